@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <backend/columns.h>
+
+static int has_extension(const char *path, const char *extension)
+{
+	size_t path_length = strlen(path), extension_length = strlen(extension);
+	return path_length > extension_length &&
+		strcasecmp(&path[path_length - extension_length], extension) == 0;
+}
+
+char columns_detect_delimiter(const char *path, const char *row, size_t length)
+{
+	if (has_extension(path, ".csv"))
+		return ',';
+	if (has_extension(path, ".tsv") || has_extension(path, ".tab"))
+		return '\t';
+
+	// the one it has most of
+	static const char candidates[] = "\t,;|";
+	char delimiter = 0;
+	size_t most = 0;
+	for (const char *c = candidates; *c != '\0'; c++) {
+		size_t n = 0;
+		for (size_t i = 0; i < length; i++)
+			n += (row[i] == *c);
+		if (n > most) {
+			most = n;
+			delimiter = *c;
+		}
+	}
+
+	return delimiter;
+}
+
+size_t columns_split(const char *row, size_t length, char delimiter,
+	struct column_field *fields, size_t max)
+{
+	size_t n = 0, start = 0;
+	char quoted = 0;
+	for (size_t i = 0; i < length && n + 1 < max; i++) {
+		if (row[i] == '"')
+			quoted = !quoted;
+		else if (row[i] == delimiter && !quoted) {
+			fields[n].start = start;
+			fields[n].length = i - start;
+			n++;
+			start = i + 1;
+		}
+	}
+	fields[n].start = start;
+	fields[n].length = length - start;
+
+	return n + 1;
+}
+
+void column_layout_init(struct column_layout *layout, char delimiter)
+{
+	layout->delimiter = delimiter;
+	layout->widths = NULL;
+	layout->n_columns = 0;
+	layout->widths_size = 0;
+	layout->version = 0;
+}
+
+void column_layout_free(struct column_layout *layout)
+{
+	free(layout->widths);
+}
+
+void column_layout_add_row(struct column_layout *layout, const char *row, size_t length)
+{
+	struct column_field fields[COLUMNS_MAX_FIELDS];
+	size_t n = columns_split(row, length, layout->delimiter, fields, COLUMNS_MAX_FIELDS);
+
+	if (n > layout->widths_size) {
+		size_t new_size = (layout->widths_size == 0) ? 16 : layout->widths_size;
+		while (new_size < n)
+			new_size *= 2;
+		layout->widths = (unsigned int *)realloc(layout->widths, new_size * sizeof(unsigned int));
+		if (layout->widths == NULL) {
+			// TODO: Critical failure. Handle in another way
+			exit(1);
+		}
+		layout->widths_size = new_size;
+	}
+	for (; layout->n_columns < n; layout->n_columns++) {
+		layout->widths[layout->n_columns] = 0;
+		layout->version++;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		size_t width = (fields[i].length < COLUMNS_MAX_WIDTH) ?
+			fields[i].length : COLUMNS_MAX_WIDTH;
+		if (width > layout->widths[i]) {
+			layout->widths[i] = width;
+			layout->version++;
+		}
+	}
+}
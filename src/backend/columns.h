@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_COLUMNS_H
+#define ENANO_COLUMNS_H
+
+#include <stddef.h>
+
+// fields after this many in a row are part of the last one
+#define COLUMNS_MAX_FIELDS 1024
+// no column is drawn wider than this
+#define COLUMNS_MAX_WIDTH 32
+
+struct column_field {
+	size_t start;
+	size_t length;
+};
+
+/*
+ * CSV/TSV rows as columns. The width of every column is the widest field
+ * seen in it so far (up to COLUMNS_MAX_WIDTH): widths only grow as rows
+ * are added, so a few sampled rows are an estimate that gets better as
+ * more of them come in, and nothing needs to see every row of the file.
+ */
+struct column_layout {
+	char delimiter;
+	unsigned int *widths;
+	size_t n_columns;
+	size_t widths_size;
+	// goes up every time a width does, or a column is added
+	size_t version;
+};
+
+// ',' for .csv files, '\t' for .tsv ones. Otherwise the one row has, or 0
+char columns_detect_delimiter(const char *path, const char *row, size_t length);
+// Splits the row into up to max fields, returns how many. A delimiter
+// between double quotes doesn't split
+size_t columns_split(const char *row, size_t length, char delimiter,
+	struct column_field *fields, size_t max);
+
+void column_layout_init(struct column_layout *layout, char delimiter);
+void column_layout_free(struct column_layout *layout);
+void column_layout_add_row(struct column_layout *layout, const char *row, size_t length);
+
+#endif /* ENANO_COLUMNS_H */
@@ -0,0 +1,716 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <backend/hex_editor.h>
+#include <common/display.h>
+#include <common/events.h>
+#include <common/stats.h>
+
+#define MAX_BYTES_PER_ROW 16
+// 16 digits of offset and MAX_BYTES_PER_ROW bytes
+#define MAX_ROW_SIZE (16 + 2 + 3 * MAX_BYTES_PER_ROW + 1 + MAX_BYTES_PER_ROW)
+// slots the patch map starts with, it's always a power of 2
+#define PATCH_MAP_MIN_SLOTS 64
+
+struct patch_block {
+	// of its first byte, a multiple of HEX_PATCH_BLOCK_SIZE
+	uint64_t offset;
+	unsigned char bytes[HEX_PATCH_BLOCK_SIZE];
+	// a bit per byte, set if it isn't the byte of the file
+	unsigned char patched[HEX_PATCH_BLOCK_SIZE / 8];
+};
+
+// Open addressing hash table of the blocks, by offset. Finding the block
+// of a byte doesn't depend on how many there are
+struct patch_map {
+	struct patch_block **slots;
+	size_t n_slots;
+	size_t n_blocks;
+};
+
+struct hex_editor_data {
+	// where we draw
+	struct display_object *display;
+	int window_nlines;
+	int window_ncols;
+
+	char *file_path;
+	struct stat file_stat;
+	int file_fd;
+	unsigned char *file_data;
+	uint64_t file_size;
+
+	struct patch_map patches;
+	// bytes that aren't the ones of the file
+	uint64_t n_patched;
+
+	// how a row is laid out: offset, bytes in hex from hex_x, the same
+	// bytes as ASCII from ascii_x
+	unsigned int offset_digits;
+	unsigned int bytes_per_row;
+	unsigned int hex_x;
+	unsigned int ascii_x;
+
+	// the byte under the cursor. Typing in the hex column sets its high
+	// half, then the low one
+	uint64_t pos;
+	char low_half;
+	char in_ascii;
+	char show_cursor;
+	char clear_window;
+
+	uint64_t top_row;
+	// the part of the file the window showed last time
+	uint64_t shown_start;
+	uint64_t shown_end;
+
+	// for the user, returned with the result of the event
+	char message[128];
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// Auxiliary functions go here
+
+static size_t patch_slot(struct patch_map *map, uint64_t offset)
+{
+	// Fibonacci hashing, the blocks next to each other go far apart
+	uint64_t hash = (offset / HEX_PATCH_BLOCK_SIZE) * 0x9e3779b97f4a7c15ull;
+	size_t slot = (hash >> 32) & (map->n_slots - 1);
+	while (map->slots[slot] != NULL && map->slots[slot]->offset != offset)
+		slot = (slot + 1) & (map->n_slots - 1);
+
+	return slot;
+}
+
+static void grow_patch_map(struct patch_map *map)
+{
+	struct patch_block **old_slots = map->slots;
+	size_t old_n_slots = map->n_slots;
+	map->n_slots = (old_n_slots == 0) ? PATCH_MAP_MIN_SLOTS : old_n_slots * 2;
+	map->slots = (struct patch_block **)calloc(map->n_slots, sizeof(struct patch_block *));
+	if (map->slots == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+
+	for (size_t i = 0; i < old_n_slots; i++)
+		if (old_slots[i] != NULL)
+			map->slots[patch_slot(map, old_slots[i]->offset)] = old_slots[i];
+	free(old_slots);
+}
+
+// the block of the byte at offset, NULL if it was never overwritten
+static struct patch_block *find_patch_block(struct patch_map *map, uint64_t offset)
+{
+	if (map->n_blocks == 0)
+		return NULL;
+
+	return map->slots[patch_slot(map, offset / HEX_PATCH_BLOCK_SIZE * HEX_PATCH_BLOCK_SIZE)];
+}
+
+// the block of the byte at offset, created if needed
+static struct patch_block *get_patch_block(struct patch_map *map, uint64_t offset)
+{
+	// never more than half full
+	if ((map->n_blocks + 1) * 2 > map->n_slots)
+		grow_patch_map(map);
+
+	offset = offset / HEX_PATCH_BLOCK_SIZE * HEX_PATCH_BLOCK_SIZE;
+	size_t slot = patch_slot(map, offset);
+	if (map->slots[slot] == NULL) {
+		struct patch_block *block = (struct patch_block *)calloc(1, sizeof(struct patch_block));
+		if (block == NULL) {
+			// TODO: Critical failure. Handle in another way
+			exit(1);
+		}
+		block->offset = offset;
+		map->slots[slot] = block;
+		map->n_blocks++;
+	}
+
+	return map->slots[slot];
+}
+
+static void free_patch_map(struct patch_map *map)
+{
+	for (size_t i = 0; i < map->n_slots; i++)
+		free(map->slots[i]);
+	free(map->slots);
+}
+
+static int byte_is_patched(struct patch_block *block, uint64_t offset)
+{
+	size_t i = offset % HEX_PATCH_BLOCK_SIZE;
+	return block != NULL && (block->patched[i / 8] >> (i % 8)) & 1;
+}
+
+static unsigned char byte_at(struct hex_editor_data *p, uint64_t offset)
+{
+	struct patch_block *block = find_patch_block(&p->patches, offset);
+	return byte_is_patched(block, offset) ?
+		block->bytes[offset % HEX_PATCH_BLOCK_SIZE] : p->file_data[offset];
+}
+
+static void set_byte(struct hex_editor_data *p, uint64_t offset, unsigned char value)
+{
+	struct patch_block *block = find_patch_block(&p->patches, offset);
+	// putting back the byte of the file doesn't need a block
+	if (block == NULL && value == p->file_data[offset])
+		return;
+	if (block == NULL)
+		block = get_patch_block(&p->patches, offset);
+
+	size_t i = offset % HEX_PATCH_BLOCK_SIZE;
+	char was_patched = byte_is_patched(block, offset);
+	char patched = (value != p->file_data[offset]);
+	block->bytes[i] = value;
+	if (patched)
+		block->patched[i / 8] |= 1 << (i % 8);
+	else
+		block->patched[i / 8] &= ~(1 << (i % 8));
+	p->n_patched += patched - was_patched;
+}
+
+static unsigned int row_width(unsigned int offset_digits, unsigned int bytes_per_row)
+{
+	return offset_digits + 2 + 3 * bytes_per_row + 1 + bytes_per_row;
+}
+
+static void compute_layout(struct hex_editor_data *p)
+{
+	// enough for the last offset, 8 at least
+	p->offset_digits = 8;
+	while (p->offset_digits < 16 && (p->file_size >> (4 * p->offset_digits)) > 0)
+		p->offset_digits++;
+
+	// as many as fit, a power of 2 so a row never crosses a patch block
+	p->bytes_per_row = MAX_BYTES_PER_ROW;
+	while (p->bytes_per_row > 1 &&
+		row_width(p->offset_digits, p->bytes_per_row) > p->window_ncols)
+		p->bytes_per_row /= 2;
+
+	p->hex_x = p->offset_digits + 2;
+	p->ascii_x = p->hex_x + 3 * p->bytes_per_row + 1;
+}
+
+// Writes the row of the n bytes from offset to row, returns its length.
+// block is the patch block of the row (if any)
+static unsigned int format_row(struct hex_editor_data *p, uint64_t offset, size_t n,
+	struct patch_block *block, char *row)
+{
+	memset(row, ' ', p->ascii_x);
+	for (unsigned int i = 0; i < p->offset_digits; i++)
+		row[p->offset_digits - 1 - i] = hex_digits[(offset >> (4 * i)) & 0xf];
+
+	for (size_t i = 0; i < n; i++) {
+		unsigned char c = byte_is_patched(block, offset + i) ?
+			block->bytes[(offset + i) % HEX_PATCH_BLOCK_SIZE] : p->file_data[offset + i];
+		row[p->hex_x + 3 * i] = hex_digits[c >> 4];
+		row[p->hex_x + 3 * i + 1] = hex_digits[c & 0xf];
+		row[p->ascii_x + i] = (32 <= c && c < 127) ? c : '.';
+	}
+
+	return p->ascii_x + n;
+}
+
+// drops the pages of [start, end) of the file, the kernel reads them again
+// if someone needs them
+static void release_file_range(struct hex_editor_data *p, uint64_t start, uint64_t end)
+{
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+	start = (start + page_size - 1) / page_size * page_size;
+	end = end / page_size * page_size;
+	if (start < end)
+		madvise(&p->file_data[start], end - start, MADV_DONTNEED);
+}
+
+static void move_to(struct hex_editor_data *p, uint64_t pos)
+{
+	p->pos = pos;
+	p->low_half = 0;
+}
+
+// No insertions: the cursor never goes past the last byte
+static void move_cursor_left(struct hex_editor_data *p)
+{
+	if (p->pos > 0)
+		move_to(p, p->pos - 1);
+	p->low_half = 0;
+}
+
+static void move_cursor_right(struct hex_editor_data *p)
+{
+	if (p->pos + 1 < p->file_size)
+		move_to(p, p->pos + 1);
+	p->low_half = 0;
+}
+
+static void move_cursor_up(struct hex_editor_data *p)
+{
+	if (p->pos >= p->bytes_per_row)
+		move_to(p, p->pos - p->bytes_per_row);
+}
+
+static void move_cursor_down(struct hex_editor_data *p)
+{
+	if (p->pos + p->bytes_per_row < p->file_size)
+		move_to(p, p->pos + p->bytes_per_row);
+}
+
+static int hex_value(int c)
+{
+	if ('0' <= c && c <= '9')
+		return c - '0';
+	if ('a' <= c && c <= 'f')
+		return c - 'a' + 10;
+	if ('A' <= c && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+// A hex digit in the hex column, any character in the ASCII one. Tab
+// switches between them
+static void character_entered(struct hex_editor_data *p, int c)
+{
+	if (c == '\t') {
+		p->in_ascii = !p->in_ascii;
+		p->low_half = 0;
+		return;
+	}
+	if (p->pos >= p->file_size) {
+		snprintf(p->message, sizeof(p->message),
+			"Nothing to overwrite, bytes can't be inserted in the hex view");
+		return;
+	}
+
+	if (p->in_ascii)
+		set_byte(p, p->pos, c);
+	else {
+		int value = hex_value(c);
+		if (value < 0) {
+			snprintf(p->message, sizeof(p->message), "Not a hex digit");
+			return;
+		}
+		unsigned char byte = byte_at(p, p->pos);
+		byte = p->low_half ? (byte & 0xf0) | value : (byte & 0x0f) | (value << 4);
+		set_byte(p, p->pos, byte);
+		if (!p->low_half) {
+			p->low_half = 1;
+			return;
+		}
+	}
+	move_cursor_right(p);
+}
+
+// Puts back the byte of the file before the cursor (or under it, if half
+// of it was typed)
+static void delete_key_entered(struct hex_editor_data *p)
+{
+	if (!p->low_half) {
+		if (p->pos == 0)
+			return;
+		p->pos--;
+	}
+	p->low_half = 0;
+	set_byte(p, p->pos, p->file_data[p->pos]);
+}
+
+// Offsets can be decimal, or hex starting with 0x
+static void go_to(struct hex_editor_data *p, struct go_to_data *data)
+{
+	char *end;
+	errno = 0;
+	unsigned long long offset = strtoull(data->position, &end, 0);
+	if (end == data->position || *end != '\0' || errno != 0) {
+		snprintf(p->message, sizeof(p->message), "Not an offset: %s", data->position);
+		return;
+	}
+	if (offset >= p->file_size) {
+		snprintf(p->message, sizeof(p->message), "The file has %llu bytes",
+			(unsigned long long)p->file_size);
+		return;
+	}
+
+	// the row of the offset, in the middle of the window
+	move_to(p, offset);
+	uint64_t row = offset / p->bytes_per_row;
+	p->top_row = (row > p->window_nlines / 2) ? row - p->window_nlines / 2 : 0;
+	p->clear_window = 1;
+}
+
+// The file keeps its size, so the blocks are written over it where they
+// go: saving takes as long as there are edits, not as the file is. The
+// bytes are the ones of the file after that, and the patches go away
+static int save_buffer(struct hex_editor_data *p, char *path)
+{
+	uint64_t start_ns = stats_now_ns();
+	int fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	int ret = 0;
+	size_t bytes_written = 0;
+	unsigned char bytes[HEX_PATCH_BLOCK_SIZE];
+	for (size_t i = 0; i < p->patches.n_slots && ret == 0; i++) {
+		struct patch_block *block = p->patches.slots[i];
+		if (block == NULL)
+			continue;
+
+		size_t n = p->file_size - block->offset;
+		if (n > HEX_PATCH_BLOCK_SIZE)
+			n = HEX_PATCH_BLOCK_SIZE;
+		for (size_t j = 0; j < n; j++)
+			bytes[j] = byte_is_patched(block, block->offset + j) ?
+				block->bytes[j] : p->file_data[block->offset + j];
+		for (size_t written = 0; written < n;) {
+			ssize_t r = pwrite(fd, &bytes[written], n - written, block->offset + written);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r < 0) {
+				ret = -errno;
+				break;
+			}
+			written += r;
+		}
+		bytes_written += n;
+	}
+	if (ret == 0 && fsync(fd) < 0)
+		ret = -errno;
+	if (close(fd) < 0 && ret == 0)
+		ret = -errno;
+	if (ret < 0)
+		return ret;
+
+	uint64_t n_patched = p->n_patched;
+	free_patch_map(&p->patches);
+	p->patches.slots = NULL;
+	p->patches.n_slots = 0;
+	p->patches.n_blocks = 0;
+	p->n_patched = 0;
+
+	uint64_t end_ns = stats_now_ns();
+	editor_stats.save_ns = end_ns - start_ns;
+	editor_stats.n_saves++;
+	editor_stats.save_bytes_written = bytes_written;
+	editor_stats.save_bytes_copied = 0;
+	trace_record("save", "io", start_ns, end_ns);
+
+	snprintf(p->message, sizeof(p->message),
+		"Saved: %llu bytes overwritten (%.1f ms)",
+		(unsigned long long)n_patched, (end_ns - start_ns) / 1000000.0);
+
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------//
+
+// Event handling functions
+
+static void handle_event_save_buffer
+(struct hex_editor_data *p, struct event *event, struct result *result)
+{
+	if (save_buffer(p, p->file_path) < 0)
+		result->result_type = ERROR_OCCURRED_ERRNO_SET;
+}
+
+static void handle_event_show_cursor
+(struct hex_editor_data *p, struct event *event, struct result *result)
+{
+	p->show_cursor = 1;
+}
+
+static void handle_event_hide_cursor
+(struct hex_editor_data *p, struct event *event, struct result *result)
+{
+	p->show_cursor = 0;
+}
+
+static void handle_event_move_cursor_left
+(struct hex_editor_data *p, struct event *event, struct result *result)
+{
+	move_cursor_left(p);
+}
+
+static void handle_event_move_cursor_right
+(struct hex_editor_data *p, struct event *event, struct result *result)
+{
+	move_cursor_right(p);
+}
+
+static void handle_event_move_cursor_up
+(struct hex_editor_data *p, struct event *event, struct result *result)
+{
+	move_cursor_up(p);
+}
+
+static void handle_event_move_cursor_down
+(struct hex_editor_data *p, struct event *event, struct result *result)
+{
+	move_cursor_down(p);
+}
+
+static void handle_event_character_entered
+(struct hex_editor_data *p, struct event *event, struct result *result)
+{
+	character_entered(p, *(int *)event->additional_data);
+}
+
+static void handle_event_delete_key_entered
+(struct hex_editor_data *p, struct event *event, struct result *result)
+{
+	delete_key_entered(p);
+}
+
+static void handle_event_go_to
+(struct hex_editor_data *p, struct event *event, struct result *result)
+{
+	go_to(p, (struct go_to_data *)event->additional_data);
+}
+
+// Events without a handler are the text editing ones, which make no sense
+// here. The user gets told, except for ticks
+static void (*event_handler_table[NR_EVENTS])
+(struct hex_editor_data *p, struct event *event, struct result *result) = {
+	[EVENT_SAVE_BUFFER] = handle_event_save_buffer,
+	[EVENT_SHOW_CURSOR] = handle_event_show_cursor,
+	[EVENT_HIDE_CURSOR] = handle_event_hide_cursor,
+	[EVENT_MOVE_CURSOR_LEFT] = handle_event_move_cursor_left,
+	[EVENT_MOVE_CURSOR_RIGHT] = handle_event_move_cursor_right,
+	[EVENT_MOVE_CURSOR_UP] = handle_event_move_cursor_up,
+	[EVENT_MOVE_CURSOR_DOWN] = handle_event_move_cursor_down,
+	[EVENT_CHARACTER_ENTERED] = handle_event_character_entered,
+	[EVENT_DELETE_KEY_ENTERED] = handle_event_delete_key_entered,
+	[EVENT_GO_TO] = handle_event_go_to
+};
+
+//---------------------------------------------------------------------------------------//
+
+// Functions that implement the editor_object interface defined at common/interface.h
+
+int hex_editor_file_is_binary(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	char start[HEX_DETECTION_SIZE];
+	ssize_t n = read(fd, start, sizeof(start));
+	close(fd);
+
+	return n > 0 && memchr(start, '\0', n) != NULL;
+}
+
+static int init_hex_editor(struct editor_object *self, const char *path, struct display_object *display)
+{
+	int ret = 0;
+	uint64_t start_ns = stats_now_ns();
+	struct hex_editor_data *p = (struct hex_editor_data *)malloc(sizeof(struct hex_editor_data));
+	if (p == NULL)
+		return -errno;
+
+	self->data = (void *)p;
+
+	p->display = display;
+	p->window_nlines = display->nlines;
+	p->window_ncols = display->ncols;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		ret = -errno;
+		goto err_opening_file;
+	}
+
+	if (fstat(fd, &p->file_stat) < 0) {
+		ret = -errno;
+		goto err_stating_file;
+	}
+
+	size_t path_size = strlen(path) + 1;
+	p->file_path = (char *)malloc(path_size * sizeof(char));
+	if (p->file_path == NULL) {
+		ret = -errno;
+		goto err_malloc_path_size;
+	}
+	strncpy(p->file_path, path, path_size);
+	p->file_fd = fd;
+
+	// the pages are read as they're shown, nothing is read now
+	p->file_size = p->file_stat.st_size;
+	p->file_data = NULL;
+	if (p->file_size > 0) {
+		p->file_data = (unsigned char *)mmap(NULL, p->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p->file_data == MAP_FAILED) {
+			ret = -errno;
+			goto err_mapping_file;
+		}
+	}
+
+	p->patches.slots = NULL;
+	p->patches.n_slots = 0;
+	p->patches.n_blocks = 0;
+	p->n_patched = 0;
+	compute_layout(p);
+	p->pos = 0;
+	p->low_half = 0;
+	p->in_ascii = 0;
+	p->show_cursor = 1;
+	p->clear_window = 0;
+	p->top_row = 0;
+	p->shown_start = p->shown_end = 0;
+
+	uint64_t end_ns = stats_now_ns();
+	editor_stats.load_ns = end_ns - start_ns;
+	trace_record("load", "io", start_ns, end_ns);
+
+	return 0;
+
+err_mapping_file:
+	free(p->file_path);
+err_malloc_path_size:
+err_stating_file:
+	close(fd);
+err_opening_file:
+	free(p);
+	return ret;
+}
+
+static void uninit_hex_editor(struct editor_object *self)
+{
+	struct hex_editor_data *p = (struct hex_editor_data *)self->data;
+
+	free_patch_map(&p->patches);
+	if (p->file_data != NULL)
+		munmap(p->file_data, p->file_size);
+	close(p->file_fd);
+	free(p->file_path);
+	free(p);
+}
+
+static void hex_editor_handle_event
+(struct editor_object *self, struct event *event, struct result *result)
+{
+	struct hex_editor_data *p = (struct hex_editor_data *)self->data;
+
+	result->additional_data = NULL;
+	if (event->event_type >= NR_EVENTS) {
+		result->result_type = ERROR_EVENT_NOT_FOUND;
+		return;
+	}
+
+	p->message[0] = '\0';
+	// the event handler may override this
+	result->result_type = EVENT_HANDLING_SUCCESS;
+	if (event_handler_table[event->event_type] != NULL)
+		event_handler_table[event->event_type](p, event, result);
+	else if (event->event_type != EVENT_TICK && event->event_type != EVENT_VOID)
+		snprintf(p->message, sizeof(p->message), "Not available in the hex view");
+
+	if (p->message[0] != '\0')
+		result->additional_data = (void *)p->message;
+}
+
+static void hex_editor_refresh(struct editor_object *self)
+{
+	struct hex_editor_data *p = (struct hex_editor_data *)self->data;
+
+	uint64_t cursor_row = p->pos / p->bytes_per_row;
+	if (cursor_row < p->top_row) {
+		p->top_row = cursor_row;
+		p->clear_window = 1;
+	}
+	else if (cursor_row >= p->top_row + p->window_nlines) {
+		p->top_row = cursor_row - p->window_nlines + 1;
+		p->clear_window = 1;
+	}
+	if (p->clear_window) {
+		p->display->clear(p->display);
+		p->clear_window = 0;
+	}
+
+	char row[MAX_ROW_SIZE];
+	for (int i = 0; i < p->window_nlines; i++) {
+		uint64_t offset = (p->top_row + i) * p->bytes_per_row;
+		if (offset >= p->file_size) {
+			p->display->clear_line(p->display, i, 0);
+			continue;
+		}
+
+		size_t n = p->file_size - offset;
+		if (n > p->bytes_per_row)
+			n = p->bytes_per_row;
+		struct patch_block *block = find_patch_block(&p->patches, offset);
+		unsigned int length = format_row(p, offset, n, block, row);
+		p->display->put_str(p->display, i, 0, row, length, DISPLAY_ATTRIBUTE_NORMAL);
+		p->display->clear_line(p->display, i, length);
+
+		// the overwritten bytes stand out
+		for (size_t j = 0; block != NULL && j < n; j++) {
+			if (!byte_is_patched(block, offset + j))
+				continue;
+			p->display->put_str(p->display, i, p->hex_x + 3 * j, &row[p->hex_x + 3 * j], 2,
+				DISPLAY_ATTRIBUTE_BOLD);
+			p->display->put_str(p->display, i, p->ascii_x + j, &row[p->ascii_x + j], 1,
+				DISPLAY_ATTRIBUTE_BOLD);
+		}
+
+		// the byte under the cursor, in the column we aren't typing in
+		if (p->top_row + i == cursor_row) {
+			size_t j = p->pos - offset;
+			unsigned int x = p->in_ascii ? p->hex_x + 3 * j : p->ascii_x + j;
+			p->display->put_str(p->display, i, x, &row[x], p->in_ascii ? 2 : 1,
+				DISPLAY_ATTRIBUTE_REVERSE);
+		}
+	}
+
+	size_t column = p->pos % p->bytes_per_row;
+	unsigned int cursor_x = p->in_ascii ? p->ascii_x + column :
+		p->hex_x + 3 * column + p->low_half;
+	if (p->show_cursor)
+		p->display->move_cursor(p->display, cursor_row - p->top_row, cursor_x);
+	p->display->show_cursor(p->display, p->show_cursor);
+
+	p->display->flush(p->display);
+
+	// once the frame is out: the part of the file we stopped showing goes
+	// back to the kernel, so moving around doesn't add up
+	uint64_t shown_start = p->top_row * p->bytes_per_row;
+	uint64_t shown_end = shown_start + (uint64_t)p->window_nlines * p->bytes_per_row;
+	if (shown_end > p->file_size)
+		shown_end = p->file_size;
+	if (shown_end <= p->shown_start || shown_start >= p->shown_end)
+		release_file_range(p, p->shown_start, p->shown_end);
+	p->shown_start = shown_start;
+	p->shown_end = shown_end;
+}
+
+struct editor_object hex_editor_object = {
+	.data = NULL,
+	.init = init_hex_editor,
+	.uninit = uninit_hex_editor,
+	.handle_event = hex_editor_handle_event,
+	.refresh_ = hex_editor_refresh
+};
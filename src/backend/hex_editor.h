@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_HEX_EDITOR_H
+#define ENANO_HEX_EDITOR_H
+
+#include <common/interface.h>
+
+// the bytes of the file a patch block covers
+#define HEX_PATCH_BLOCK_SIZE 256
+// how much of the start of a file is looked at to tell if it's binary
+#define HEX_DETECTION_SIZE 8192
+
+/*
+ * The hex view: offsets, bytes in hex and the same bytes as ASCII, drawn
+ * straight from a mapping of the file. Bytes can only be overwritten, so
+ * every offset stays where it is: going to one is a division, and the
+ * edits are kept apart in a map of blocks of HEX_PATCH_BLOCK_SIZE bytes
+ * (only the blocks with edits exist), which saving writes over the file.
+ * The memory it takes depends on the edits and the window, never on the
+ * size of the file.
+ */
+extern struct editor_object hex_editor_object;
+
+// there's a '\0' in the start of the file, which text has no business
+// having. Returns 0 if it can't tell
+int hex_editor_file_is_binary(const char *path);
+
+#endif /* ENANO_HEX_EDITOR_H */
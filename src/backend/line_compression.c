@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <backend/line_compression.h>
+#include <common/stats.h>
+
+// A small LZ77 codec (the format is the one of LZ4 blocks). The input is
+// a sequence of:
+//  - a token: number of literals (high 4 bits) and match length - 4 (low
+//    4 bits). 15 means "add the bytes that follow until one isn't 255"
+//  - the literals
+//  - the offset of the match (2 bytes, little endian) and the rest of its
+//    length
+// The last sequence has only literals
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+// what compressing n bytes can take at most
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+struct compressed_lines_header {
+	size_t raw_size;
+	size_t compressed_size;
+};
+
+// both codecs work here, lines are only compressed from the main thread
+static unsigned char raw_buffer[COMPRESSED_LINES_MAX_SIZE];
+static unsigned char compressed_buffer[LZ_BOUND(COMPRESSED_LINES_MAX_SIZE)];
+
+static uint32_t read32(const unsigned char *p)
+{
+	uint32_t ret;
+	memcpy(&ret, p, sizeof(ret));
+	return ret;
+}
+
+static unsigned int lz_hash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *put_length(unsigned char *out, size_t length)
+{
+	for (; length >= 255; length -= 255)
+		*out++ = 255;
+	*out++ = length;
+	return out;
+}
+
+static unsigned char *put_sequence(unsigned char *out, const unsigned char *literals,
+	size_t n_literals, size_t offset, size_t match_length)
+{
+	size_t match_code = match_length - LZ_MIN_MATCH;
+	*out++ = ((n_literals < 15) ? n_literals : 15) << 4 |
+		((match_length == 0) ? 0 : (match_code < 15) ? match_code : 15);
+	if (n_literals >= 15)
+		out = put_length(out, n_literals - 15);
+	memcpy(out, literals, n_literals);
+	out += n_literals;
+
+	// the last sequence
+	if (match_length == 0)
+		return out;
+
+	*out++ = offset & 0xff;
+	*out++ = offset >> 8;
+	if (match_code >= 15)
+		out = put_length(out, match_code - 15);
+
+	return out;
+}
+
+static size_t lz_compress(const unsigned char *in, size_t n, unsigned char *out)
+{
+	// where the last 4 bytes with every hash were seen, + 1
+	uint32_t table[1 << LZ_HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	unsigned char *it = out;
+	size_t anchor = 0;
+	for (size_t i = 0; i + LZ_MIN_MATCH <= n;) {
+		uint32_t v = read32(&in[i]);
+		unsigned int h = lz_hash(v);
+		size_t candidate = table[h];
+		table[h] = i + 1;
+		if (candidate == 0 || i - (candidate - 1) > LZ_MAX_OFFSET ||
+			read32(&in[candidate - 1]) != v) {
+			i++;
+			continue;
+		}
+
+		candidate--;
+		size_t match_length = LZ_MIN_MATCH;
+		while (i + match_length < n && in[candidate + match_length] == in[i + match_length])
+			match_length++;
+
+		it = put_sequence(it, &in[anchor], i - anchor, i - candidate, match_length);
+		i += match_length;
+		anchor = i;
+	}
+	it = put_sequence(it, &in[anchor], n - anchor, 0, 0);
+
+	return it - out;
+}
+
+// Returns 0 if in isn't the compressed form of out_size bytes
+static int lz_decompress(const unsigned char *in, size_t n, unsigned char *out, size_t out_size)
+{
+	const unsigned char *end = &in[n];
+	size_t o = 0;
+	while (in < end) {
+		unsigned int token = *in++;
+		size_t n_literals = token >> 4;
+		if (n_literals == 15) {
+			unsigned int c;
+			do {
+				if (in == end)
+					return 0;
+				c = *in++;
+				n_literals += c;
+			} while (c == 255);
+		}
+		if (n_literals > (size_t)(end - in) || n_literals > out_size - o)
+			return 0;
+		memcpy(&out[o], in, n_literals);
+		in += n_literals;
+		o += n_literals;
+
+		if (in == end)
+			break;
+
+		if (end - in < 2)
+			return 0;
+		size_t offset = in[0] | in[1] << 8;
+		in += 2;
+		size_t match_length = (token & 15) + LZ_MIN_MATCH;
+		if ((token & 15) == 15) {
+			unsigned int c;
+			do {
+				if (in == end)
+					return 0;
+				c = *in++;
+				match_length += c;
+			} while (c == 255);
+		}
+		if (offset == 0 || offset > o || match_length > out_size - o)
+			return 0;
+		// byte by byte, the match can overlap what it writes
+		for (size_t i = 0; i < match_length; i++, o++)
+			out[o] = out[o - offset];
+	}
+
+	return o == out_size;
+}
+
+int compress_lines(struct line_linked_list_node *first, size_t n)
+{
+	uint64_t start_ns = stats_now_ns();
+
+	size_t raw_size = 0;
+	struct line_linked_list_node *it = first;
+	for (size_t i = 0; i < n; i++, it = it->next) {
+		memcpy(&raw_buffer[raw_size], it->line.line_str, it->line.length);
+		raw_size += it->line.length;
+	}
+
+	size_t compressed_size = lz_compress(raw_buffer, raw_size, compressed_buffer);
+	// the lines are in the heap one by one, and the block takes a bit of
+	// memory itself
+	if (compressed_size + sizeof(struct compressed_lines_header) >= raw_size / 4 * 3)
+		return 0;
+
+	struct line_storage *block =
+		line_storage_alloc(sizeof(struct compressed_lines_header) + compressed_size);
+	struct compressed_lines_header *header = (struct compressed_lines_header *)block->data;
+	header->raw_size = raw_size;
+	header->compressed_size = compressed_size;
+	memcpy(&block->data[sizeof(*header)], compressed_buffer, compressed_size);
+
+	it = first;
+	for (size_t i = 0; i < n; i++, it = it->next) {
+		size_t length = it->line.length;
+		line_clear(&it->line);
+		line_set_span(&it->line, block, NULL, length);
+	}
+	line_storage_unref(block);
+
+	editor_stats.compressed_raw_bytes += raw_size;
+	editor_stats.compressed_bytes += compressed_size;
+	trace_record("compress_lines", "compression", start_ns, stats_now_ns());
+	return 1;
+}
+
+const char *read_compressed_lines(struct line_storage *block)
+{
+	uint64_t start_ns = stats_now_ns();
+	struct compressed_lines_header *header = (struct compressed_lines_header *)block->data;
+	if (!lz_decompress((unsigned char *)&block->data[sizeof(*header)], header->compressed_size,
+		raw_buffer, header->raw_size)) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+
+	uint64_t end_ns = stats_now_ns();
+	latency_histogram_add(&editor_stats.decompress_latency, end_ns - start_ns);
+	trace_record("decompress_lines", "compression", start_ns, end_ns);
+	return (const char *)raw_buffer;
+}
+
+void decompress_lines(struct line_linked_list_node *node)
+{
+	struct line_storage *block = node->line.storage;
+	struct compressed_lines_header *header = (struct compressed_lines_header *)block->data;
+	editor_stats.compressed_raw_bytes -= header->raw_size;
+	editor_stats.compressed_bytes -= header->compressed_size;
+
+	struct line_linked_list_node *first = node;
+	while (first->prev != NULL && first->prev->line.storage == block)
+		first = first->prev;
+	size_t n = 0;
+	for (struct line_linked_list_node *it = first; it != NULL && it->line.storage == block;
+		it = it->next)
+		n++;
+
+	const char *contents = read_compressed_lines(block);
+	// every line gets its own storage back, as they were
+	struct line_linked_list_node *it = first;
+	for (size_t i = 0; i < n; i++, it = it->next) {
+		size_t length = it->line.length;
+		struct line_storage *storage = line_storage_alloc(length + 1);
+		memcpy(storage->data, contents, length);
+		storage->data[length] = '\0';
+		contents += length;
+
+		// the last one frees the block
+		line_clear(&it->line);
+		line_set_span(&it->line, storage, storage->data, length);
+		line_storage_unref(storage);
+	}
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_LINE_COMPRESSION_H
+#define ENANO_LINE_COMPRESSION_H
+
+#include <stddef.h>
+
+#include <backend/lines.h>
+
+// the most bytes of lines a block can hold
+#define COMPRESSED_LINES_MAX_SIZE (64 * 1024)
+
+/*
+ * Lines nobody is looking at can be compressed together in a block. The
+ * block is their storage, but they have no line_str, so their contents
+ * can't be read until the block is decompressed (and every line gets its
+ * contents back). Only the lengths of the lines are kept.
+ */
+static inline int line_is_compressed(struct line *line)
+{
+	return line->storage != NULL && line->line_str == NULL;
+}
+
+// Compresses the n lines starting at first, which can't take more than
+// COMPRESSED_LINES_MAX_SIZE bytes and must own their (writable) storage.
+// Returns 0 if they weren't compressed because it wasn't worth it
+int compress_lines(struct line_linked_list_node *first, size_t n);
+// Decompresses the block of node (a compressed line), in the list
+void decompress_lines(struct line_linked_list_node *node);
+// Returns the contents of the lines of the block, one after the other
+// (without '\n'), leaving the lines compressed. They're valid until the
+// next call
+const char *read_compressed_lines(struct line_storage *block);
+
+#endif /* ENANO_LINE_COMPRESSION_H */
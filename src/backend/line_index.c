@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <backend/line_index.h>
+#include <common/stats.h>
+
+#define LINE_INDEX_MAGIC "ENANOLIX"
+#define LINE_INDEX_VERSION 1
+// the hash covers this many blocks, spread evenly over the file
+#define HASH_SAMPLES 64
+#define HASH_BLOCK_SIZE 4096
+
+struct line_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t stride;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t sample_hash;
+	uint64_t n_newlines;
+	uint64_t n_offsets;
+	// followed by n_offsets uint64_t
+};
+
+// FNV-1a
+static uint64_t hash_bytes(uint64_t hash, const char *data, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static uint64_t sample_hash(const char *data, size_t size)
+{
+	uint64_t hash = hash_bytes(0xcbf29ce484222325ull, (const char *)&size, sizeof(size));
+	if (size <= HASH_SAMPLES * HASH_BLOCK_SIZE)
+		return hash_bytes(hash, data, size);
+
+	// the first and the last blocks are always part of the samples
+	for (size_t i = 0; i < HASH_SAMPLES; i++) {
+		size_t offset = i * ((size - HASH_BLOCK_SIZE) / (HASH_SAMPLES - 1));
+		hash = hash_bytes(hash, &data[offset], HASH_BLOCK_SIZE);
+	}
+
+	return hash;
+}
+
+// $XDG_CACHE_HOME/enano/<dev>-<ino>.lidx (or ~/.cache/enano/...). The
+// directories are created if create is set
+static int cache_path(char *path, size_t path_size, const struct stat *st, char create)
+{
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int length;
+	if (cache_home != NULL && cache_home[0] != '\0')
+		length = snprintf(path, path_size, "%s", cache_home);
+	else if (home != NULL && home[0] != '\0')
+		length = snprintf(path, path_size, "%s/.cache", home);
+	else
+		return -ENOENT;
+
+	if (create)
+		mkdir(path, 0700);
+	length += snprintf(&path[length], path_size - length, "/enano");
+	if (create)
+		mkdir(path, 0700);
+
+	length += snprintf(&path[length], path_size - length, "/%llx-%llx.lidx",
+		(unsigned long long)st->st_dev, (unsigned long long)st->st_ino);
+	if (length >= path_size)
+		return -ENAMETOOLONG;
+
+	return 0;
+}
+
+static void fill_header(struct line_index_header *header, const char *data, const struct stat *st)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, LINE_INDEX_MAGIC, sizeof(header->magic));
+	header->version = LINE_INDEX_VERSION;
+	header->stride = LINE_INDEX_STRIDE;
+	header->dev = st->st_dev;
+	header->ino = st->st_ino;
+	header->size = st->st_size;
+	header->mtime_sec = st->st_mtim.tv_sec;
+	header->mtime_nsec = st->st_mtim.tv_nsec;
+	header->sample_hash = sample_hash(data, st->st_size);
+}
+
+static int load_cached_index(struct line_index *index, const char *data, const struct stat *st)
+{
+	char path[4096];
+	int ret = cache_path(path, sizeof(path), st, 0);
+	if (ret < 0)
+		return ret;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	struct stat cache_st;
+	if (fstat(fd, &cache_st) < 0 || cache_st.st_size < sizeof(struct line_index_header)) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	void *map = mmap(NULL, cache_st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	struct line_index_header expected;
+	fill_header(&expected, data, st);
+	struct line_index_header *header = (struct line_index_header *)map;
+	expected.n_newlines = header->n_newlines;
+	expected.n_offsets = header->n_offsets;
+	if (memcmp(header, &expected, sizeof(expected)) != 0 ||
+		cache_st.st_size != sizeof(*header) + header->n_offsets * sizeof(uint64_t)) {
+		munmap(map, cache_st.st_size);
+		return -EINVAL;
+	}
+
+	index->n_newlines = header->n_newlines;
+	index->offsets = (const uint64_t *)&header[1];
+	index->n_offsets = header->n_offsets;
+	index->map = map;
+	index->map_size = cache_st.st_size;
+
+	return 0;
+}
+
+// while building the index we give back the pages of the file we're done
+// with every this many bytes, so reading a file doesn't mean having all of
+// it in memory
+#define BUILD_RELEASE_CHUNK (8 * 1024 * 1024)
+
+static int build_index(struct line_index *index, const char *data, size_t size)
+{
+	size_t released = 0;
+	size_t offsets_size = 1024;
+	uint64_t *offsets = (uint64_t *)malloc(offsets_size * sizeof(uint64_t));
+	if (offsets == NULL)
+		return -errno;
+
+	offsets[0] = 0;
+	index->n_offsets = 1;
+	index->n_newlines = 0;
+	for (const char *it = data; size > 0 && (it = memchr(it, '\n', &data[size] - it)) != NULL;) {
+		it++;
+		if (++index->n_newlines % LINE_INDEX_STRIDE != 0)
+			continue;
+
+		if (index->n_offsets == offsets_size) {
+			offsets_size *= 2;
+			uint64_t *new_offsets = (uint64_t *)realloc(offsets, offsets_size * sizeof(uint64_t));
+			if (new_offsets == NULL) {
+				free(offsets);
+				return -ENOMEM;
+			}
+			offsets = new_offsets;
+		}
+		offsets[index->n_offsets++] = it - data;
+
+		if (it - data - released >= BUILD_RELEASE_CHUNK) {
+			madvise((void *)&data[released], BUILD_RELEASE_CHUNK, MADV_DONTNEED);
+			released += BUILD_RELEASE_CHUNK;
+		}
+	}
+
+	index->offsets = offsets;
+	index->map = NULL;
+	index->map_size = 0;
+
+	return 0;
+}
+
+// The cache is written to a temporary file and renamed, so nobody can
+// map a half written one
+static int save_index(struct line_index *index, const char *data, const struct stat *st)
+{
+	char path[4096], tmp_path[4096 + 32];
+	int ret = cache_path(path, sizeof(path), st, 1);
+	if (ret < 0)
+		return ret;
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+
+	FILE *descriptor = fopen(tmp_path, "w");
+	if (!descriptor)
+		return -errno;
+
+	struct line_index_header header;
+	fill_header(&header, data, st);
+	header.n_newlines = index->n_newlines;
+	header.n_offsets = index->n_offsets;
+	if (fwrite(&header, sizeof(header), 1, descriptor) != 1 ||
+		fwrite(index->offsets, sizeof(uint64_t), index->n_offsets, descriptor) != index->n_offsets) {
+		ret = -errno;
+		fclose(descriptor);
+		unlink(tmp_path);
+		return ret;
+	}
+
+	if (fclose(descriptor) != 0 || rename(tmp_path, path) < 0) {
+		ret = -errno;
+		unlink(tmp_path);
+		return ret;
+	}
+
+	return 0;
+}
+
+int line_index_load(struct line_index *index, const char *data, const struct stat *st)
+{
+	uint64_t start_ns = stats_now_ns();
+	if (load_cached_index(index, data, st) == 0) {
+		trace_record("line_index_cached", "io", start_ns, stats_now_ns());
+		return 0;
+	}
+
+	int ret = build_index(index, data, st->st_size);
+	if (ret < 0)
+		return ret;
+	// not having a cache just makes the next open slower
+	save_index(index, data, st);
+	trace_record("line_index_build", "io", start_ns, stats_now_ns());
+
+	return 0;
+}
+
+void line_index_free(struct line_index *index)
+{
+	if (index->map != NULL)
+		munmap(index->map, index->map_size);
+	else
+		free((void *)index->offsets);
+}
+
+void line_index_remove_cache(const struct stat *st)
+{
+	char path[4096];
+	if (cache_path(path, sizeof(path), st, 0) == 0)
+		unlink(path);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_LINE_INDEX_H
+#define ENANO_LINE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// offsets of one line every LINE_INDEX_STRIDE are kept
+#define LINE_INDEX_STRIDE 1024
+
+/*
+ * Where the lines of a file start. Finding it out means reading every byte
+ * of the file, so it's kept in a cache file next to a few things that
+ * tell whether the file changed (inode, size, mtime and a hash of some
+ * blocks of it). Opening the same file again maps the cache instead.
+ */
+struct line_index {
+	uint64_t n_newlines;
+	// offsets[i] is where line i * LINE_INDEX_STRIDE starts
+	const uint64_t *offsets;
+	size_t n_offsets;
+
+	// the cache file, if offsets live there. Otherwise they were malloc'd
+	void *map;
+	size_t map_size;
+};
+
+// data is the (mapped) contents of the file described by st
+int line_index_load(struct line_index *index, const char *data, const struct stat *st);
+void line_index_free(struct line_index *index);
+// the file described by st is gone, so is its cache
+void line_index_remove_cache(const struct stat *st);
+
+#endif /* ENANO_LINE_INDEX_H */
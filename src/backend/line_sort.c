@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <backend/line_sort.h>
+
+#define MAX_WORKERS 16
+// a half this small isn't worth a thread
+#define MIN_THREAD_LINES 16384
+#define INSERTION_SORT_LINES 16
+
+// sorts order[0, n), using tmp[0, n) as scratch space
+struct sort_task {
+	struct line *lines;
+	size_t *order;
+	size_t *tmp;
+	size_t n;
+	// threads this task can use, itself included
+	unsigned int n_workers;
+};
+
+static int compare_lines(const struct line *a, const struct line *b)
+{
+	size_t length = (a->length < b->length) ? a->length : b->length;
+	int ret = (length == 0) ? 0 : memcmp(a->line_str, b->line_str, length);
+	if (ret != 0)
+		return ret;
+
+	return (a->length > b->length) - (a->length < b->length);
+}
+
+static void insertion_sort(struct line *lines, size_t *order, size_t n)
+{
+	for (size_t i = 1; i < n; i++) {
+		size_t index = order[i];
+		size_t j = i;
+		for (; j > 0 && compare_lines(&lines[order[j - 1]], &lines[index]) > 0; j--)
+			order[j] = order[j - 1];
+		order[j] = index;
+	}
+}
+
+// merges the sorted order[0, half) and order[half, n)
+static void merge(struct line *lines, size_t *order, size_t *tmp, size_t half, size_t n)
+{
+	size_t i = 0, j = half, k = 0;
+	while (i < half && j < n) {
+		// on ties the left one goes first, so the sort is stable
+		if (compare_lines(&lines[order[j]], &lines[order[i]]) < 0)
+			tmp[k++] = order[j++];
+		else
+			tmp[k++] = order[i++];
+	}
+	while (i < half)
+		tmp[k++] = order[i++];
+	// what's left of the right half is already in place
+	memcpy(order, tmp, k * sizeof(size_t));
+}
+
+static void *sort_task(void *arg)
+{
+	struct sort_task *task = (struct sort_task *)arg;
+	if (task->n <= INSERTION_SORT_LINES) {
+		insertion_sort(task->lines, task->order, task->n);
+		return NULL;
+	}
+
+	size_t half = task->n / 2;
+	struct sort_task left = {
+		task->lines, task->order, task->tmp, half, task->n_workers / 2
+	};
+	struct sort_task right = {
+		task->lines, &task->order[half], &task->tmp[half], task->n - half,
+		task->n_workers - task->n_workers / 2
+	};
+
+	pthread_t thread;
+	char threaded = left.n_workers > 0 && half >= MIN_THREAD_LINES &&
+		pthread_create(&thread, NULL, sort_task, &left) == 0;
+	sort_task(&right);
+	if (threaded)
+		pthread_join(thread, NULL);
+	else
+		sort_task(&left);
+
+	// sorted input (a log is, often) is merged for free
+	if (compare_lines(&task->lines[task->order[half - 1]], &task->lines[task->order[half]]) > 0)
+		merge(task->lines, task->order, task->tmp, half, task->n);
+
+	return NULL;
+}
+
+int line_sort(struct line *lines, size_t n, size_t *order)
+{
+	for (size_t i = 0; i < n; i++)
+		order[i] = i;
+	if (n < 2)
+		return 0;
+
+	size_t *tmp = (size_t *)malloc(n * sizeof(size_t));
+	if (tmp == NULL)
+		return -errno;
+
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	struct sort_task task = {
+		lines, order, tmp, n,
+		(n_cpus < 1) ? 1 : (n_cpus > MAX_WORKERS) ? MAX_WORKERS : n_cpus
+	};
+	sort_task(&task);
+
+	free(tmp);
+	return 0;
+}
+
+size_t line_sort_duplicates(struct line *lines, size_t n, const size_t *order,
+	char *duplicated)
+{
+	size_t n_duplicated = 0;
+	memset(duplicated, 0, n);
+	for (size_t i = 1; i < n; i++) {
+		// the sort is stable, the first one of the equal lines comes first
+		if (compare_lines(&lines[order[i - 1]], &lines[order[i]]) == 0) {
+			duplicated[order[i]] = 1;
+			n_duplicated++;
+		}
+	}
+
+	return n_duplicated;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_LINE_SORT_H
+#define ENANO_LINE_SORT_H
+
+#include <stddef.h>
+
+#include <backend/lines.h>
+
+/*
+ * Sorting lines by their bytes (as `LC_ALL=C sort` does). Only indexes
+ * move, never the lines or their contents: order gets the indexes of the
+ * n lines, sorted, equal lines keeping the order they had. It's a merge
+ * sort, the halves are sorted by different threads until there are as
+ * many as CPUs. The lines MUST NOT change meanwhile.
+ */
+int line_sort(struct line *lines, size_t n, size_t *order);
+// With order sorted by line_sort(), marks in duplicated the lines equal
+// to an earlier one. Returns how many there are
+size_t line_sort_duplicates(struct line *lines, size_t n, const size_t *order,
+	char *duplicated);
+
+#endif /* ENANO_LINE_SORT_H */
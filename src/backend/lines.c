@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <backend/lines.h>
+#include <common/stats.h>
+
+#define max(x,y) (x >= y) ? x : y
+
+struct line_storage *line_storage_alloc(size_t size)
+{
+	struct line_storage *ret =
+		(struct line_storage *)malloc(sizeof(struct line_storage) + size);
+	if (ret == NULL) {
+		// TODO: Critical bug, but this is not acceptable behavior
+		exit(1);
+	}
+
+	stats_count_alloc(sizeof(struct line_storage) + size);
+	ret->refcount = 1;
+	ret->size = size;
+
+	return ret;
+}
+
+void line_storage_ref(struct line_storage *storage)
+{
+	if (storage != NULL)
+		storage->refcount++;
+}
+
+void line_storage_unref(struct line_storage *storage)
+{
+	if (storage == NULL || --storage->refcount > 0)
+		return;
+
+	stats_count_free(sizeof(struct line_storage) + storage->size);
+	free(storage);
+}
+
+void line_set_span(struct line *line, struct line_storage *storage, char *str, size_t length)
+{
+	line_storage_ref(storage);
+	line->storage = storage;
+	line->line_str = str;
+	line->length = length;
+}
+
+void line_clear(struct line *line)
+{
+	line_storage_unref(line->storage);
+	line->storage = NULL;
+	line->line_str = NULL;
+	line->length = 0;
+}
+
+static int line_is_writable(struct line *line)
+{
+	return line->storage != NULL && line->storage->refcount == 1 &&
+		line->line_str == line->storage->data;
+}
+
+void reserve_line(struct line *line, size_t length)
+{
+	if (line_is_writable(line)) {
+		if (length + 1 <= line->storage->size)
+			return;
+
+		size_t new_size = max(2 * length, MIN_LINE_SIZE);
+		stats_count_alloc(new_size - line->storage->size);
+		line->storage = realloc(line->storage, sizeof(struct line_storage) + new_size);
+		if (line->storage == NULL) {
+			// TODO: Critical failure. Handle in another way
+			exit(1);
+		}
+		line->storage->size = new_size;
+		line->line_str = line->storage->data;
+		return;
+	}
+
+	// copy on write
+	size_t new_size = max(2 * length, MIN_LINE_SIZE);
+	struct line_storage *storage = line_storage_alloc(new_size);
+	size_t to_copy = (line->length <= length) ? line->length : length;
+	memcpy(storage->data, line->line_str, to_copy);
+	storage->data[to_copy] = '\0';
+
+	line_storage_unref(line->storage);
+	line->storage = storage;
+	line->line_str = storage->data;
+	line->length = to_copy;
+}
+
+void concat_lines(struct line *dst, struct line *src)
+{
+	// we need at least dst->length + src->length + 1 ('\0' char) bytes
+	reserve_line(dst, dst->length + src->length);
+	memcpy(&dst->line_str[dst->length], src->line_str, src->length);
+	dst->length += src->length;
+	dst->line_str[dst->length] = '\0';
+}
+
+size_t line_find(struct line *line, size_t from, const char *needle, size_t needle_length)
+{
+	if (needle_length == 0 || from > line->length || line->length - from < needle_length)
+		return LINE_NOT_FOUND;
+
+	char *it = &line->line_str[from];
+	// the last position where needle still fits
+	char *last = &line->line_str[line->length - needle_length];
+	while (it <= last) {
+		it = memchr(it, needle[0], last - it + 1);
+		if (it == NULL)
+			break;
+		if (memcmp(it, needle, needle_length) == 0)
+			return it - line->line_str;
+		it++;
+	}
+
+	return LINE_NOT_FOUND;
+}
+
+struct line_linked_list_node *alloc_linked_list_node(size_t size)
+{
+	struct line_linked_list_node *ret =
+		(struct line_linked_list_node *)malloc(sizeof(struct line_linked_list_node));
+
+	if (ret == NULL) {
+		// TODO: Critical bug, but this is not acceptable behavior
+		exit(1);
+	}
+
+	stats_count_alloc(sizeof(struct line_linked_list_node));
+	ret->line.storage = line_storage_alloc(size);
+	ret->line.line_str = ret->line.storage->data;
+	ret->line.line_str[0] = '\0';
+	ret->line.length = 0;
+
+	return ret;
+}
+
+struct line_linked_list_node *alloc_span_linked_list_node(struct line *span)
+{
+	struct line_linked_list_node *ret =
+		(struct line_linked_list_node *)malloc(sizeof(struct line_linked_list_node));
+
+	if (ret == NULL) {
+		// TODO: Critical bug, but this is not acceptable behavior
+		exit(1);
+	}
+
+	stats_count_alloc(sizeof(struct line_linked_list_node));
+	line_set_span(&ret->line, span->storage, span->line_str, span->length);
+
+	return ret;
+}
+
+void free_linked_list_node(struct line_linked_list_node *node)
+{
+	stats_count_free(sizeof(struct line_linked_list_node));
+	line_clear(&node->line);
+	free(node);
+}
+
+struct line_linked_list_node *walk_lines(struct line_linked_list_node *node,
+	size_t from_y, size_t to_y)
+{
+	for (; from_y < to_y; from_y++)
+		node = node->next;
+	for (; from_y > to_y; from_y--)
+		node = node->prev;
+
+	return node;
+}
+
+void unlink_linked_list_node(struct line_linked_list_node *node)
+{
+	if (node->prev != NULL)
+		node->prev->next = node->next;
+	if (node->next != NULL)
+		node->next->prev = node->prev;
+}
+
+void link_linked_list_node(struct line_linked_list_node *node,
+	struct line_linked_list_node *new_node)
+{
+	new_node->prev = node;
+	new_node->next = node->next;
+	if (node->next != NULL)
+		node->next->prev = new_node;
+	node->next = new_node;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_LINES_H
+#define ENANO_LINES_H
+
+#include <stddef.h>
+
+// TODO: Don't hardcode this
+#define MIN_LINE_SIZE 64
+
+/*
+ * Line contents live in reference counted blocks of memory. A line owns
+ * its block (and can write to it) only while nobody else references it,
+ * otherwise the contents are an immutable span that many lines (or the
+ * clipboard) can share, and the line gets a private copy the first time
+ * it's modified (see reserve_line()).
+ */
+struct line_storage {
+	unsigned int refcount;
+	// bytes available at data
+	size_t size;
+	char data[];
+};
+
+struct line {
+	size_t length;
+	// NOT '\0' terminated unless the line is writable
+	char *line_str;
+	// the block line_str points into
+	struct line_storage *storage;
+};
+
+struct line_linked_list_node {
+	struct line line;
+	struct line_linked_list_node *next;
+	struct line_linked_list_node *prev;
+};
+
+struct line_storage *line_storage_alloc(size_t size);
+void line_storage_ref(struct line_storage *storage);
+void line_storage_unref(struct line_storage *storage);
+
+// makes line a reference to the span [str, str + length) of storage
+void line_set_span(struct line *line, struct line_storage *storage, char *str, size_t length);
+void line_clear(struct line *line);
+
+// makes sure the line can be written and has room for length characters
+// plus the '\0'. The contents are kept (and '\0' terminated)
+void reserve_line(struct line *line, size_t length);
+void concat_lines(struct line *dst, struct line *src);
+
+#define LINE_NOT_FOUND ((size_t)-1)
+// returns the position of the first occurrence of needle in line starting
+// at from or after it, LINE_NOT_FOUND if there isn't any
+size_t line_find(struct line *line, size_t from, const char *needle, size_t needle_length);
+
+// returns a node with an empty writable line of (at least) size bytes
+struct line_linked_list_node *alloc_linked_list_node(size_t size);
+// returns a node referencing the given span (no copying involved)
+struct line_linked_list_node *alloc_span_linked_list_node(struct line *span);
+void free_linked_list_node(struct line_linked_list_node *node);
+
+// walks from node (which is line from_y) to line to_y
+struct line_linked_list_node *walk_lines(struct line_linked_list_node *node,
+	size_t from_y, size_t to_y);
+void unlink_linked_list_node(struct line_linked_list_node *node);
+// links new_node after node
+void link_linked_list_node(struct line_linked_list_node *node,
+	struct line_linked_list_node *new_node);
+
+#endif /* ENANO_LINES_H */
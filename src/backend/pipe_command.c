@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// for pipe2()
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <backend/pipe_command.h>
+#include <common/stats.h>
+
+#define max(x,y) (x >= y) ? x : y
+
+extern char **environ;
+
+struct pipe_command_job {
+	pid_t pid;
+	// our ends of the stdin, stdout and stderr of the command, -1 once
+	// we're done with them
+	int input_fd;
+	int output_fd;
+	int error_fd;
+	// cancelling writes to it, which wakes the thread up
+	int cancel_pipe[2];
+
+	struct line *input;
+	size_t n_input;
+	size_t input_size;
+	// the next byte of the input to go to the buffer
+	size_t input_y;
+	size_t input_x;
+	char buffer[PIPE_COMMAND_BUFFER_SIZE];
+	size_t buffered;
+	// the bytes of the buffer already written
+	size_t sent;
+
+	struct line *lines;
+	size_t n_lines;
+	size_t lines_size;
+	// the output is read into the block, and its lines point into it
+	struct line_storage *block;
+	size_t block_used;
+	// where the line being read starts
+	size_t line_start;
+
+	char error[PIPE_COMMAND_ERROR_SIZE];
+	size_t error_length;
+
+	pthread_t thread;
+	int status;
+	// atomic
+	size_t written;
+	size_t read;
+	char canceled;
+	char done;
+
+	uint64_t start_ns;
+	uint64_t end_ns;
+};
+
+// copies as much of the input as fits to the buffer
+static void fill_buffer(struct pipe_command_job *job)
+{
+	job->buffered = job->sent = 0;
+	while (job->input_y < job->n_input && job->buffered < PIPE_COMMAND_BUFFER_SIZE) {
+		struct line *line = &job->input[job->input_y];
+		size_t n = line->length - job->input_x;
+		if (n > PIPE_COMMAND_BUFFER_SIZE - job->buffered)
+			n = PIPE_COMMAND_BUFFER_SIZE - job->buffered;
+		memcpy(&job->buffer[job->buffered], &line->line_str[job->input_x], n);
+		job->buffered += n;
+		job->input_x += n;
+		if (job->input_x == line->length && job->buffered < PIPE_COMMAND_BUFFER_SIZE) {
+			job->buffer[job->buffered++] = '\n';
+			job->input_y++;
+			job->input_x = 0;
+		}
+	}
+}
+
+// Returns 1 once there's nothing else to write
+static int write_input(struct pipe_command_job *job)
+{
+	if (job->sent == job->buffered)
+		fill_buffer(job);
+	if (job->buffered == 0)
+		return 1;
+
+	ssize_t n = write(job->input_fd, &job->buffer[job->sent], job->buffered - job->sent);
+	// EPIPE means the command doesn't want the rest (think of head)
+	if (n < 0)
+		return errno != EAGAIN && errno != EINTR;
+
+	job->sent += n;
+	__atomic_add_fetch(&job->written, n, __ATOMIC_RELAXED);
+	return 0;
+}
+
+// the line [job->line_start, end) of the block is complete
+static void add_line(struct pipe_command_job *job, size_t end)
+{
+	if (job->n_lines == job->lines_size) {
+		size_t new_size = (job->lines_size == 0) ? 1024 : job->lines_size * 2;
+		struct line *new_lines =
+			(struct line *)realloc(job->lines, new_size * sizeof(struct line));
+		if (new_lines == NULL) {
+			// TODO: Critical failure. Handle in another way
+			exit(1);
+		}
+		job->lines = new_lines;
+		job->lines_size = new_size;
+	}
+
+	line_set_span(&job->lines[job->n_lines++], job->block,
+		&job->block->data[job->line_start], end - job->line_start);
+	job->line_start = end + 1;
+}
+
+// Moves the line being read to a new block, with room for more. The old
+// one stays alive as long as some line points into it
+static void new_block(struct pipe_command_job *job)
+{
+	size_t partial = job->block_used - job->line_start;
+	struct line_storage *block = line_storage_alloc(max(PIPE_COMMAND_BLOCK_SIZE, partial * 2));
+	if (job->block != NULL) {
+		memcpy(block->data, &job->block->data[job->line_start], partial);
+		line_storage_unref(job->block);
+	}
+	job->block = block;
+	job->block_used = partial;
+	job->line_start = 0;
+}
+
+// Returns 1 once there's nothing else to read
+static int read_output(struct pipe_command_job *job)
+{
+	if (job->block == NULL || job->block_used == job->block->size)
+		new_block(job);
+
+	size_t room = job->block->size - job->block_used;
+	if (room > PIPE_COMMAND_BUFFER_SIZE)
+		room = PIPE_COMMAND_BUFFER_SIZE;
+	char *data = &job->block->data[job->block_used];
+	ssize_t n = read(job->output_fd, data, room);
+	if (n < 0)
+		return errno != EAGAIN && errno != EINTR;
+	if (n == 0) {
+		// the last line doesn't always end with '\n'
+		if (job->line_start < job->block_used)
+			add_line(job, job->block_used);
+		return 1;
+	}
+
+	for (char *it = data; (it = memchr(it, '\n', data + n - it)) != NULL; it++)
+		add_line(job, it - job->block->data);
+	job->block_used += n;
+	__atomic_add_fetch(&job->read, n, __ATOMIC_RELAXED);
+	return 0;
+}
+
+// The start of stderr is kept for the user, the rest is thrown away.
+// Returns 1 once there's nothing else to read
+static int read_error(struct pipe_command_job *job)
+{
+	char buffer[512];
+	ssize_t n = read(job->error_fd, buffer, sizeof(buffer));
+	if (n < 0)
+		return errno != EAGAIN && errno != EINTR;
+
+	size_t room = sizeof(job->error) - 1 - job->error_length;
+	size_t kept = ((size_t)n < room) ? (size_t)n : room;
+	memcpy(&job->error[job->error_length], buffer, kept);
+	job->error_length += kept;
+	return n == 0;
+}
+
+static void close_fd(int *fd)
+{
+	if (*fd >= 0)
+		close(*fd);
+	*fd = -1;
+}
+
+static void *pipe_command_thread(void *arg)
+{
+	struct pipe_command_job *job = (struct pipe_command_job *)arg;
+	// writing to a command that stopped reading raises SIGPIPE, which
+	// would kill the editor. Blocked, the write fails with EPIPE instead
+	sigset_t sigpipe;
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+	// both ends of a pipe block together: the input is written as the
+	// command makes room for it, and the output read as soon as it's
+	// there, so the command is never stuck waiting for us
+	while (job->output_fd >= 0 || job->error_fd >= 0) {
+		// poll() skips the negative (closed) ones
+		struct pollfd fds[4] = {
+			{ .fd = job->cancel_pipe[0], .events = POLLIN },
+			{ .fd = job->input_fd, .events = POLLOUT },
+			{ .fd = job->output_fd, .events = POLLIN },
+			{ .fd = job->error_fd, .events = POLLIN }
+		};
+		if (poll(fds, 4, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (fds[0].revents != 0)
+			break;
+		if (fds[1].revents != 0 && write_input(job))
+			close_fd(&job->input_fd);
+		if (fds[2].revents != 0 && read_output(job))
+			close_fd(&job->output_fd);
+		if (fds[3].revents != 0 && read_error(job))
+			close_fd(&job->error_fd);
+	}
+
+	close_fd(&job->input_fd);
+	close_fd(&job->output_fd);
+	close_fd(&job->error_fd);
+	// the command may go on after closing its stdout and stderr, it can
+	// still be canceled meanwhile
+	struct pollfd cancel = { .fd = job->cancel_pipe[0], .events = POLLIN };
+	for (;;) {
+		char canceled = __atomic_load_n(&job->canceled, __ATOMIC_RELAXED);
+		// the whole process group, the command may be a pipeline
+		if (canceled)
+			kill(-job->pid, SIGKILL);
+		pid_t ret = waitpid(job->pid, &job->status, canceled ? 0 : WNOHANG);
+		if (ret > 0)
+			break;
+		if (ret < 0 && errno != EINTR) {
+			job->status = -errno;
+			break;
+		}
+		// there's no fd telling us it's gone, we look every now and then
+		if (ret == 0)
+			poll(&cancel, 1, 20);
+	}
+
+	job->end_ns = stats_now_ns();
+	__atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+// Runs command with sh, its stdin, stdout and stderr are the other ends
+// of the pipes
+static int spawn_command(struct pipe_command_job *job, const char *command,
+	int input[2], int output[2], int error[2])
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, input[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, error[1], STDERR_FILENO);
+
+	// in its own process group, so it can be killed with everything it
+	// starts. The signals we block or handle aren't its business
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+	posix_spawnattr_setflags(&attributes,
+		POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+	posix_spawnattr_setpgroup(&attributes, 0);
+	sigset_t signals;
+	sigemptyset(&signals);
+	posix_spawnattr_setsigmask(&attributes, &signals);
+	sigfillset(&signals);
+	posix_spawnattr_setsigdefault(&attributes, &signals);
+
+	char *argv[] = { "sh", "-c", (char *)command, NULL };
+	int ret = posix_spawn(&job->pid, "/bin/sh", &actions, &attributes, argv, environ);
+	posix_spawnattr_destroy(&attributes);
+	posix_spawn_file_actions_destroy(&actions);
+
+	return -ret;
+}
+
+int pipe_command_start(struct pipe_command_job **job, const char *command,
+	struct line *lines, size_t n_lines)
+{
+	struct pipe_command_job *p =
+		(struct pipe_command_job *)calloc(1, sizeof(struct pipe_command_job));
+	if (p == NULL)
+		return -errno;
+
+	int ret = 0;
+	int input[2] = { -1, -1 }, output[2] = { -1, -1 }, error[2] = { -1, -1 };
+	p->cancel_pipe[0] = p->cancel_pipe[1] = -1;
+	if (pipe2(input, O_CLOEXEC) < 0 || pipe2(output, O_CLOEXEC) < 0 ||
+		pipe2(error, O_CLOEXEC) < 0 || pipe2(p->cancel_pipe, O_CLOEXEC) < 0) {
+		ret = -errno;
+		goto err_creating_pipes;
+	}
+
+	p->start_ns = stats_now_ns();
+	ret = spawn_command(p, command, input, output, error);
+	if (ret < 0)
+		goto err_creating_pipes;
+	close_fd(&input[0]);
+	close_fd(&output[1]);
+	close_fd(&error[1]);
+
+	p->input_fd = input[1];
+	p->output_fd = output[0];
+	p->error_fd = error[0];
+	fcntl(p->input_fd, F_SETFL, O_NONBLOCK);
+	fcntl(p->output_fd, F_SETFL, O_NONBLOCK);
+	fcntl(p->error_fd, F_SETFL, O_NONBLOCK);
+
+	p->input = lines;
+	p->n_input = n_lines;
+	for (size_t i = 0; i < n_lines; i++)
+		p->input_size += lines[i].length + 1;
+
+	ret = -pthread_create(&p->thread, NULL, pipe_command_thread, p);
+	if (ret < 0) {
+		kill(-p->pid, SIGKILL);
+		waitpid(p->pid, NULL, 0);
+		close_fd(&p->input_fd);
+		close_fd(&p->output_fd);
+		close_fd(&p->error_fd);
+		goto err_creating_pipes;
+	}
+
+	*job = p;
+	return 0;
+
+err_creating_pipes:
+	for (int i = 0; i < 2; i++) {
+		close_fd(&input[i]);
+		close_fd(&output[i]);
+		close_fd(&error[i]);
+		close_fd(&p->cancel_pipe[i]);
+	}
+	free(p);
+	return ret;
+}
+
+void pipe_command_progress(struct pipe_command_job *job, size_t *written, size_t *read,
+	size_t *input_size)
+{
+	*written = __atomic_load_n(&job->written, __ATOMIC_RELAXED);
+	*read = __atomic_load_n(&job->read, __ATOMIC_RELAXED);
+	*input_size = job->input_size;
+}
+
+int pipe_command_done(struct pipe_command_job *job)
+{
+	return __atomic_load_n(&job->done, __ATOMIC_ACQUIRE);
+}
+
+void pipe_command_cancel(struct pipe_command_job *job)
+{
+	__atomic_store_n(&job->canceled, 1, __ATOMIC_RELAXED);
+	// wakes the thread up
+	char c = 0;
+	while (write(job->cancel_pipe[1], &c, 1) < 0 && errno == EINTR)
+		;
+}
+
+void pipe_command_finish(struct pipe_command_job *job, struct pipe_command_result *result)
+{
+	pthread_join(job->thread, NULL);
+
+	for (size_t i = 0; i < job->n_input; i++)
+		line_clear(&job->input[i]);
+	free(job->input);
+	// the lines keep alive the blocks they point into
+	line_storage_unref(job->block);
+
+	result->canceled = job->canceled;
+	if (result->canceled) {
+		for (size_t i = 0; i < job->n_lines; i++)
+			line_clear(&job->lines[i]);
+		job->n_lines = 0;
+	}
+	// never NULL, even if there are no lines
+	if (job->lines == NULL) {
+		job->lines = (struct line *)malloc(sizeof(struct line));
+		if (job->lines == NULL) {
+			// TODO: Critical failure. Handle in another way
+			exit(1);
+		}
+	}
+	result->lines = job->lines;
+	result->n_lines = job->n_lines;
+	result->status = job->status;
+	memcpy(result->error, job->error, job->error_length);
+	result->error[job->error_length] = '\0';
+	result->elapsed_ns = job->end_ns - job->start_ns;
+
+	close_fd(&job->cancel_pipe[0]);
+	close_fd(&job->cancel_pipe[1]);
+	free(job);
+}
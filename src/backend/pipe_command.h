@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_PIPE_COMMAND_H
+#define ENANO_PIPE_COMMAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <backend/lines.h>
+
+// bytes moved to or from the command at once
+#define PIPE_COMMAND_BUFFER_SIZE (64 * 1024)
+// the lines of the output live in blocks of (at least) this size
+#define PIPE_COMMAND_BLOCK_SIZE (1024 * 1024)
+// the start of stderr kept for the user
+#define PIPE_COMMAND_ERROR_SIZE 96
+
+/*
+ * Runs a shell command with some lines as its input, and takes its output
+ * as lines. The input is written, and the output read, at the same time
+ * by a background thread, PIPE_COMMAND_BUFFER_SIZE bytes at a time: the
+ * input is never copied as a whole and the output goes straight to the
+ * blocks its lines point into. Putting the result in the buffer is left
+ * to the caller.
+ */
+struct pipe_command_job;
+
+struct pipe_command_result {
+	// the lines of the output. The caller owns them, and the array (which
+	// is never NULL)
+	struct line *lines;
+	size_t n_lines;
+	// as returned by waitpid(), or -errno if we couldn't wait for it
+	int status;
+	char canceled;
+	// what the command wrote to stderr (the start of it)
+	char error[PIPE_COMMAND_ERROR_SIZE];
+	uint64_t elapsed_ns;
+};
+
+// every line is written followed by a '\n'. Once started, the job owns
+// the references of the n_lines lines (and the array, which has to be
+// malloc'd)
+int pipe_command_start(struct pipe_command_job **job, const char *command,
+	struct line *lines, size_t n_lines);
+// bytes of the input written so far, and of the output read
+void pipe_command_progress(struct pipe_command_job *job, size_t *written, size_t *read,
+	size_t *input_size);
+int pipe_command_done(struct pipe_command_job *job);
+// kills the command, the result will have no lines
+void pipe_command_cancel(struct pipe_command_job *job);
+// waits for the job to be done and frees it
+void pipe_command_finish(struct pipe_command_job *job, struct pipe_command_result *result);
+
+#endif /* ENANO_PIPE_COMMAND_H */
@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <backend/replace_all.h>
+#include <common/stats.h>
+
+#define max(x,y) (x >= y) ? x : y
+
+// lines handed to a worker at once
+#define CHUNK_LINES 4096
+#define MAX_WORKERS 16
+
+// what a worker found in a chunk
+struct chunk {
+	struct replaced_line *lines;
+	size_t n_lines;
+	size_t size;
+	size_t n_matches;
+};
+
+struct replace_all_job {
+	char *search;
+	size_t search_length;
+	char *replacement;
+	size_t replacement_length;
+	size_t n_lines;
+
+	// protects everything up to (and including) chunks
+	pthread_mutex_t lock;
+	// first line of the next chunk to hand out
+	struct line_linked_list_node *next_node;
+	size_t next_y;
+	// in the order of the lines
+	struct chunk **chunks;
+	size_t n_chunks;
+	size_t chunks_size;
+
+	pthread_t workers[MAX_WORKERS];
+	unsigned int n_workers;
+	// atomic
+	size_t lines_done;
+	unsigned int workers_done;
+	char canceled;
+
+	uint64_t start_ns;
+	// when the last worker was done, protected by lock
+	uint64_t end_ns;
+};
+
+// returns the chunk the lines [*y, *y + *n) go to, NULL when there's nothing left
+static struct chunk *get_chunk(struct replace_all_job *job,
+	struct line_linked_list_node **first, size_t *y, size_t *n)
+{
+	struct chunk *chunk = (struct chunk *)calloc(1, sizeof(struct chunk));
+	if (chunk == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+
+	pthread_mutex_lock(&job->lock);
+	if (job->next_node == NULL || __atomic_load_n(&job->canceled, __ATOMIC_RELAXED)) {
+		pthread_mutex_unlock(&job->lock);
+		free(chunk);
+		return NULL;
+	}
+
+	*first = job->next_node;
+	*y = job->next_y;
+	for (*n = 0; *n < CHUNK_LINES && job->next_node != NULL; (*n)++)
+		job->next_node = job->next_node->next;
+	job->next_y += *n;
+
+	if (job->n_chunks == job->chunks_size) {
+		size_t new_size = (job->chunks_size == 0) ? 256 : job->chunks_size * 2;
+		struct chunk **new_chunks =
+			(struct chunk **)realloc(job->chunks, new_size * sizeof(struct chunk *));
+		if (new_chunks == NULL) {
+			// TODO: Critical failure. Handle in another way
+			exit(1);
+		}
+		job->chunks = new_chunks;
+		job->chunks_size = new_size;
+	}
+	job->chunks[job->n_chunks++] = chunk;
+	pthread_mutex_unlock(&job->lock);
+
+	return chunk;
+}
+
+static void replace_in_line(struct replace_all_job *job, struct chunk *chunk,
+	struct line_linked_list_node *node, size_t y)
+{
+	struct line *line = &node->line;
+	size_t n_matches = 0;
+	size_t match = line_find(line, 0, job->search, job->search_length);
+	for (; match != LINE_NOT_FOUND; n_matches++)
+		match = line_find(line, match + job->search_length, job->search,
+			job->search_length);
+	if (n_matches == 0)
+		return;
+
+	if (chunk->n_lines == chunk->size) {
+		size_t new_size = (chunk->size == 0) ? 64 : chunk->size * 2;
+		struct replaced_line *new_lines = (struct replaced_line *)realloc(chunk->lines,
+			new_size * sizeof(struct replaced_line));
+		if (new_lines == NULL) {
+			// TODO: Critical failure. Handle in another way
+			exit(1);
+		}
+		chunk->lines = new_lines;
+		chunk->size = new_size;
+	}
+
+	size_t length = line->length + n_matches * job->replacement_length -
+		n_matches * job->search_length;
+	struct replaced_line *replaced = &chunk->lines[chunk->n_lines++];
+	replaced->node = node;
+	replaced->y = y;
+	replaced->line.storage = line_storage_alloc(max(length + 1, MIN_LINE_SIZE));
+	replaced->line.line_str = replaced->line.storage->data;
+	replaced->line.length = length;
+
+	char *to = replaced->line.line_str;
+	size_t from = 0;
+	for (match = line_find(line, 0, job->search, job->search_length);
+		match != LINE_NOT_FOUND;
+		match = line_find(line, from, job->search, job->search_length)) {
+		memcpy(to, &line->line_str[from], match - from);
+		to += match - from;
+		memcpy(to, job->replacement, job->replacement_length);
+		to += job->replacement_length;
+		from = match + job->search_length;
+	}
+	memcpy(to, &line->line_str[from], line->length - from);
+	replaced->line.line_str[length] = '\0';
+
+	chunk->n_matches += n_matches;
+}
+
+static void *replace_all_worker(void *arg)
+{
+	struct replace_all_job *job = (struct replace_all_job *)arg;
+	struct line_linked_list_node *node;
+	size_t y, n;
+	struct chunk *chunk;
+
+	while ((chunk = get_chunk(job, &node, &y, &n)) != NULL) {
+		for (size_t i = 0; i < n; i++, node = node->next)
+			replace_in_line(job, chunk, node, y + i);
+		__atomic_add_fetch(&job->lines_done, n, __ATOMIC_RELAXED);
+	}
+
+	uint64_t end_ns = stats_now_ns();
+	pthread_mutex_lock(&job->lock);
+	if (end_ns > job->end_ns)
+		job->end_ns = end_ns;
+	pthread_mutex_unlock(&job->lock);
+	__atomic_add_fetch(&job->workers_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+int replace_all_start(struct replace_all_job **job, struct line_linked_list_node *first,
+	size_t n_lines, const char *search, const char *replacement)
+{
+	struct replace_all_job *p = (struct replace_all_job *)calloc(1, sizeof(struct replace_all_job));
+	if (p == NULL)
+		return -errno;
+
+	p->search = strdup(search);
+	p->replacement = strdup(replacement);
+	if (p->search == NULL || p->replacement == NULL) {
+		free(p->search);
+		free(p->replacement);
+		free(p);
+		return -ENOMEM;
+	}
+	p->search_length = strlen(search);
+	p->replacement_length = strlen(replacement);
+	p->n_lines = n_lines;
+	p->next_node = first;
+	p->next_y = 0;
+	p->start_ns = stats_now_ns();
+	pthread_mutex_init(&p->lock, NULL);
+
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int n_workers = (n_cpus < 1) ? 1 : (n_cpus > MAX_WORKERS) ? MAX_WORKERS : n_cpus;
+	int ret = 0;
+	for (p->n_workers = 0; p->n_workers < n_workers; p->n_workers++) {
+		ret = pthread_create(&p->workers[p->n_workers], NULL, replace_all_worker, p);
+		if (ret != 0)
+			break;
+	}
+	// we can do with less workers than we wanted, but not without any
+	if (p->n_workers == 0) {
+		pthread_mutex_destroy(&p->lock);
+		free(p->search);
+		free(p->replacement);
+		free(p);
+		return -ret;
+	}
+
+	*job = p;
+	return 0;
+}
+
+size_t replace_all_progress(struct replace_all_job *job)
+{
+	return __atomic_load_n(&job->lines_done, __ATOMIC_RELAXED);
+}
+
+int replace_all_done(struct replace_all_job *job)
+{
+	return __atomic_load_n(&job->workers_done, __ATOMIC_ACQUIRE) == job->n_workers;
+}
+
+void replace_all_cancel(struct replace_all_job *job)
+{
+	__atomic_store_n(&job->canceled, 1, __ATOMIC_RELAXED);
+}
+
+void replace_all_finish(struct replace_all_job *job, struct replace_all_result *result)
+{
+	for (unsigned int i = 0; i < job->n_workers; i++)
+		pthread_join(job->workers[i], NULL);
+
+	result->n_lines = 0;
+	result->n_matches = 0;
+	for (size_t i = 0; i < job->n_chunks; i++) {
+		result->n_lines += job->chunks[i]->n_lines;
+		result->n_matches += job->chunks[i]->n_matches;
+	}
+
+	result->lines = (struct replaced_line *)malloc((result->n_lines + 1) *
+		sizeof(struct replaced_line));
+	if (result->lines == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+	size_t n = 0;
+	for (size_t i = 0; i < job->n_chunks; i++) {
+		struct chunk *chunk = job->chunks[i];
+		memcpy(&result->lines[n], chunk->lines, chunk->n_lines * sizeof(struct replaced_line));
+		n += chunk->n_lines;
+		free(chunk->lines);
+		free(chunk);
+	}
+	result->elapsed_ns = job->end_ns - job->start_ns;
+
+	pthread_mutex_destroy(&job->lock);
+	free(job->chunks);
+	free(job->search);
+	free(job->replacement);
+	free(job);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_REPLACE_ALL_H
+#define ENANO_REPLACE_ALL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <backend/lines.h>
+
+/*
+ * Replace-all runs in background threads, so the editor keeps handling
+ * keys meanwhile. The workers take chunks of consecutive lines and build
+ * the new contents of the lines with matches in new storage, they never
+ * write to the lines of the buffer. Putting the result in the buffer is
+ * left to the caller, which MUST NOT modify the lines until the job is
+ * finished.
+ */
+struct replace_all_job;
+
+struct replaced_line {
+	struct line_linked_list_node *node;
+	size_t y;
+	// the new contents of the line
+	struct line line;
+};
+
+struct replace_all_result {
+	// sorted by y
+	struct replaced_line *lines;
+	size_t n_lines;
+	size_t n_matches;
+	uint64_t elapsed_ns;
+};
+
+// looks for search in the n_lines lines from first (which is line 0) on
+int replace_all_start(struct replace_all_job **job, struct line_linked_list_node *first,
+	size_t n_lines, const char *search, const char *replacement);
+// number of lines looked at so far, the job is done once it's n_lines
+size_t replace_all_progress(struct replace_all_job *job);
+int replace_all_done(struct replace_all_job *job);
+// the workers stop after the chunk they're at, the result will have
+// whatever they found until then
+void replace_all_cancel(struct replace_all_job *job);
+// waits for the job to be done and frees it. The caller owns the lines
+// of the result (and has to free result->lines)
+void replace_all_finish(struct replace_all_job *job, struct replace_all_result *result);
+
+#endif /* ENANO_REPLACE_ALL_H */
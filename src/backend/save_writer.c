@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// for copy_file_range()
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <backend/save_writer.h>
+
+static int write_all(int fd, const char *data, size_t length)
+{
+	while (length > 0) {
+		ssize_t written = write(fd, data, length);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		data += written;
+		length -= written;
+	}
+
+	return 0;
+}
+
+static int flush_buffer(struct save_writer *writer)
+{
+	int ret = write_all(writer->fd, writer->buffer, writer->buffered);
+	if (ret < 0)
+		return ret;
+
+	writer->bytes_written += writer->buffered;
+	writer->buffered = 0;
+	return 0;
+}
+
+static int flush_copy(struct save_writer *writer)
+{
+	while (writer->copy_length > 0 && !writer->copy_unsupported) {
+		// writes at (and moves) the position of fd, like write()
+		ssize_t copied = copy_file_range(writer->source_fd, &writer->copy_offset,
+			writer->fd, NULL, writer->copy_length, 0);
+		if (copied < 0) {
+			if (errno == EINTR)
+				continue;
+			// old kernels, different filesystems (before Linux 5.3) or
+			// files that aren't regular ones
+			if (errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+				errno != EOPNOTSUPP)
+				return -errno;
+			writer->copy_unsupported = 1;
+			break;
+		}
+		// the source got shorter while we had it open
+		if (copied == 0)
+			return -EIO;
+		writer->copy_length -= copied;
+		writer->bytes_copied += copied;
+	}
+
+	if (writer->copy_length > 0) {
+		int ret = write_all(writer->fd, &writer->source_data[writer->copy_offset],
+			writer->copy_length);
+		if (ret < 0)
+			return ret;
+		writer->bytes_written += writer->copy_length;
+		writer->copy_offset += writer->copy_length;
+		writer->copy_length = 0;
+	}
+
+	return 0;
+}
+
+void save_writer_init(struct save_writer *writer, int fd, int source_fd,
+	const char *source_data)
+{
+	writer->fd = fd;
+	writer->source_fd = source_fd;
+	writer->copy_offset = 0;
+	writer->copy_length = 0;
+	writer->buffered = 0;
+	writer->copy_unsupported = 0;
+	writer->source_data = source_data;
+	writer->bytes_copied = 0;
+	writer->bytes_written = 0;
+}
+
+int save_writer_copy(struct save_writer *writer, off_t offset, size_t length)
+{
+	if (length == 0)
+		return 0;
+
+	// most of the time the piece goes right after the previous one
+	if (writer->copy_length > 0 && writer->copy_offset + writer->copy_length == offset) {
+		writer->copy_length += length;
+		return 0;
+	}
+
+	int ret = save_writer_flush(writer);
+	if (ret < 0)
+		return ret;
+
+	writer->copy_offset = offset;
+	writer->copy_length = length;
+	return 0;
+}
+
+int save_writer_write(struct save_writer *writer, const char *data, size_t length)
+{
+	int ret = flush_copy(writer);
+	if (ret < 0)
+		return ret;
+
+	if (writer->buffered + length > SAVE_WRITER_BUFFER_SIZE) {
+		ret = flush_buffer(writer);
+		if (ret < 0)
+			return ret;
+		// too big to be worth buffering
+		if (length > SAVE_WRITER_BUFFER_SIZE) {
+			ret = write_all(writer->fd, data, length);
+			if (ret < 0)
+				return ret;
+			writer->bytes_written += length;
+			return 0;
+		}
+	}
+
+	memcpy(&writer->buffer[writer->buffered], data, length);
+	writer->buffered += length;
+	return 0;
+}
+
+int save_writer_flush(struct save_writer *writer)
+{
+	// only one of them can have something, whatever came first was
+	// flushed when the other one got data
+	int ret = flush_buffer(writer);
+	if (ret < 0)
+		return ret;
+
+	return flush_copy(writer);
+}
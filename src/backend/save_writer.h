@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_SAVE_WRITER_H
+#define ENANO_SAVE_WRITER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SAVE_WRITER_BUFFER_SIZE (64 * 1024)
+
+/*
+ * Writes a file made of pieces of another one (the file we loaded) and
+ * bytes from memory. Consecutive pieces of the source are merged and
+ * copied with copy_file_range(), so the kernel can copy them without
+ * going through us (or share the blocks, if the filesystem can), and only
+ * what comes from memory is actually written.
+ */
+struct save_writer {
+	int fd;
+	int source_fd;
+
+	// the piece of the source waiting to be copied
+	off_t copy_offset;
+	size_t copy_length;
+
+	char buffer[SAVE_WRITER_BUFFER_SIZE];
+	size_t buffered;
+
+	// copy_file_range() can't be used between these two files
+	char copy_unsupported;
+	// the source, if we have to fall back to writing it ourselves
+	const char *source_data;
+
+	size_t bytes_copied;
+	size_t bytes_written;
+};
+
+void save_writer_init(struct save_writer *writer, int fd, int source_fd,
+	const char *source_data);
+// functions below return 0 on success, -errno on failure
+// appends [offset, offset + length) of the source file
+int save_writer_copy(struct save_writer *writer, off_t offset, size_t length);
+int save_writer_write(struct save_writer *writer, const char *data, size_t length);
+int save_writer_flush(struct save_writer *writer);
+
+#endif /* ENANO_SAVE_WRITER_H */
@@ -14,48 +14,128 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+// for O_TMPFILE and mkostemp()
+#define _GNU_SOURCE
+
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
-
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <backend/columns.h>
+#include <backend/line_compression.h>
+#include <backend/line_index.h>
+#include <backend/line_sort.h>
+#include <backend/lines.h>
+#include <backend/pipe_command.h>
+#include <backend/replace_all.h>
+#include <backend/save_writer.h>
 #include <backend/single_buffer_editor.h>
+#include <backend/undo.h>
+#include <common/display.h>
 #include <common/events.h>
-#include <curses.h>
+#include <common/stats.h>
 
 #define SPACES_IN_A_TAB 8
+// lines created from the file at once, see next_line(). Batches before
+// the loaded lines start where the index says, so they're as big as its
+// stride
+#define LOAD_BATCH_LINES LINE_INDEX_STRIDE
+// what the lines loaded from the file can take, unless told otherwise
+#define DEFAULT_LINE_CACHE_BUDGET (64 * 1024 * 1024)
+// modified lines this many windows away from the lines in use get
+// compressed, and the ones closer than PREFETCH_WINDOWS decompressed
+#define COLD_WINDOWS 8
+#define PREFETCH_WINDOWS 2
+// smallest block of lines worth compressing, and most lines in one
+#define MIN_COMPRESSED_LINES_SIZE 4096
+#define MAX_COMPRESSED_LINES 4096
+// lines looked at for compression after every refresh
+#define COMPRESSION_SCAN_LINES 4096
+// spots of the file sampled for the column widths on every tick (one
+// every LINE_INDEX_STRIDE lines), the rows read at each of them and the
+// most we read of one
+#define COLUMN_SAMPLE_SPOTS 64
+#define COLUMN_SAMPLE_ROWS 8
+#define COLUMN_SAMPLE_MAX_ROW 65536
+#define COLUMN_SEPARATOR " | "
 
 #define max(x,y) (x >= y) ? x : y
 
-struct line {
-	size_t size;
-	// TODO: We don't use this yet !!
-	// length, as it would be returned by strlen()
-	size_t length;
-	// TODO: Represent each line as a linked list too?
-	// That would allow O(1) insertion too, although jumping would become O(n) (currently O(1))
-	// '\0' terminated string
-	char *line_str;
+// What cut and copy leave for paste: the text is the spans joined by '\n'.
+// The spans reference the storage of the lines they came from, so nothing
+// is copied (see backend/lines.h). Lines that follow each other in the
+// same storage, like the ones still as they are in the file, go in one
+// span ('\n's included)
+struct clipboard {
+	size_t n_spans;
+	struct line *spans;
 };
 
-struct line_linked_list_node {
-	struct line line;
-	struct line_linked_list_node *next;
-	struct line_linked_list_node *prev;
+// A cursor besides the main one (pos_x, pos_y, line_y)
+struct cursor {
+	size_t x;
+	size_t y;
+	struct line_linked_list_node *line;
+	// only meaningful while a batch of edits is applied, see
+	// gather_cursors()
+	char is_main;
 };
 
 // TODO: Change size_t for unsigned int where possible
 struct single_buffer_editor_data {
-	WINDOW *window;
+	// where we draw, it belongs to the caller of init()
+	struct display_object *display;
 	size_t window_nlines;
 	size_t window_ncols;
 
 	// path to the file that backs the buffer in disk
 	char *file_path;
+	struct stat file_stat;
+	// kept open to copy the parts of it nobody modified when saving
+	int file_fd;
+	// the file, mapped (NULL if it's empty). The lines nobody modified
+	// point into it
+	char *file_data;
+	size_t file_size;
+	struct line_index line_index;
 	// the real buffer we use, the file it's split into lines
 	// Linked list allows inserting lines in O(1), jumping to a line in O(n)
+	// Lines are created from file_data as they're needed, the last
+	// n_unloaded_lines lines of the buffer aren't in the list yet, the
+	// first of them starts at unloaded_offset. Neither are the first
+	// first_loaded_y lines, which are the first lines of the file as they
+	// were (lines is line first_loaded_y). See evict_lines()
 	struct line_linked_list_node *lines;
+	size_t n_unloaded_lines;
+	size_t unloaded_offset;
+	size_t first_loaded_y;
+	// how much the lines loaded from the file can take (nodes + the file
+	// itself)
+	size_t line_cache_budget;
+	// a modified line stops unloading the first (last) lines. Knowing it
+	// saves looking for it again on every refresh, until the buffer
+	// changes or more lines are loaded there
+	char first_lines_pinned;
+	char last_lines_pinned;
+
+	// where the search for modified lines to compress goes on from (NULL
+	// to start from the beginning). See compress_cold_lines()
+	struct line_linked_list_node *compression_scan;
+	size_t compression_scan_y;
+	// set when a whole pass didn't compress anything, until the buffer
+	// changes or the lines in use move away from where they were then
+	char compression_idle;
+	size_t compression_idle_y;
+	char compression_pass_compressed;
 
 	size_t n_lines;
 
@@ -72,398 +152,2713 @@ struct single_buffer_editor_data {
 	// holds the line at the top of the window
 	struct line_linked_list_node *top_print_line;
 	size_t top_print_line_y;
+
+	// the selection goes from the mark to the cursor
+	char mark_set;
+	size_t mark_x;
+	size_t mark_y;
+
+	struct clipboard clipboard;
+
+	// the extra cursors. Every edit happens at all of them (and at the
+	// main one)
+	struct cursor *cursors;
+	size_t n_cursors;
+	size_t cursors_size;
+
+	struct undo_history undo_history;
+	// the record of the edit in progress, see undo_begin()
+	struct undo_record pending_undo;
+	char undo_pending;
+	size_t pending_undo_n_lines;
+	// the last event typed (or deleted) characters in a line
+	char typing;
+
+	// not NULL while a replace-all runs in the background
+	struct replace_all_job *replace_all_job;
+	// not NULL while lines go through a command in the background. Its
+	// output takes the place of the pipe_n_lines lines from pipe_first_y
+	// on
+	struct pipe_command_job *pipe_command_job;
+	size_t pipe_first_y;
+	size_t pipe_n_lines;
+
+	// rows drawn as columns, scrolled sideways a column at a time
+	// (first_column is the leftmost one drawn). The widths come from the
+	// rows drawn and from rows of the file sampled in the background, from
+	// spot column_sample_next of the index on
+	char columns_view;
+	struct column_layout columns;
+	size_t first_column;
+	size_t column_sample_next;
+	// the layout the window has, see fit_columns()
+	size_t columns_drawn_version;
+	size_t columns_drawn_first;
+
+	// for the user, returned with the result of the event
+	char message[128];
 };
 
 // Auxiliary functions go here
 
-static unsigned int count_lines(char *buf, size_t buf_size)
+// Returns a node for the line of the file starting at *offset, which is
+// moved to the start of the next line
+static struct line_linked_list_node *alloc_file_line(struct single_buffer_editor_data *p,
+	size_t *offset)
+{
+	char *line_start = &p->file_data[*offset];
+	char *line_end = (*offset < p->file_size) ?
+		memchr(line_start, '\n', p->file_size - *offset) : NULL;
+	// the last line doesn't always end with '\n'
+	size_t length = (line_end != NULL) ? line_end - line_start : p->file_size - *offset;
+
+	struct line span = { length, line_start, NULL };
+	*offset += length + 1;
+	return alloc_span_linked_list_node(&span);
+}
+
+// Creates up to n lines from the file after last (the last line of the
+// list, NULL if the list is empty)
+static void load_lines(struct single_buffer_editor_data *p,
+	struct line_linked_list_node *last, size_t n)
+{
+	if (n > 0 && p->n_unloaded_lines > 0) {
+		editor_stats.line_cache_misses++;
+		p->last_lines_pinned = 0;
+	}
+
+	for (; n > 0 && p->n_unloaded_lines > 0; n--) {
+		struct line_linked_list_node *node = alloc_file_line(p, &p->unloaded_offset);
+		if (last != NULL)
+			link_linked_list_node(last, node);
+		else {
+			node->prev = node->next = NULL;
+			p->lines = node;
+		}
+		last = node;
+		p->n_unloaded_lines--;
+	}
+}
+
+// Creates the batch of lines right before the first loaded line
+static void load_previous_lines(struct single_buffer_editor_data *p)
+{
+	editor_stats.line_cache_misses++;
+	p->first_lines_pinned = 0;
+	p->first_loaded_y -= LOAD_BATCH_LINES;
+	size_t offset = p->line_index.offsets[p->first_loaded_y / LOAD_BATCH_LINES];
+
+	struct line_linked_list_node *first = p->lines;
+	struct line_linked_list_node *last = NULL;
+	for (size_t i = 0; i < LOAD_BATCH_LINES; i++) {
+		struct line_linked_list_node *node = alloc_file_line(p, &offset);
+		if (last != NULL)
+			link_linked_list_node(last, node);
+		else {
+			node->prev = NULL;
+			node->next = NULL;
+			p->lines = node;
+		}
+		last = node;
+	}
+	last->next = first;
+	first->prev = last;
+}
+
+// the line can be read after this
+static struct line_linked_list_node *readable_line(struct line_linked_list_node *node)
+{
+	if (node != NULL && line_is_compressed(&node->line))
+		decompress_lines(node);
+
+	return node;
+}
+
+// node->next, creating the lines that follow from the file if needed
+static struct line_linked_list_node *next_line(struct single_buffer_editor_data *p,
+	struct line_linked_list_node *node)
+{
+	if (node->next == NULL && p->n_unloaded_lines > 0)
+		load_lines(p, node, LOAD_BATCH_LINES);
+	else
+		editor_stats.line_cache_hits++;
+
+	return readable_line(node->next);
+}
+
+// node->prev, creating the lines before from the file if needed
+static struct line_linked_list_node *prev_line(struct single_buffer_editor_data *p,
+	struct line_linked_list_node *node)
+{
+	if (node->prev == NULL && p->first_loaded_y > 0)
+		load_previous_lines(p);
+	else
+		editor_stats.line_cache_hits++;
+
+	return readable_line(node->prev);
+}
+
+// walk_lines() creating the lines on the way
+static struct line_linked_list_node *line_at(struct single_buffer_editor_data *p,
+	struct line_linked_list_node *node, size_t from_y, size_t to_y)
+{
+	for (; from_y < to_y; from_y++)
+		node = next_line(p, node);
+	for (; from_y > to_y; from_y--)
+		node = prev_line(p, node);
+
+	return readable_line(node);
+}
+
+// makes sure lines [from_y, to_y] are in the list (and can be read)
+static void load_lines_between(struct single_buffer_editor_data *p, size_t from_y, size_t to_y)
+{
+	struct line_linked_list_node *it = line_at(p, p->line_y, p->pos_y, from_y);
+	for (size_t y = from_y; y < to_y; y++)
+		it = next_line(p, it);
+}
+
+static void load_all_lines(struct single_buffer_editor_data *p)
+{
+	while (p->first_loaded_y > 0)
+		load_previous_lines(p);
+
+	struct line_linked_list_node *last = p->lines;
+	for (;;) {
+		readable_line(last);
+		if (last->next == NULL)
+			break;
+		last = last->next;
+	}
+	load_lines(p, last, p->n_unloaded_lines);
+}
+
+// Line cache
+//
+// Lines loaded from the file cost a node each, and the pages of the file
+// they point to stay in memory. When that goes over line_cache_budget we
+// give back lines at the ends of the loaded ones (the end furthest from
+// the cursor, which is the one we visited the longest ago when scrolling)
+// as long as they're the lines of the file as they were and far from the
+// cursors, the mark and the window. Modified lines can't go back, so they
+// and everything between them and the cursor stay
+
+static size_t loaded_lines_cost(struct single_buffer_editor_data *p)
+{
+	size_t n_loaded = p->n_lines + 1 - p->first_loaded_y - p->n_unloaded_lines;
+	size_t first_offset = p->line_index.offsets[p->first_loaded_y / LOAD_BATCH_LINES];
+	size_t end_offset = (p->unloaded_offset < p->file_size) ?
+		p->unloaded_offset : p->file_size;
+
+	return n_loaded * sizeof(struct line_linked_list_node) + (end_offset - first_offset);
+}
+
+// the line is the line of the file starting at offset, untouched
+static int is_file_line(struct single_buffer_editor_data *p, struct line *line, size_t offset)
+{
+	return line->storage == NULL && line->line_str == &p->file_data[offset] &&
+		(offset + line->length == p->file_size ||
+		(offset + line->length < p->file_size && p->file_data[offset + line->length] == '\n'));
+}
+
+// drops the pages of [start, end) of the file, the kernel reads them again
+// if someone needs them
+static void release_file_range(struct single_buffer_editor_data *p, size_t start, size_t end)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	start = (start + page_size - 1) / page_size * page_size;
+	end = end / page_size * page_size;
+	if (start < end)
+		madvise(&p->file_data[start], end - start, MADV_DONTNEED);
+}
+
+// Unloads the first batch of lines if they're the first lines of the file.
+// Returns 0 if it couldn't
+static int evict_first_lines(struct single_buffer_editor_data *p)
+{
+	size_t batch = p->first_loaded_y / LOAD_BATCH_LINES;
+	// the line after the batch has to be in the index
+	if (batch + 1 >= p->line_index.n_offsets)
+		return 0;
+
+	size_t offset = p->line_index.offsets[batch];
+	struct line_linked_list_node *it = p->lines;
+	for (size_t i = 0; i < LOAD_BATCH_LINES; i++, it = it->next) {
+		if (!is_file_line(p, &it->line, offset))
+			return 0;
+		offset += it->line.length + 1;
+	}
+	if (offset != p->line_index.offsets[batch + 1])
+		return 0;
+
+	it->prev->next = NULL;
+	it->prev = NULL;
+	struct line_linked_list_node *first = p->lines;
+	p->lines = it;
+	p->first_loaded_y += LOAD_BATCH_LINES;
+	while (first != NULL) {
+		struct line_linked_list_node *next = first->next;
+		free_linked_list_node(first);
+		first = next;
+	}
+
+	release_file_range(p, p->line_index.offsets[batch], offset);
+	p->compression_scan = NULL;
+	editor_stats.line_cache_evictions += LOAD_BATCH_LINES;
+	return 1;
+}
+
+// Unloads up to n lines at the end of the list, last being the last one,
+// as long as they're the last lines of the file loaded. Returns how many
+static size_t evict_last_lines(struct single_buffer_editor_data *p,
+	struct line_linked_list_node *last, size_t n)
+{
+	size_t offset = p->unloaded_offset;
+	size_t end_offset = offset;
+	size_t evicted = 0;
+	for (; evicted < n && last->prev != NULL; evicted++) {
+		if (offset < last->line.length + 1)
+			break;
+		size_t line_offset = offset - last->line.length - 1;
+		if (!is_file_line(p, &last->line, line_offset) ||
+			(line_offset > 0 && p->file_data[line_offset - 1] != '\n'))
+			break;
+
+		offset = line_offset;
+		struct line_linked_list_node *prev = last->prev;
+		prev->next = NULL;
+		free_linked_list_node(last);
+		last = prev;
+	}
+
+	p->unloaded_offset = offset;
+	p->n_unloaded_lines += evicted;
+	if (evicted > 0) {
+		release_file_range(p, offset, (end_offset < p->file_size) ? end_offset : p->file_size);
+		p->compression_scan = NULL;
+	}
+	editor_stats.line_cache_evictions += evicted;
+	return evicted;
+}
+
+// the lines we (or the user) are at: the window, the cursors and the mark
+static void lines_in_use(struct single_buffer_editor_data *p, size_t *first_y, size_t *last_y)
+{
+	*first_y = p->top_print_line_y;
+	*last_y = p->top_print_line_y + p->window_nlines;
+	if (p->pos_y < *first_y)
+		*first_y = p->pos_y;
+	if (p->pos_y > *last_y)
+		*last_y = p->pos_y;
+	if (p->mark_set && p->mark_y < *first_y)
+		*first_y = p->mark_y;
+	if (p->mark_set && p->mark_y > *last_y)
+		*last_y = p->mark_y;
+	for (size_t i = 0; i < p->n_cursors; i++) {
+		if (p->cursors[i].y < *first_y)
+			*first_y = p->cursors[i].y;
+		if (p->cursors[i].y > *last_y)
+			*last_y = p->cursors[i].y;
+	}
+}
+
+static void evict_lines(struct single_buffer_editor_data *p)
+{
+	// the workers of a replace-all are reading them
+	if (p->file_data == NULL || p->replace_all_job != NULL)
+		return;
+
+	size_t cost = loaded_lines_cost(p);
+	editor_stats.line_cache_bytes = cost;
+	if (cost <= p->line_cache_budget)
+		return;
+
+	// we keep a window of lines around the ones in use, moving up or
+	// down doesn't unload anything
+	size_t first_y, last_y;
+	lines_in_use(p, &first_y, &last_y);
+	first_y = (first_y > p->window_nlines) ? first_y - p->window_nlines : 0;
+	last_y += p->window_nlines;
+
+	size_t loaded_last_y = p->n_lines - p->n_unloaded_lines;
+	struct line_linked_list_node *last = NULL;
+	while (cost > p->line_cache_budget) {
+		char can_evict_first = !p->first_lines_pinned &&
+			p->first_loaded_y + LOAD_BATCH_LINES <= first_y;
+		char can_evict_last = !p->last_lines_pinned && loaded_last_y > last_y;
+		// the end further away from the cursor goes first
+		if (can_evict_first && can_evict_last) {
+			if (p->pos_y - p->first_loaded_y >= loaded_last_y - p->pos_y)
+				can_evict_last = 0;
+			else
+				can_evict_first = 0;
+		}
+
+		if (can_evict_first)
+			p->first_lines_pinned = !evict_first_lines(p);
+		else if (can_evict_last) {
+			if (last == NULL)
+				last = walk_lines(p->line_y, p->pos_y, loaded_last_y);
+			size_t n = loaded_last_y - last_y;
+			if (n > LOAD_BATCH_LINES)
+				n = LOAD_BATCH_LINES;
+			struct line_linked_list_node *prev = walk_lines(last, loaded_last_y,
+				loaded_last_y - n);
+			size_t evicted = evict_last_lines(p, last, n);
+			p->last_lines_pinned = evicted < n;
+			last = prev;
+			loaded_last_y -= evicted;
+		}
+		else
+			break;
+
+		cost = loaded_lines_cost(p);
+	}
+	editor_stats.line_cache_bytes = cost;
+}
+
+// Compression of modified lines
+//
+// Modified lines own their memory, and there's nowhere to give them back
+// to. The ones far from the lines in use are compressed in blocks (see
+// backend/line_compression.h) a bit after every refresh, and decompressed
+// when they're needed again: ahead of time if they get close to the
+// window, or right away if something else (a search, an undo, ...) reaches
+// them
+
+// the line can be part of a block
+static int line_is_compressible(struct line *line)
+{
+	return line->storage != NULL && line->storage->refcount == 1 &&
+		line->line_str == line->storage->data &&
+		line->length <= COMPRESSED_LINES_MAX_SIZE;
+}
+
+// Goes on looking for modified lines to compress for COMPRESSION_SCAN_LINES
+// lines
+static void compress_cold_lines(struct single_buffer_editor_data *p)
+{
+	// the workers of a replace-all are reading them
+	if (p->replace_all_job != NULL)
+		return;
+
+	size_t first_y, last_y;
+	lines_in_use(p, &first_y, &last_y);
+	size_t in_use_y = first_y;
+	size_t distance = COLD_WINDOWS * p->window_nlines;
+	if (p->compression_idle) {
+		size_t moved = (in_use_y > p->compression_idle_y) ?
+			in_use_y - p->compression_idle_y : p->compression_idle_y - in_use_y;
+		if (moved < distance / 2)
+			return;
+		p->compression_idle = 0;
+	}
+	// lines in [first_y, last_y] are hot
+	first_y = (first_y > distance) ? first_y - distance : 0;
+	last_y += distance;
+
+	if (p->compression_scan == NULL) {
+		p->compression_scan = p->lines;
+		p->compression_scan_y = p->first_loaded_y;
+		p->compression_pass_compressed = 0;
+	}
+
+	// the lines that can go in the next block
+	struct line_linked_list_node *block = NULL;
+	size_t block_y = 0, n_block_lines = 0, block_size = 0;
+	struct line_linked_list_node *it = p->compression_scan;
+	size_t y = p->compression_scan_y;
+	for (size_t i = 0; i < COMPRESSION_SCAN_LINES && it != NULL; i++, it = it->next, y++) {
+		char fits = (y < first_y || y > last_y) && line_is_compressible(&it->line) &&
+			n_block_lines < MAX_COMPRESSED_LINES &&
+			block_size + it->line.length <= COMPRESSED_LINES_MAX_SIZE;
+		if (fits && block != NULL) {
+			n_block_lines++;
+			block_size += it->line.length;
+			// a full block is done with right away: if the scan stopped
+			// with it, the next one would start with it again
+			if (n_block_lines < MAX_COMPRESSED_LINES)
+				continue;
+			if (block_size >= MIN_COMPRESSED_LINES_SIZE && compress_lines(block, n_block_lines))
+				p->compression_pass_compressed = 1;
+			block = NULL;
+			continue;
+		}
+
+		if (block != NULL && block_size >= MIN_COMPRESSED_LINES_SIZE &&
+			compress_lines(block, n_block_lines))
+			p->compression_pass_compressed = 1;
+		block = NULL;
+
+		if ((y < first_y || y > last_y) && line_is_compressible(&it->line)) {
+			block = it;
+			block_y = y;
+			n_block_lines = 1;
+			block_size = it->line.length;
+		}
+	}
+
+	if (it != NULL) {
+		// the block might go on, next time we start with it
+		p->compression_scan = (block != NULL) ? block : it;
+		p->compression_scan_y = (block != NULL) ? block_y : y;
+		return;
+	}
+
+	if (block != NULL && block_size >= MIN_COMPRESSED_LINES_SIZE &&
+		compress_lines(block, n_block_lines))
+		p->compression_pass_compressed = 1;
+	p->compression_scan = NULL;
+	if (!p->compression_pass_compressed) {
+		p->compression_idle = 1;
+		p->compression_idle_y = in_use_y;
+	}
+}
+
+// Decompresses the lines around the window, so scrolling doesn't have to
+static void prefetch_lines(struct single_buffer_editor_data *p)
+{
+	size_t distance = PREFETCH_WINDOWS * p->window_nlines;
+	struct line_linked_list_node *up = p->top_print_line, *down = p->top_print_line;
+	for (size_t i = 0; i < distance + p->window_nlines && down != NULL; i++) {
+		readable_line(down);
+		down = down->next;
+	}
+	for (size_t i = 0; i < distance && up != NULL; i++) {
+		readable_line(up);
+		up = up->prev;
+	}
+}
+
+static void move_str_right_1_char(char *begin, char *end)
+{
+	for (; end != begin; end--)
+		*end = *(end - 1);
+}
+
+static void move_str_left_1_char(char *begin, char *end)
+{
+	for (; begin != end; begin++)
+		*begin = *(begin + 1);
+}
+
+// returns the number of screen columns the first n characters of str
+// take, when they're drawn from column start_column
+static unsigned int str_columns(char *str, size_t n, unsigned int start_column)
 {
-	size_t ret = 0;
-	for (size_t i = 0; i < buf_size; i++)
-		if (buf[i] == '\n')
-			ret++;
+	unsigned int column = start_column;
+	for (size_t i = 0; i < n; i++) {
+		if (str[i] == '\t')
+			column = (column / SPACES_IN_A_TAB + 1) * SPACES_IN_A_TAB;
+		else
+			column++;
+	}
+
+	return column - start_column;
+}
+
+// returns the maximum number of characters of str (which has length
+// characters) that fill into an screen line of line_size characters
+static unsigned int str_length_to_fill_line(char *str, size_t length, unsigned int line_size)
+{
+	unsigned int ret = 0;
+	unsigned int columns = 0;
+	for (; ret < length; str++) {
+		unsigned int width = (*str == '\t') ?
+			SPACES_IN_A_TAB - columns % SPACES_IN_A_TAB : 1;
+		if (columns + width > line_size)
+			break;
+
+		columns += width;
+		ret++;
+	}
 
 	return ret;
 }
 
-static unsigned int count_tabs(char *s, unsigned int limit)
-{
-	unsigned int ret = 0;
-	for (int i = 0; i < limit; i++)
-		if (s[i] == '\t')
-			ret++;
+static void clear_clipboard(struct clipboard *clipboard)
+{
+	for (size_t i = 0; i < clipboard->n_spans; i++)
+		line_clear(&clipboard->spans[i]);
+
+	free(clipboard->spans);
+	clipboard->spans = NULL;
+	clipboard->n_spans = 0;
+}
+
+//----------------------------------------------------------------------------------------//
+
+// Functions that implement editor capabilities: Like moving the cursor, copy, paste, ....
+
+static void show_cursor(struct single_buffer_editor_data *p)
+{
+	p->show_cursor = 1;
+}
+
+static void hide_cursor(struct single_buffer_editor_data *p)
+{
+	p->show_cursor = 0;
+}
+
+static void move_cursor_left(struct single_buffer_editor_data *p)
+{
+	if (p->pos_x > 0)
+		p->pos_x--;
+	else if (p->pos_x == 0 && p->pos_y > 0) {
+		p->pos_y--;
+		p->line_y = prev_line(p, p->line_y);
+		p->pos_x = p->line_y->line.length;
+	}
+}
+
+static void move_cursor_right(struct single_buffer_editor_data *p)
+{
+	if (p->pos_x < p->line_y->line.length)
+		p->pos_x++;
+	else if (p->pos_x == p->line_y->line.length && p->pos_y < p->n_lines) {
+		p->pos_x = 0;
+		p->pos_y++;
+		p->line_y = next_line(p, p->line_y);
+	}
+}
+
+static void move_cursor_up(struct single_buffer_editor_data *p)
+{
+	if (p->pos_y > 0) {
+		p->pos_y--;
+		p->line_y = prev_line(p, p->line_y);
+		p->pos_x = (p->line_y->line.length >= p->pos_x) ? p->pos_x : p->line_y->line.length;
+	}
+}
+
+static void move_cursor_down(struct single_buffer_editor_data *p)
+{
+	if (p->pos_y < p->n_lines) {
+		p->pos_y++;
+		p->line_y = next_line(p, p->line_y);
+		p->pos_x = (p->line_y->line.length >= p->pos_x) ? p->pos_x : p->line_y->line.length;
+	}
+}
+
+// Lines are numbered from 1, as the user sees them
+static void go_to_line(struct single_buffer_editor_data *p, struct go_to_data *data)
+{
+	char *end;
+	errno = 0;
+	unsigned long long n = strtoull(data->position, &end, 0);
+	if (end == data->position || *end != '\0' || errno != 0 || n == 0) {
+		snprintf(p->message, sizeof(p->message), "Not a line number: %s", data->position);
+		return;
+	}
+	if (n - 1 > p->n_lines) {
+		snprintf(p->message, sizeof(p->message), "The file has %zu lines", p->n_lines + 1);
+		return;
+	}
+
+	size_t y = n - 1;
+	p->line_y = line_at(p, p->line_y, p->pos_y, y);
+	p->pos_y = y;
+	p->pos_x = 0;
+	// the line goes to the middle of the window
+	p->top_print_line_y = (y > p->window_nlines / 2) ? y - p->window_nlines / 2 : 0;
+	p->top_print_line = line_at(p, p->line_y, y, p->top_print_line_y);
+	p->clear_window = 1;
+}
+
+// Splits current_line at x, returns the new line holding what was after x
+// TODO: This could be further optimized if when x == 0 we just
+// place a new line before the current line
+static struct line_linked_list_node *split_line(struct single_buffer_editor_data *p,
+	struct line_linked_list_node *current_line, size_t x)
+{
+	size_t new_line_size = max(current_line->line.length - x + 1, MIN_LINE_SIZE);
+	struct line_linked_list_node *new_line = alloc_linked_list_node(new_line_size);
+	link_linked_list_node(current_line, new_line);
+
+	if (x != current_line->line.length) {
+		new_line->line.length = current_line->line.length - x;
+		memcpy(new_line->line.line_str,
+			&current_line->line.line_str[x], new_line->line.length);
+		new_line->line.line_str[new_line->line.length] = '\0';
+
+		current_line->line.length = x;
+		reserve_line(&current_line->line, x);
+		current_line->line.line_str[x] = '\0';
+	}
+
+	p->n_lines++;
+	p->clear_window = 1;
+
+	return new_line;
+}
+
+// Appends current_line to the previous line and frees it. Returns the
+// length the previous line had
+static size_t join_with_previous_line(struct single_buffer_editor_data *p,
+	struct line_linked_list_node *current_line)
+{
+	struct line_linked_list_node *prev_line = current_line->prev;
+	size_t prev_line_length = prev_line->line.length;
+
+	concat_lines(&prev_line->line, &current_line->line);
+	// with several cursors the line might not be the one under the main
+	// cursor, and be the top line of the window
+	if (p->top_print_line == current_line) {
+		p->top_print_line = prev_line;
+		p->top_print_line_y--;
+	}
+	unlink_linked_list_node(current_line);
+	free_linked_list_node(current_line);
+	p->n_lines--;
+	p->clear_window = 1;
+
+	return prev_line_length;
+}
+
+static void insert_new_line(struct single_buffer_editor_data *p)
+{
+	p->line_y = split_line(p, p->line_y, p->pos_x);
+	p->pos_x = 0;
+	p->pos_y++;
+}
+
+static void remove_current_character(struct single_buffer_editor_data *p)
+{
+	struct line_linked_list_node *current_line = p->line_y;
+	if (p->pos_x == 0) {
+		if (p->pos_y == 0)
+			return;
+
+		p->line_y = prev_line(p, current_line);
+		p->pos_x = join_with_previous_line(p, current_line);
+		p->pos_y--;
+	}
+	else {
+		// if (p->pos_x < current_line->line.length)
+		reserve_line(&current_line->line, current_line->line.length);
+		move_str_left_1_char(
+			&current_line->line.line_str[p->pos_x - 1],
+			&current_line->line.line_str[current_line->line.length]);
+		p->pos_x--;
+		current_line->line.length--;
+		current_line->line.line_str[current_line->line.length] = '\0';
+	}
+
+	// TODO: Right now we're triggering a full window rewrite everytime
+	// the user removes something. It'll be probably more efficient (although
+	// it's not sure, testing is needed) to have a clear_window flag per line
+	// and fully rewrite those lines by printing '\0' to fill the gap between
+	// the line new end and window_ncols characters that fit on the screen line
+	p->clear_window = 1;
+}
+
+// *c MUST be different from '\n'
+static void put_character(struct single_buffer_editor_data *p, char *c)
+{
+	struct line *line = &p->line_y->line;
+	// make sure there is space available
+	reserve_line(line, line->length + 1);
+
+	// are we inserting at the end of the line?
+	if (line->length == p->pos_x) {
+		line->line_str[p->pos_x] = *c;
+		p->pos_x++;
+		line->line_str[p->pos_x] = '\0';
+		line->length++;
+	}
+	else {
+		move_str_right_1_char(
+			&line->line_str[p->pos_x], &line->line_str[line->length + 1]);
+		line->line_str[p->pos_x] = *c;
+		p->pos_x++;
+		line->length++;
+	}
+}
+
+// Undo
+//
+// Edits are recorded as a single hunk (see backend/undo.h): undo_begin()
+// takes references to the lines the edit is going to touch before it
+// happens, and undo_commit() tells how many lines they became after it
+
+static void undo_begin(struct single_buffer_editor_data *p,
+	struct line_linked_list_node *node, size_t y, size_t n)
+{
+	struct undo_record *record = &p->pending_undo;
+	undo_record_alloc(record, 1, n);
+	record->hunks[0].y = y;
+	record->hunks[0].n_insert = n;
+	for (size_t i = 0; i < n; i++, node = node->next)
+		line_set_span(&record->lines[i], node->line.storage, node->line.line_str,
+			node->line.length);
+	record->cursor_x = p->pos_x;
+	record->cursor_y = p->pos_y;
+
+	p->pending_undo_n_lines = p->n_lines;
+	p->undo_pending = 1;
+}
+
+static void undo_commit(struct single_buffer_editor_data *p)
+{
+	struct undo_record *record = &p->pending_undo;
+	if (!p->undo_pending) {
+		// the edit went to the last record, see undo_begin_typing()
+		record = undo_history_to_undo(&p->undo_history);
+		record->inverse_cursor_x = p->pos_x;
+		record->inverse_cursor_y = p->pos_y;
+		return;
+	}
+
+	// undo_begin_cursors() works the hunks out itself
+	if (record->n_hunks == 1)
+		record->hunks[0].n_remove =
+			record->hunks[0].n_insert + p->n_lines - p->pending_undo_n_lines;
+	record->inverse_cursor_x = p->pos_x;
+	record->inverse_cursor_y = p->pos_y;
+	undo_history_push(&p->undo_history, record);
+	p->undo_pending = 0;
+}
+
+// Characters typed (or deleted) one after the other in the same line are
+// undone at once
+static void undo_begin_typing(struct single_buffer_editor_data *p)
+{
+	struct undo_record *record = undo_history_to_undo(&p->undo_history);
+	if (p->typing && record != NULL && undo_history_to_redo(&p->undo_history) == NULL &&
+		record->n_hunks == 1 && record->hunks[0].y == p->pos_y &&
+		record->hunks[0].n_remove == 1 && record->hunks[0].n_insert == 1)
+		return;
+
+	undo_begin(p, p->line_y, p->pos_y, 1);
+}
+
+// Like undo_begin(), for an edit at every cursor (sorted): one hunk per line
+// with cursors, so the record doesn't grow with the distance between them.
+// Each cursor adds new_lines lines and, if joins is set, a line whose first
+// cursor is at its start is joined with the previous one
+static void undo_begin_cursors(struct single_buffer_editor_data *p,
+	struct cursor *cursors, size_t n, size_t new_lines, char joins)
+{
+	struct undo_record *record = &p->pending_undo;
+	// at most two lines per cursor line
+	undo_record_alloc(record, n, 2 * n);
+	size_t n_hunks = 0, n_lines = 0;
+	// the line after the last hunk, and the lines the hunks so far add
+	size_t end = 0;
+	long long delta = 0;
+	for (size_t first = 0; first < n;) {
+		size_t last = first;
+		while (last < n && cursors[last].line == cursors[first].line)
+			last++;
+
+		size_t y = cursors[first].y;
+		char join = joins && cursors[first].x == 0 && y > 0;
+		struct undo_hunk *hunk;
+		if (join && n_hunks > 0 && end == y)
+			// the previous line is in the last hunk already
+			hunk = &record->hunks[n_hunks - 1];
+		else {
+			// hunks are in the line numbers after the edit
+			hunk = &record->hunks[n_hunks++];
+			hunk->y = (size_t)((long long)y + delta);
+			hunk->n_insert = 0;
+			hunk->n_remove = 0;
+			if (join) {
+				struct line_linked_list_node *prev = prev_line(p, cursors[first].line);
+				line_set_span(&record->lines[n_lines++], prev->line.storage,
+					prev->line.line_str, prev->line.length);
+				hunk->y--;
+				hunk->n_insert++;
+				hunk->n_remove++;
+			}
+		}
+
+		struct line *line = &cursors[first].line->line;
+		line_set_span(&record->lines[n_lines++], line->storage, line->line_str, line->length);
+		hunk->n_insert++;
+		hunk->n_remove += 1 + new_lines * (last - first) - join;
+		delta += (long long)(new_lines * (last - first)) - join;
+		end = y + 1;
+
+		first = last;
+	}
+	record->n_hunks = n_hunks;
+	record->cursor_x = p->pos_x;
+	record->cursor_y = p->pos_y;
+
+	p->pending_undo_n_lines = p->n_lines;
+	p->undo_pending = 1;
+}
+
+static void toggle_mark(struct single_buffer_editor_data *p)
+{
+	p->mark_set = !p->mark_set;
+	p->mark_x = p->pos_x;
+	p->mark_y = p->pos_y;
+}
+
+// Gets the text cut/copy work on: the selection if there is one, otherwise
+// the current line (with its '\n', when it has one)
+static void get_region(struct single_buffer_editor_data *p,
+	struct line_linked_list_node **start, size_t *start_x, size_t *start_y,
+	struct line_linked_list_node **end, size_t *end_x, size_t *end_y)
+{
+	if (!p->mark_set) {
+		*start = p->line_y;
+		*start_x = 0;
+		*start_y = p->pos_y;
+		if (p->pos_y < p->n_lines) {
+			*end = next_line(p, p->line_y);
+			*end_x = 0;
+			*end_y = p->pos_y + 1;
+		}
+		else {
+			*end = p->line_y;
+			*end_x = p->line_y->line.length;
+			*end_y = p->pos_y;
+		}
+		return;
+	}
+
+	struct line_linked_list_node *mark_line = line_at(p, p->line_y, p->pos_y, p->mark_y);
+	if (p->mark_y < p->pos_y || (p->mark_y == p->pos_y && p->mark_x < p->pos_x)) {
+		*start = mark_line;
+		*start_x = p->mark_x;
+		*start_y = p->mark_y;
+		*end = p->line_y;
+		*end_x = p->pos_x;
+		*end_y = p->pos_y;
+	}
+	else {
+		*start = p->line_y;
+		*start_x = p->pos_x;
+		*start_y = p->pos_y;
+		*end = mark_line;
+		*end_x = p->mark_x;
+		*end_y = p->mark_y;
+	}
+}
+
+// Fills the clipboard with references to the text from (start, start_x)
+// to (end, end_x). No line content is copied
+static void copy_region(struct single_buffer_editor_data *p,
+	struct line_linked_list_node *start, size_t start_x,
+	struct line_linked_list_node *end, size_t end_x, size_t n_lines)
+{
+	struct clipboard *clipboard = &p->clipboard;
+	clear_clipboard(clipboard);
+	size_t spans_size = 0;
+
+	struct line_linked_list_node *it = start;
+	for (size_t i = 0; i <= n_lines; i++, it = it->next) {
+		struct line *line = &readable_line(it)->line;
+		size_t from = (it == start) ? start_x : 0;
+		size_t to = (it == end) ? end_x : line->length;
+		char *str = &line->line_str[from];
+
+		// right after the last span, with the '\n' in between
+		struct line *last = (clipboard->n_spans > 0) ?
+			&clipboard->spans[clipboard->n_spans - 1] : NULL;
+		if (last != NULL && last->storage == line->storage &&
+			&last->line_str[last->length + 1] == str && last->line_str[last->length] == '\n') {
+			last->length += 1 + to - from;
+			continue;
+		}
+
+		if (clipboard->n_spans == spans_size) {
+			spans_size = (spans_size == 0) ? 16 : 2 * spans_size;
+			clipboard->spans = (struct line *)realloc(clipboard->spans,
+				spans_size * sizeof(struct line));
+			if (clipboard->spans == NULL) {
+				// TODO: Critical failure. Handle in another way
+				exit(1);
+			}
+		}
+		line_set_span(&clipboard->spans[clipboard->n_spans++], line->storage, str, to - from);
+	}
+}
+
+// Returns the lines of the clipboard (n_lines of them): spans borrowing
+// the references of the clipboard, only the array has to be freed
+static struct line *clipboard_lines(struct clipboard *clipboard, size_t *n_lines)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < clipboard->n_spans; i++) {
+		struct line *span = &clipboard->spans[i];
+		for (char *it = span->line_str; it != NULL; n++) {
+			char *newline = memchr(it, '\n', &span->line_str[span->length] - it);
+			it = (newline != NULL) ? newline + 1 : NULL;
+		}
+	}
+
+	struct line *lines = (struct line *)malloc(n * sizeof(struct line));
+	if (lines == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+	*n_lines = 0;
+	for (size_t i = 0; i < clipboard->n_spans; i++) {
+		struct line *span = &clipboard->spans[i];
+		char *span_end = &span->line_str[span->length];
+		for (char *it = span->line_str; it != NULL; (*n_lines)++) {
+			char *newline = memchr(it, '\n', span_end - it);
+			struct line *line = &lines[*n_lines];
+			line->storage = span->storage;
+			line->line_str = it;
+			line->length = ((newline != NULL) ? newline : span_end) - it;
+			it = (newline != NULL) ? newline + 1 : NULL;
+		}
+	}
+
+	return lines;
+}
+
+// Removes the text from (start, start_x) to (end, end_x). Only the start
+// and end lines are touched, the lines in between are just unlinked
+static void delete_region(struct single_buffer_editor_data *p,
+	struct line_linked_list_node *start, size_t start_x,
+	struct line_linked_list_node *end, size_t end_x, size_t n_lines)
+{
+	struct line tail;
+	line_set_span(&tail, end->line.storage, &end->line.line_str[end_x],
+		end->line.length - end_x);
+
+	while (start->next != end->next) {
+		struct line_linked_list_node *node = start->next;
+		unlink_linked_list_node(node);
+		free_linked_list_node(node);
+	}
+
+	// only start_x characters need to be kept (or copied, if shared)
+	start->line.length = start_x;
+	concat_lines(&start->line, &tail);
+	line_clear(&tail);
+
+	p->n_lines -= n_lines;
+}
+
+static void cut_or_copy(struct single_buffer_editor_data *p, char cut)
+{
+	struct line_linked_list_node *start, *end;
+	size_t start_x, start_y, end_x, end_y;
+	get_region(p, &start, &start_x, &start_y, &end, &end_x, &end_y);
+	copy_region(p, start, start_x, end, end_x, end_y - start_y);
+
+	if (cut) {
+		undo_begin(p, start, start_y, end_y - start_y + 1);
+		delete_region(p, start, start_x, end, end_x, end_y - start_y);
+		p->line_y = start;
+		p->pos_x = start_x;
+		p->pos_y = start_y;
+		// the top line of the window might be gone
+		if (p->top_print_line_y > start_y) {
+			p->top_print_line = start;
+			p->top_print_line_y = start_y;
+		}
+		p->clear_window = 1;
+		undo_commit(p);
+	}
+
+	p->mark_set = 0;
+}
+
+// Inserts the clipboard at the cursor. The lines of the clipboard become
+// lines referencing the same storage, only the first and last ones, which
+// are merged with the current line, get their content copied
+static void paste(struct single_buffer_editor_data *p)
+{
+	if (p->clipboard.n_spans == 0)
+		return;
+
+	size_t n_lines;
+	struct line *lines = clipboard_lines(&p->clipboard, &n_lines);
+	struct line *line = &p->line_y->line;
+	struct line *first = &lines[0];
+	if (n_lines == 1) {
+		reserve_line(line, line->length + first->length);
+		memmove(&line->line_str[p->pos_x + first->length], &line->line_str[p->pos_x],
+			line->length - p->pos_x + 1);
+		memcpy(&line->line_str[p->pos_x], first->line_str, first->length);
+		line->length += first->length;
+		p->pos_x += first->length;
+		p->mark_set = 0;
+		p->clear_window = 1;
+		free(lines);
+		return;
+	}
+
+	// the last line of the clipboard gets what was after the cursor
+	struct line *last = &lines[n_lines - 1];
+	size_t tail_length = line->length - p->pos_x;
+	struct line_linked_list_node *last_node;
+	if (tail_length == 0)
+		last_node = alloc_span_linked_list_node(last);
+	else {
+		last_node = alloc_linked_list_node(max(last->length + tail_length + 1, MIN_LINE_SIZE));
+		memcpy(last_node->line.line_str, last->line_str, last->length);
+		memcpy(&last_node->line.line_str[last->length], &line->line_str[p->pos_x], tail_length);
+		last_node->line.length = last->length + tail_length;
+		last_node->line.line_str[last_node->line.length] = '\0';
+	}
+
+	line->length = p->pos_x;
+	concat_lines(line, first);
+
+	struct line_linked_list_node *it = p->line_y;
+	for (size_t i = 1; i < n_lines - 1; i++) {
+		link_linked_list_node(it, alloc_span_linked_list_node(&lines[i]));
+		it = it->next;
+	}
+	link_linked_list_node(it, last_node);
+
+	p->n_lines += n_lines - 1;
+	p->pos_y += n_lines - 1;
+	p->pos_x = last->length;
+	p->line_y = last_node;
+	p->mark_set = 0;
+	p->clear_window = 1;
+	free(lines);
+}
+
+// Multiple cursors
+//
+// Movements are done cursor by cursor, reusing the functions above. Edits
+// are applied as a batch: the cursors are sorted by position and every
+// line is rewritten once, no matter how many cursors it has, adjusting the
+// positions of the cursors on the go
+
+static void add_cursor(struct single_buffer_editor_data *p,
+	size_t x, size_t y, struct line_linked_list_node *line)
+{
+	if (p->n_cursors == p->cursors_size) {
+		size_t new_size = (p->cursors_size == 0) ? 16 : p->cursors_size * 2;
+		struct cursor *new_cursors =
+			(struct cursor *)realloc(p->cursors, new_size * sizeof(struct cursor));
+		if (new_cursors == NULL) {
+			// TODO: Critical failure. Handle in another way
+			exit(1);
+		}
+		p->cursors = new_cursors;
+		p->cursors_size = new_size;
+	}
+
+	struct cursor *cursor = &p->cursors[p->n_cursors++];
+	cursor->x = x;
+	cursor->y = y;
+	cursor->line = line;
+	cursor->is_main = 0;
+	p->clear_window = 1;
+}
+
+static void remove_extra_cursors(struct single_buffer_editor_data *p)
+{
+	if (p->n_cursors > 0)
+		p->clear_window = 1;
+	p->n_cursors = 0;
+}
+
+static int compare_cursors(const void *a, const void *b)
+{
+	const struct cursor *c1 = (const struct cursor *)a;
+	const struct cursor *c2 = (const struct cursor *)b;
+	if (c1->y != c2->y)
+		return (c1->y < c2->y) ? -1 : 1;
+	if (c1->x != c2->x)
+		return (c1->x < c2->x) ? -1 : 1;
+
+	return 0;
+}
+
+// cursors have to be sorted. Returns the number of cursors left
+static size_t remove_duplicated_cursors(struct cursor *cursors, size_t n)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (kept > 0 && cursors[kept - 1].line == cursors[i].line &&
+			cursors[kept - 1].x == cursors[i].x)
+			cursors[kept - 1].is_main |= cursors[i].is_main;
+		else
+			cursors[kept++] = cursors[i];
+	}
+
+	return kept;
+}
+
+// Returns all the cursors (the main one included) sorted by position
+static struct cursor *gather_cursors(struct single_buffer_editor_data *p, size_t *n)
+{
+	struct cursor *cursors =
+		(struct cursor *)malloc((p->n_cursors + 1) * sizeof(struct cursor));
+	if (cursors == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+
+	memcpy(cursors, p->cursors, p->n_cursors * sizeof(struct cursor));
+	cursors[p->n_cursors].x = p->pos_x;
+	cursors[p->n_cursors].y = p->pos_y;
+	cursors[p->n_cursors].line = p->line_y;
+	cursors[p->n_cursors].is_main = 1;
+
+	qsort(cursors, p->n_cursors + 1, sizeof(struct cursor), compare_cursors);
+	*n = remove_duplicated_cursors(cursors, p->n_cursors + 1);
+
+	return cursors;
+}
+
+// The lines above the window might have been added or removed, so we look
+// for the top line around the main cursor, which was on the window
+static void find_top_print_line(struct single_buffer_editor_data *p)
+{
+	struct line_linked_list_node *up = p->line_y, *down = p->line_y;
+	for (size_t i = 0; i <= p->window_nlines; i++) {
+		if (up == p->top_print_line) {
+			p->top_print_line_y = p->pos_y - i;
+			return;
+		}
+		if (down == p->top_print_line) {
+			p->top_print_line_y = p->pos_y + i;
+			return;
+		}
+		if (p->pos_y > i)
+			up = prev_line(p, up);
+		if (down->next != NULL)
+			down = down->next;
+	}
+
+	p->top_print_line = p->line_y;
+	p->top_print_line_y = p->pos_y;
+}
+
+// Puts the cursors back after a batch (and frees them). Batches keep the
+// line, x and y of every cursor up to date
+static void scatter_cursors(struct single_buffer_editor_data *p, struct cursor *cursors, size_t n)
+{
+	n = remove_duplicated_cursors(cursors, n);
+
+	p->n_cursors = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (cursors[i].is_main) {
+			p->pos_x = cursors[i].x;
+			p->pos_y = cursors[i].y;
+			p->line_y = cursors[i].line;
+		}
+		else
+			p->cursors[p->n_cursors++] = cursors[i];
+	}
+	free(cursors);
+
+	find_top_print_line(p);
+	p->clear_window = 1;
+}
+
+// *c MUST be different from '\n'
+static void put_character_all_cursors(struct single_buffer_editor_data *p, char c)
+{
+	size_t n;
+	struct cursor *cursors = gather_cursors(p, &n);
+	undo_begin_cursors(p, cursors, n, 0, 0);
+
+	for (size_t first = 0; first < n;) {
+		// cursors [first, last) are on the same line
+		size_t last = first;
+		while (last < n && cursors[last].line == cursors[first].line)
+			last++;
+
+		struct line *line = &cursors[first].line->line;
+		reserve_line(line, line->length + (last - first));
+		// from right to left, the text after every cursor moves as many
+		// positions as cursors there are up to it
+		size_t tail_end = line->length;
+		for (size_t i = last; i-- > first;) {
+			size_t shift = i - first + 1;
+			size_t x = cursors[i].x;
+			memmove(&line->line_str[x + shift], &line->line_str[x], tail_end - x);
+			line->line_str[x + shift - 1] = c;
+			tail_end = x;
+			cursors[i].x = x + shift;
+		}
+		line->length += last - first;
+		line->line_str[line->length] = '\0';
+
+		first = last;
+	}
+
+	scatter_cursors(p, cursors, n);
+	undo_commit(p);
+}
+
+static void remove_character_all_cursors(struct single_buffer_editor_data *p)
+{
+	size_t n;
+	struct cursor *cursors = gather_cursors(p, &n);
+	undo_begin_cursors(p, cursors, n, 0, 1);
+	// cursors at the start of a line, they join it with the previous one
+	size_t *joins = (size_t *)malloc(n * sizeof(size_t));
+	if (joins == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+	size_t n_joins = 0;
+
+	// first the characters before the rest of cursors, from left to right
+	// the text between two cursors moves as many positions as cursors
+	// there are up to it
+	for (size_t first = 0; first < n;) {
+		size_t last = first;
+		while (last < n && cursors[last].line == cursors[first].line)
+			last++;
+
+		size_t from = first;
+		if (cursors[first].x == 0) {
+			if (cursors[first].y > 0)
+				joins[n_joins++] = first;
+			from++;
+		}
+
+		if (from < last) {
+			struct line *line = &cursors[first].line->line;
+			reserve_line(line, line->length);
+			size_t to = cursors[from].x - 1;
+			for (size_t i = from; i < last; i++) {
+				size_t text_start = cursors[i].x;
+				size_t text_end = (i + 1 < last) ? cursors[i + 1].x - 1 : line->length;
+				memmove(&line->line_str[to], &line->line_str[text_start],
+					text_end - text_start);
+				cursors[i].x = to;
+				to += text_end - text_start;
+			}
+			line->length = to;
+			line->line_str[line->length] = '\0';
+		}
+
+		first = last;
+	}
+
+	// then the joins, bottom up. The cursors on a joined line (all of them
+	// after the one joining it) go to the previous line
+	for (size_t j = n_joins; j-- > 0;) {
+		size_t i = joins[j];
+		struct line_linked_list_node *joined_line = cursors[i].line;
+		struct line_linked_list_node *prev_line = joined_line->prev;
+		size_t prev_line_length = join_with_previous_line(p, joined_line);
+		for (size_t k = i; k < n && cursors[k].line == joined_line; k++) {
+			cursors[k].line = prev_line;
+			cursors[k].x += prev_line_length;
+		}
+	}
+	// every join moves the lines below it one up
+	for (size_t i = 0, j = 0; i < n; i++) {
+		while (j < n_joins && joins[j] <= i)
+			j++;
+		cursors[i].y -= j;
+	}
+	free(joins);
+
+	scatter_cursors(p, cursors, n);
+	undo_commit(p);
+}
+
+static void insert_new_line_all_cursors(struct single_buffer_editor_data *p)
+{
+	size_t n;
+	struct cursor *cursors = gather_cursors(p, &n);
+	undo_begin_cursors(p, cursors, n, 1, 0);
+
+	// bottom up, so the lines of the cursors left don't move. The cursors
+	// after the one splitting a line are already on lines of their own, and
+	// every split up to a cursor moves it one line down
+	for (size_t i = n; i-- > 0;) {
+		cursors[i].line = split_line(p, cursors[i].line, cursors[i].x);
+		cursors[i].x = 0;
+		cursors[i].y += i + 1;
+	}
+
+	scatter_cursors(p, cursors, n);
+	undo_commit(p);
+}
+
+static void move_all_cursors(struct single_buffer_editor_data *p,
+	void (*move_cursor)(struct single_buffer_editor_data *p))
+{
+	size_t pos_x = p->pos_x, pos_y = p->pos_y;
+	struct line_linked_list_node *line_y = p->line_y;
+
+	// the move functions work on the main cursor
+	for (size_t i = 0; i < p->n_cursors; i++) {
+		p->pos_x = p->cursors[i].x;
+		p->pos_y = p->cursors[i].y;
+		p->line_y = p->cursors[i].line;
+		move_cursor(p);
+		p->cursors[i].x = p->pos_x;
+		p->cursors[i].y = p->pos_y;
+		p->cursors[i].line = p->line_y;
+	}
+
+	p->pos_x = pos_x;
+	p->pos_y = pos_y;
+	p->line_y = line_y;
+	move_cursor(p);
+
+	if (p->n_cursors > 0) {
+		// some of them might have met
+		size_t n;
+		struct cursor *cursors = gather_cursors(p, &n);
+		scatter_cursors(p, cursors, n);
+	}
+}
+
+// the cursor furthest in the buffer
+static struct cursor last_cursor(struct single_buffer_editor_data *p)
+{
+	struct cursor ret = { p->pos_x, p->pos_y, p->line_y, 1 };
+	for (size_t i = 0; i < p->n_cursors; i++)
+		if (compare_cursors(&p->cursors[i], &ret) > 0)
+			ret = p->cursors[i];
+
+	return ret;
+}
+
+static int is_word_character(char c)
+{
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+// Adds a cursor at the next occurrence of the selection, if it doesn't
+// span several lines, or of the word under the main cursor otherwise. The
+// search starts after the last cursor, and the cursor is put at the same
+// place of the match the main cursor is at
+static void add_cursor_at_next_match(struct single_buffer_editor_data *p)
+{
+	struct line *line = &p->line_y->line;
+	size_t start, end;
+	if (p->mark_set && p->mark_y == p->pos_y && p->mark_x != p->pos_x) {
+		start = (p->mark_x < p->pos_x) ? p->mark_x : p->pos_x;
+		end = (p->mark_x < p->pos_x) ? p->pos_x : p->mark_x;
+	}
+	else {
+		start = end = p->pos_x;
+		while (start > 0 && is_word_character(line->line_str[start - 1]))
+			start--;
+		while (end < line->length && is_word_character(line->line_str[end]))
+			end++;
+	}
+	if (start == end)
+		return;
+
+	const char *needle = &line->line_str[start];
+	size_t needle_length = end - start;
+	size_t offset = p->pos_x - start;
+
+	struct cursor last = last_cursor(p);
+	struct line_linked_list_node *it = last.line;
+	size_t y = last.y;
+	size_t from = last.x + needle_length - offset;
+	for (; it != NULL; it = next_line(p, it), y++, from = 0) {
+		size_t match = line_find(&it->line, from, needle, needle_length);
+		if (match != LINE_NOT_FOUND) {
+			add_cursor(p, match + offset, y, it);
+			return;
+		}
+	}
+}
+
+// Adds a cursor on the line below the last cursor, at the column of the
+// main cursor (or at the end of the line if it's shorter)
+static void add_cursor_below(struct single_buffer_editor_data *p)
+{
+	struct cursor last = last_cursor(p);
+	if (last.y == p->n_lines)
+		return;
+
+	struct line_linked_list_node *below = next_line(p, last.line);
+	size_t x = (below->line.length >= p->pos_x) ? p->pos_x : below->line.length;
+	add_cursor(p, x, last.y + 1, below);
+}
+
+static void apply_undo_record(struct single_buffer_editor_data *p, struct undo_record *record)
+{
+	remove_extra_cursors(p);
+	p->mark_set = 0;
+
+	// the hunks (and the lines right before and after them) have to be
+	// loaded
+	struct undo_hunk *first = &record->hunks[0], *last = &record->hunks[record->n_hunks - 1];
+	size_t to_y = last->y + last->n_remove;
+	load_lines_between(p, (first->y > 0) ? first->y - 1 : 0,
+		(to_y < p->n_lines) ? to_y : p->n_lines);
+
+	size_t x = record->cursor_x, y = record->cursor_y;
+	size_t node_y = p->pos_y;
+	struct line_linked_list_node *node =
+		undo_record_apply(record, &p->lines, &p->n_lines, p->line_y, &node_y);
+
+	p->pos_y = y;
+	p->line_y = line_at(p, node, node_y, y);
+	p->pos_x = (p->line_y->line.length >= x) ? x : p->line_y->line.length;
+	// the top line of the window might be gone, the cursor goes to the
+	// middle of the window
+	p->top_print_line_y = (y > p->window_nlines / 2) ? y - p->window_nlines / 2 : 0;
+	p->top_print_line = line_at(p, p->line_y, y, p->top_print_line_y);
+	p->clear_window = 1;
+}
+
+static void undo(struct single_buffer_editor_data *p)
+{
+	struct undo_record *record = undo_history_to_undo(&p->undo_history);
+	if (record == NULL) {
+		snprintf(p->message, sizeof(p->message), "Nothing to undo");
+		return;
+	}
+
+	apply_undo_record(p, record);
+	undo_history_undone(&p->undo_history);
+}
+
+static void redo(struct single_buffer_editor_data *p)
+{
+	struct undo_record *record = undo_history_to_redo(&p->undo_history);
+	if (record == NULL) {
+		snprintf(p->message, sizeof(p->message), "Nothing to redo");
+		return;
+	}
+
+	apply_undo_record(p, record);
+	undo_history_redone(&p->undo_history);
+}
+
+static void replace_all(struct single_buffer_editor_data *p, struct replace_all_data *data)
+{
+	if (data->search[0] == '\0') {
+		snprintf(p->message, sizeof(p->message), "Nothing to search for");
+		return;
+	}
+
+	// the workers can't create lines
+	load_all_lines(p);
+	int ret = replace_all_start(&p->replace_all_job, p->lines, p->n_lines + 1,
+		data->search, data->replacement);
+	if (ret < 0) {
+		p->replace_all_job = NULL;
+		snprintf(p->message, sizeof(p->message), "Couldn't replace: %s", strerror(-ret));
+		return;
+	}
+
+	snprintf(p->message, sizeof(p->message), "Replacing...");
+}
+
+// Puts the result of the replace-all in the buffer once the workers are
+// done. It's a single edit, undone at once
+static void check_replace_all(struct single_buffer_editor_data *p)
+{
+	if (!replace_all_done(p->replace_all_job)) {
+		snprintf(p->message, sizeof(p->message), "Replacing... %zu%%",
+			replace_all_progress(p->replace_all_job) * 100 / (p->n_lines + 1));
+		return;
+	}
+
+	struct replace_all_result result;
+	replace_all_finish(p->replace_all_job, &result);
+	p->replace_all_job = NULL;
+
+	if (result.n_lines > 0) {
+		struct undo_record record;
+		undo_record_alloc(&record, result.n_lines, result.n_lines);
+		for (size_t i = 0; i < result.n_lines; i++) {
+			struct replaced_line *replaced = &result.lines[i];
+			record.hunks[i].y = replaced->y;
+			record.hunks[i].n_remove = 1;
+			record.hunks[i].n_insert = 1;
+			// the old line moves to the record, no copies
+			record.lines[i] = replaced->node->line;
+			replaced->node->line = replaced->line;
+		}
+		record.cursor_x = record.inverse_cursor_x = p->pos_x;
+		record.cursor_y = record.inverse_cursor_y = p->pos_y;
+		undo_history_push(&p->undo_history, &record);
+
+		// the lines of the cursors might be shorter now
+		if (p->pos_x > p->line_y->line.length)
+			p->pos_x = p->line_y->line.length;
+		for (size_t i = 0; i < p->n_cursors; i++)
+			if (p->cursors[i].x > p->cursors[i].line->line.length)
+				p->cursors[i].x = p->cursors[i].line->line.length;
+		p->mark_set = 0;
+		p->typing = 0;
+		p->clear_window = 1;
+		p->compression_idle = 0;
+	}
+	free(result.lines);
+
+	uint64_t end_ns = stats_now_ns();
+	trace_record("replace_all", "job", end_ns - result.elapsed_ns, end_ns);
+	snprintf(p->message, sizeof(p->message), "Replaced %zu occurrences in %zu lines (%.1f ms)",
+		result.n_matches, result.n_lines, result.elapsed_ns / 1000000.0);
+}
+
+// Sort, unique, filter and pipe through a command
+//
+// They work on whole lines, those of the selection or the whole buffer.
+// The lines of the result (references to the lines of the range, but for
+// the output of a command) take the place of the range as a single undo
+// record, applied like any other
+
+// Takes references to the lines sort, unique and filter work on. Returns
+// how many there are
+static size_t get_line_range(struct single_buffer_editor_data *p, size_t *first_y,
+	struct line **lines)
+{
+	size_t last_y = p->n_lines;
+	*first_y = 0;
+	if (p->mark_set) {
+		char mark_first = p->mark_y < p->pos_y;
+		*first_y = mark_first ? p->mark_y : p->pos_y;
+		last_y = mark_first ? p->pos_y : p->mark_y;
+		// a selection ending at the start of a line doesn't take it
+		size_t last_x = mark_first ? p->pos_x : p->mark_x;
+		if (last_y > *first_y && last_x == 0)
+			last_y--;
+	}
+	else
+		load_all_lines(p);
+
+	size_t n = last_y - *first_y + 1;
+	*lines = (struct line *)malloc(n * sizeof(struct line));
+	if (*lines == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+	struct line_linked_list_node *it = line_at(p, p->line_y, p->pos_y, *first_y);
+	for (size_t i = 0; i < n; i++) {
+		line_set_span(&(*lines)[i], it->line.storage, it->line.line_str, it->line.length);
+		if (i + 1 < n)
+			it = next_line(p, it);
+	}
+	// the empty line after the last '\n' isn't really a line
+	if (last_y == p->n_lines && n > 1 && it->line.length == 0)
+		line_clear(&(*lines)[--n]);
+
+	return n;
+}
+
+// Puts the n lines in place of the n_range lines from first_y on. Takes
+// the references, and the array (malloc'd, with room for a line at least)
+static void replace_line_range(struct single_buffer_editor_data *p, size_t first_y,
+	size_t n_range, struct line *lines, size_t n)
+{
+	// the buffer can't be left without lines
+	if (n == 0 && n_range == p->n_lines + 1) {
+		struct line_storage *storage = line_storage_alloc(MIN_LINE_SIZE);
+		storage->data[0] = '\0';
+		line_set_span(&lines[0], storage, storage->data, 0);
+		line_storage_unref(storage);
+		n = 1;
+	}
+
+	struct undo_record record;
+	undo_record_alloc(&record, 1, 0);
+	// no copies of the array, it can be millions of lines
+	free(record.lines);
+	record.lines = lines;
+	record.hunks[0].y = first_y;
+	record.hunks[0].n_remove = n_range;
+	record.hunks[0].n_insert = n;
+	// the first line of the result, if there's still a line there
+	size_t n_lines = p->n_lines + n - n_range;
+	record.cursor_x = 0;
+	record.cursor_y = (first_y <= n_lines) ? first_y : n_lines;
+	record.inverse_cursor_x = p->pos_x;
+	record.inverse_cursor_y = p->pos_y;
+
+	// it's applied as if we were redoing it, and becomes what undoes it
+	apply_undo_record(p, &record);
+	undo_history_push(&p->undo_history, &record);
+	p->typing = 0;
+}
+
+static void sort_lines(struct single_buffer_editor_data *p)
+{
+	uint64_t start_ns = stats_now_ns();
+	struct line *lines;
+	size_t first_y;
+	size_t n = get_line_range(p, &first_y, &lines);
+	size_t *order = (size_t *)malloc((n + 1) * sizeof(size_t));
+	struct line *sorted = (struct line *)malloc((n + 1) * sizeof(struct line));
+	if (order == NULL || sorted == NULL || line_sort(lines, n, order) < 0) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+
+	size_t n_moved = 0;
+	for (size_t i = 0; i < n; i++) {
+		sorted[i] = lines[order[i]];
+		n_moved += (order[i] != i);
+	}
+	if (n_moved > 0)
+		replace_line_range(p, first_y, n, sorted, n);
+	else {
+		for (size_t i = 0; i < n; i++)
+			line_clear(&lines[i]);
+		free(sorted);
+	}
+	free(order);
+	free(lines);
+
+	uint64_t end_ns = stats_now_ns();
+	trace_record("sort_lines", "lines", start_ns, end_ns);
+	snprintf(p->message, sizeof(p->message), "Sorted %zu lines, %zu moved (%.1f ms)",
+		n, n_moved, (end_ns - start_ns) / 1000000.0);
+}
+
+// Drops the lines marked in drop. Returns how many are left
+static size_t drop_lines(struct line *lines, size_t n, const char *drop)
+{
+	size_t n_kept = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (drop[i])
+			line_clear(&lines[i]);
+		else
+			lines[n_kept++] = lines[i];
+	}
+
+	return n_kept;
+}
+
+static void unique_lines(struct single_buffer_editor_data *p)
+{
+	uint64_t start_ns = stats_now_ns();
+	struct line *lines;
+	size_t first_y;
+	size_t n = get_line_range(p, &first_y, &lines);
+	size_t *order = (size_t *)malloc((n + 1) * sizeof(size_t));
+	char *duplicated = (char *)malloc(n + 1);
+	if (order == NULL || duplicated == NULL || line_sort(lines, n, order) < 0) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+
+	size_t n_duplicated = line_sort_duplicates(lines, n, order, duplicated);
+	size_t n_kept = drop_lines(lines, n, duplicated);
+	if (n_duplicated > 0)
+		replace_line_range(p, first_y, n, lines, n_kept);
+	else {
+		for (size_t i = 0; i < n_kept; i++)
+			line_clear(&lines[i]);
+		free(lines);
+	}
+	free(duplicated);
+	free(order);
+
+	uint64_t end_ns = stats_now_ns();
+	trace_record("unique_lines", "lines", start_ns, end_ns);
+	snprintf(p->message, sizeof(p->message), "Dropped %zu duplicated lines of %zu (%.1f ms)",
+		n_duplicated, n, (end_ns - start_ns) / 1000000.0);
+}
+
+static void filter_lines(struct single_buffer_editor_data *p, struct filter_lines_data *data)
+{
+	if (data->pattern[0] == '\0') {
+		snprintf(p->message, sizeof(p->message), "Nothing to search for");
+		return;
+	}
+
+	uint64_t start_ns = stats_now_ns();
+	struct line *lines;
+	size_t first_y;
+	size_t n = get_line_range(p, &first_y, &lines);
+	char *drop = (char *)malloc(n + 1);
+	if (drop == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+
+	size_t pattern_length = strlen(data->pattern);
+	size_t n_dropped = 0;
+	for (size_t i = 0; i < n; i++) {
+		char found = line_find(&lines[i], 0, data->pattern, pattern_length) != LINE_NOT_FOUND;
+		drop[i] = (found != data->keep);
+		n_dropped += drop[i];
+	}
+	size_t n_kept = drop_lines(lines, n, drop);
+	if (n_dropped > 0)
+		replace_line_range(p, first_y, n, lines, n_kept);
+	else {
+		for (size_t i = 0; i < n_kept; i++)
+			line_clear(&lines[i]);
+		free(lines);
+	}
+	free(drop);
+
+	uint64_t end_ns = stats_now_ns();
+	trace_record("filter_lines", "lines", start_ns, end_ns);
+	snprintf(p->message, sizeof(p->message), "Kept %zu lines of %zu (%.1f ms)",
+		n - n_dropped, n, (end_ns - start_ns) / 1000000.0);
+}
+
+// The lines go through the command in the background (see
+// backend/pipe_command.h), the buffer can't be modified until its output
+// takes their place
+static void pipe_lines(struct single_buffer_editor_data *p, struct pipe_lines_data *data)
+{
+	if (data->command[0] == '\0') {
+		snprintf(p->message, sizeof(p->message), "No command to run");
+		return;
+	}
+
+	struct line *lines;
+	size_t first_y;
+	size_t n = get_line_range(p, &first_y, &lines);
+	int ret = pipe_command_start(&p->pipe_command_job, data->command, lines, n);
+	if (ret < 0) {
+		p->pipe_command_job = NULL;
+		for (size_t i = 0; i < n; i++)
+			line_clear(&lines[i]);
+		free(lines);
+		snprintf(p->message, sizeof(p->message), "Couldn't run the command: %s",
+			strerror(-ret));
+		return;
+	}
+
+	p->pipe_first_y = first_y;
+	p->pipe_n_lines = n;
+	snprintf(p->message, sizeof(p->message), "Piping %zu lines...", n);
+}
+
+// Waits for the command and puts its output in place of the lines, unless
+// it failed. It's a single edit, undone at once
+static void finish_pipe_command(struct single_buffer_editor_data *p)
+{
+	struct pipe_command_result result;
+	pipe_command_finish(p->pipe_command_job, &result);
+	p->pipe_command_job = NULL;
+
+	// the start of the first line of stderr says best what went wrong
+	int error_length = strcspn(result.error, "\n");
+	if (result.canceled)
+		snprintf(p->message, sizeof(p->message), "Canceled");
+	else if (result.status < 0)
+		snprintf(p->message, sizeof(p->message), "Couldn't wait for the command: %s",
+			strerror(-result.status));
+	else if (WIFSIGNALED(result.status))
+		snprintf(p->message, sizeof(p->message), "The command was killed by signal %d",
+			WTERMSIG(result.status));
+	else if (WEXITSTATUS(result.status) != 0)
+		snprintf(p->message, sizeof(p->message), "The command failed (exit status %d)%s%.*s",
+			WEXITSTATUS(result.status), (error_length > 0) ? ": " : "", error_length,
+			result.error);
+	else {
+		replace_line_range(p, p->pipe_first_y, p->pipe_n_lines, result.lines,
+			result.n_lines);
+		// the lines of the range are gone, and there are new ones
+		p->first_lines_pinned = p->last_lines_pinned = 0;
+		p->compression_scan = NULL;
+		p->compression_idle = 0;
+		snprintf(p->message, sizeof(p->message), "Replaced %zu lines with %zu (%.1f ms)",
+			p->pipe_n_lines, result.n_lines, result.elapsed_ns / 1000000.0);
+		result.lines = NULL;
+		result.n_lines = 0;
+	}
+	for (size_t i = 0; i < result.n_lines; i++)
+		line_clear(&result.lines[i]);
+	free(result.lines);
+
+	uint64_t end_ns = stats_now_ns();
+	trace_record("pipe_lines", "job", end_ns - result.elapsed_ns, end_ns);
+}
+
+static void check_pipe_command(struct single_buffer_editor_data *p)
+{
+	if (pipe_command_done(p->pipe_command_job)) {
+		finish_pipe_command(p);
+		return;
+	}
+
+	size_t written, read, input_size;
+	pipe_command_progress(p->pipe_command_job, &written, &read, &input_size);
+	snprintf(p->message, sizeof(p->message), "Piping... %zu%% in, %zu KB out",
+		written * 100 / input_size, read / 1024);
+}
+
+// Nothing the job did so far is kept
+static void cancel_job(struct single_buffer_editor_data *p)
+{
+	if (p->pipe_command_job != NULL) {
+		pipe_command_cancel(p->pipe_command_job);
+		finish_pipe_command(p);
+	}
+	else if (p->replace_all_job != NULL) {
+		replace_all_cancel(p->replace_all_job);
+		struct replace_all_result result;
+		replace_all_finish(p->replace_all_job, &result);
+		p->replace_all_job = NULL;
+		for (size_t i = 0; i < result.n_lines; i++)
+			line_clear(&result.lines[i].line);
+		free(result.lines);
+		snprintf(p->message, sizeof(p->message), "Canceled");
+	}
+	else
+		snprintf(p->message, sizeof(p->message), "Nothing to cancel");
+}
+
+// Columns view
+//
+// Only the rows in the window are split into fields, every time they're
+// drawn, so it costs the same on any file. Widths only grow: the first
+// rows sampled give an estimate, and more rows from all over the file
+// (read straight from it, through the index) refine it on every tick
+
+static char sampling_columns(struct single_buffer_editor_data *p)
+{
+	return p->columns_view && p->column_sample_next < p->line_index.n_offsets;
+}
+
+// Samples the next COLUMN_SAMPLE_SPOTS spots of the file
+static void sample_column_widths(struct single_buffer_editor_data *p)
+{
+	if (p->file_data == NULL) {
+		p->column_sample_next = p->line_index.n_offsets;
+		return;
+	}
+
+	size_t first_offset = p->line_index.offsets[p->column_sample_next];
+	size_t offset = first_offset;
+	for (size_t spot = 0; spot < COLUMN_SAMPLE_SPOTS && sampling_columns(p); spot++) {
+		offset = p->line_index.offsets[p->column_sample_next++];
+		for (size_t row = 0; row < COLUMN_SAMPLE_ROWS && offset < p->file_size; row++) {
+			size_t length = p->file_size - offset;
+			if (length > COLUMN_SAMPLE_MAX_ROW)
+				length = COLUMN_SAMPLE_MAX_ROW;
+			const char *end = memchr(&p->file_data[offset], '\n', length);
+			if (end != NULL)
+				length = end - &p->file_data[offset];
+			column_layout_add_row(&p->columns, &p->file_data[offset], length);
+			offset += length + 1;
+		}
+	}
+	// the loaded lines (the window among them) point into the file
+	size_t loaded_start = p->line_index.offsets[p->first_loaded_y / LOAD_BATCH_LINES];
+	size_t loaded_end = (p->n_unloaded_lines > 0) ? p->unloaded_offset : p->file_size;
+	release_file_range(p, first_offset, (offset < loaded_start) ? offset : loaded_start);
+	release_file_range(p, (first_offset > loaded_end) ? first_offset : loaded_end, offset);
+}
+
+static void toggle_columns(struct single_buffer_editor_data *p)
+{
+	p->clear_window = 1;
+	if (p->columns_view) {
+		p->columns_view = 0;
+		column_layout_free(&p->columns);
+		return;
+	}
+
+	struct line *line = &p->line_y->line;
+	char delimiter = columns_detect_delimiter(p->file_path, line->line_str, line->length);
+	if (delimiter == 0) {
+		snprintf(p->message, sizeof(p->message), "No columns in this line");
+		return;
+	}
+
+	p->columns_view = 1;
+	column_layout_init(&p->columns, delimiter);
+	p->first_column = 0;
+	p->column_sample_next = 0;
+	sample_column_widths(p);
+	if (delimiter == '\t')
+		snprintf(p->message, sizeof(p->message), "Columns separated by tabs");
+	else
+		snprintf(p->message, sizeof(p->message), "Columns separated by '%c'", delimiter);
+}
+
+// the field x is in (the one it ends, if it's on a delimiter)
+static size_t field_at(struct column_field *fields, size_t n_fields, size_t x)
+{
+	size_t i = 0;
+	while (i + 1 < n_fields && x > fields[i].start + fields[i].length)
+		i++;
+
+	return i;
+}
+
+// Screen column where column c starts, -1 if it isn't drawn
+static long column_screen_x(struct single_buffer_editor_data *p, size_t c)
+{
+	if (c < p->first_column)
+		return -1;
+
+	size_t x = 0;
+	for (size_t i = p->first_column; i < c && x < p->window_ncols; i++)
+		x += p->columns.widths[i] + strlen(COLUMN_SEPARATOR);
+
+	return (x < p->window_ncols) ? (long)x : -1;
+}
+
+// Draws the row at screen line y. The field the cursor is in is drawn from
+// skip on, so the cursor is always in it
+static void draw_columns_row(struct single_buffer_editor_data *p, int y, struct line *line,
+	size_t select_from, size_t select_to, size_t cursor_field, size_t skip)
+{
+	struct column_field fields[COLUMNS_MAX_FIELDS];
+	size_t n_fields = columns_split(line->line_str, line->length, p->columns.delimiter,
+		fields, COLUMNS_MAX_FIELDS);
+
+	size_t x = 0;
+	char cell[COLUMNS_MAX_WIDTH];
+	for (size_t c = p->first_column; c < n_fields && x < p->window_ncols; c++) {
+		size_t start = fields[c].start + ((c == cursor_field) ? skip : 0);
+		size_t length = fields[c].start + fields[c].length - start;
+		if (length > p->columns.widths[c])
+			length = p->columns.widths[c];
+		if (length > p->window_ncols - x)
+			length = p->window_ncols - x;
+		// tabs would take more than a column
+		for (size_t i = 0; i < length; i++)
+			cell[i] = (line->line_str[start + i] == '\t') ? ' ' : line->line_str[start + i];
+
+		char selected = select_from < fields[c].start + fields[c].length &&
+			select_to > fields[c].start;
+		p->display->put_str(p->display, y, x, cell, length,
+			selected ? DISPLAY_ATTRIBUTE_REVERSE : DISPLAY_ATTRIBUTE_NORMAL);
+		x += p->columns.widths[c];
+		size_t separator_length = strlen(COLUMN_SEPARATOR);
+		if (c + 1 < n_fields && x < p->window_ncols)
+			p->display->put_str(p->display, y, x, COLUMN_SEPARATOR,
+				(separator_length < p->window_ncols - x) ?
+				separator_length : p->window_ncols - x, DISPLAY_ATTRIBUTE_NORMAL);
+		x += separator_length;
+	}
+}
+
+// Widens the columns for the rows of the window, and scrolls them sideways
+// until the one of the cursor fits. Returns 1 if the columns aren't where
+// they were drawn last time, then the window has to be cleared
+static char fit_columns(struct single_buffer_editor_data *p)
+{
+	struct line_linked_list_node *current_line = readable_line(p->top_print_line);
+	for (int i = 0; i < p->window_nlines && current_line != NULL; i++) {
+		column_layout_add_row(&p->columns, current_line->line.line_str,
+			current_line->line.length);
+		current_line = next_line(p, current_line);
+	}
+
+	struct column_field fields[COLUMNS_MAX_FIELDS];
+	struct line *line = &p->line_y->line;
+	size_t n_fields = columns_split(line->line_str, line->length, p->columns.delimiter,
+		fields, COLUMNS_MAX_FIELDS);
+	size_t cursor_field = field_at(fields, n_fields, p->pos_x);
+	size_t width = p->columns.widths[cursor_field];
+	// and room for the cursor after it
+	size_t needed = (width + 1 < p->window_ncols) ? width + 1 : p->window_ncols;
+	if (cursor_field < p->first_column)
+		p->first_column = cursor_field;
+	while (p->first_column < cursor_field && (column_screen_x(p, cursor_field) < 0 ||
+		column_screen_x(p, cursor_field) + needed > p->window_ncols))
+		p->first_column++;
+
+	char moved = p->columns.version != p->columns_drawn_version ||
+		p->first_column != p->columns_drawn_first;
+	p->columns_drawn_version = p->columns.version;
+	p->columns_drawn_first = p->first_column;
+	return moved;
+}
+
+// Draws the rows of the window as columns, once fit_columns() placed them.
+// Only the row of the cursor is cleared: the rest are drawn where they were
+static void draw_columns(struct single_buffer_editor_data *p,
+	size_t select_start_x, size_t select_start_y, size_t select_end_x, size_t select_end_y,
+	unsigned int *cursor_x, unsigned int *cursor_y)
+{
+	struct column_field fields[COLUMNS_MAX_FIELDS];
+	struct line *line = &p->line_y->line;
+	size_t n_fields = columns_split(line->line_str, line->length, p->columns.delimiter,
+		fields, COLUMNS_MAX_FIELDS);
+	size_t cursor_field = field_at(fields, n_fields, p->pos_x);
+	size_t width = p->columns.widths[cursor_field];
+	// the cursor can be right after the last character of the field
+	size_t in_field = p->pos_x - fields[cursor_field].start;
+	size_t skip = (in_field >= width) ? in_field - width + (width > 0) : 0;
+
+	struct line_linked_list_node *current_line = readable_line(p->top_print_line);
+	for (int i = 0; i < p->window_nlines && current_line != NULL; i++) {
+		size_t line_y = p->top_print_line_y + i;
+		size_t select_from = 1, select_to = 0;
+		if (select_start_y <= line_y && line_y <= select_end_y) {
+			select_from = (line_y == select_start_y) ? select_start_x : 0;
+			select_to = (line_y == select_end_y) ? select_end_x : current_line->line.length;
+		}
+		if (line_y == p->pos_y)
+			p->display->clear_line(p->display, i, 0);
+		draw_columns_row(p, i, &current_line->line, select_from, select_to,
+			(line_y == p->pos_y) ? cursor_field : COLUMNS_MAX_FIELDS, skip);
+		current_line = next_line(p, current_line);
+	}
+
+	*cursor_y = p->pos_y - p->top_print_line_y;
+	*cursor_x = column_screen_x(p, cursor_field) + in_field - skip;
+	if (*cursor_x >= p->window_ncols)
+		*cursor_x = p->window_ncols - 1;
+
+	// the extra cursors, at the start of their field if it's drawn
+	for (size_t i = 0; i < p->n_cursors; i++) {
+		struct cursor *cursor = &p->cursors[i];
+		if (cursor->y < p->top_print_line_y ||
+			cursor->y >= p->top_print_line_y + p->window_nlines)
+			continue;
+
+		line = &cursor->line->line;
+		n_fields = columns_split(line->line_str, line->length, p->columns.delimiter,
+			fields, COLUMNS_MAX_FIELDS);
+		size_t field = field_at(fields, n_fields, cursor->x);
+		long x = column_screen_x(p, field);
+		size_t in_cell = cursor->x - fields[field].start;
+		if (x < 0 || in_cell >= p->columns.widths[field] ||
+			x + in_cell >= p->window_ncols || cursor->y == p->pos_y)
+			continue;
+
+		char c = (cursor->x < line->length && line->line_str[cursor->x] != '\t') ?
+			line->line_str[cursor->x] : ' ';
+		p->display->put_str(p->display, cursor->y - p->top_print_line_y, x + in_cell,
+			&c, 1, DISPLAY_ATTRIBUTE_REVERSE);
+	}
+}
+
+// Writes the line (and the '\n' after it, if there's one) copying from
+// the file whatever still is in it as it was
+static int save_line(struct single_buffer_editor_data *p, struct save_writer *writer,
+	struct line *line, char newline)
+{
+	// not modified since we loaded it. Pasted text can point into the
+	// file too, but then it's usually just a part of a line
+	if (line->storage == NULL && line->length > 0) {
+		size_t offset = line->line_str - p->file_data;
+		size_t end = offset + line->length;
+		if (newline && end < p->file_size && p->file_data[end] == '\n')
+			return save_writer_copy(writer, offset, line->length + 1);
+
+		int ret = save_writer_copy(writer, offset, line->length);
+		if (ret < 0 || !newline)
+			return ret;
+		return save_writer_write(writer, "\n", 1);
+	}
+
+	int ret = save_writer_write(writer, line->line_str, line->length);
+	if (ret < 0 || !newline)
+		return ret;
+	return save_writer_write(writer, "\n", 1);
+}
+
+// Writes the lines of the block *node is in (the first line of it). *node
+// is left at the last one
+static int save_compressed_lines(struct single_buffer_editor_data *p,
+	struct save_writer *writer, struct line_linked_list_node **node)
+{
+	struct line_storage *block = (*node)->line.storage;
+	const char *contents = read_compressed_lines(block);
+	for (struct line_linked_list_node *it = *node; it != NULL && it->line.storage == block;
+		it = it->next) {
+		int ret = save_writer_write(writer, contents, it->line.length);
+		if (ret == 0 && (it->next != NULL || p->n_unloaded_lines > 0))
+			ret = save_writer_write(writer, "\n", 1);
+		if (ret < 0)
+			return ret;
+		contents += it->line.length;
+		*node = it;
+	}
+
+	return 0;
+}
+
+// Writes the buffer to fd. Only the modified lines are really written, the
+// rest is copied from the file we loaded (see backend/save_writer.h)
+static int write_buffer(struct single_buffer_editor_data *p, int fd,
+	size_t *bytes_written, size_t *bytes_copied)
+{
+	struct save_writer *writer = (struct save_writer *)malloc(sizeof(struct save_writer));
+	if (writer == NULL)
+		return -errno;
+	save_writer_init(writer, fd, p->file_fd, p->file_data);
+
+	int ret = 0;
+	// the lines before the loaded ones are the start of the file
+	if (p->first_loaded_y > 0) {
+		ret = save_writer_copy(writer, 0,
+			p->line_index.offsets[p->first_loaded_y / LOAD_BATCH_LINES]);
+		if (ret < 0)
+			goto err_writing;
+	}
+
+	// every line but the last one ends with '\n'
+	for (struct line_linked_list_node *it = p->lines; it != NULL; it = it->next) {
+		if (line_is_compressed(&it->line))
+			ret = save_compressed_lines(p, writer, &it);
+		else
+			ret = save_line(p, writer, &it->line, it->next != NULL || p->n_unloaded_lines > 0);
+		if (ret < 0)
+			goto err_writing;
+	}
+	// the lines not loaded yet are just as they are in the file
+	if (p->n_unloaded_lines > 0) {
+		ret = save_writer_copy(writer, p->unloaded_offset,
+			p->file_size - p->unloaded_offset);
+		if (ret < 0)
+			goto err_writing;
+	}
+
+	ret = save_writer_flush(writer);
+	if (ret < 0)
+		goto err_writing;
+	if (fsync(fd) < 0) {
+		ret = -errno;
+		goto err_writing;
+	}
+	*bytes_written = writer->bytes_written;
+	*bytes_copied = writer->bytes_copied;
+
+err_writing:
+	free(writer);
+	return ret;
+}
+
+// Replacing the file by a new one is only safe if nothing else refers to
+// it: a symbolic link would become a regular file, a hard link would be
+// split, and someone else's file would become ours
+static char can_replace_file(const char *path)
+{
+	struct stat st;
+	if (lstat(path, &st) < 0)
+		return errno == ENOENT;
+
+	return S_ISREG(st.st_mode) && st.st_nlink == 1 && st.st_uid == geteuid();
+}
+
+// Creates a file named prefix and a unique suffix, *tmp_path gets the name
+// (to be freed). Returns the file or -errno
+static int create_temporary(const char *prefix, char **tmp_path)
+{
+	size_t tmp_path_size = strlen(prefix) + 8;
+	*tmp_path = (char *)malloc(tmp_path_size);
+	if (*tmp_path == NULL)
+		return -errno;
+	snprintf(*tmp_path, tmp_path_size, "%s.XXXXXX", prefix);
+
+	int fd = mkostemp(*tmp_path, O_CLOEXEC);
+	if (fd < 0) {
+		int ret = -errno;
+		free(*tmp_path);
+		*tmp_path = NULL;
+		return ret;
+	}
+
+	return fd;
+}
+
+static const char *temporary_directory(void)
+{
+	const char *dir = getenv("TMPDIR");
+	return (dir != NULL && dir[0] != '\0') ? dir : P_tmpdir;
+}
+
+// The buffer is written to a temporary file which then takes the place of
+// the old one. Besides not losing data if something goes wrong, this keeps
+// the old file (the lines not modified point into it) alive
+// Returns 1 if the temporary file can't be made like the old one (the
+// directory isn't writable, or the group can't be kept), so the file has
+// to be written in place
+static int replace_file(struct single_buffer_editor_data *p, const char *path,
+	size_t *bytes_written, size_t *bytes_copied)
+{
+	char *tmp_path;
+	int fd = create_temporary(path, &tmp_path);
+	if (fd == -ENOMEM)
+		return fd;
+	if (fd < 0)
+		return 1;
+
+	int ret = 1;
+	if (fchown(fd, p->file_stat.st_uid, p->file_stat.st_gid) < 0)
+		goto err_writing;
+
+	ret = write_buffer(p, fd, bytes_written, bytes_copied);
+	if (ret < 0)
+		goto err_writing;
+	if (fchmod(fd, p->file_stat.st_mode & 07777) < 0) {
+		ret = -errno;
+		goto err_writing;
+	}
+	if (close(fd) < 0) {
+		ret = -errno;
+		goto err_closing;
+	}
+	if (rename(tmp_path, path) < 0) {
+		ret = -errno;
+		goto err_closing;
+	}
+	free(tmp_path);
+
+	return 0;
 
+err_writing:
+	close(fd);
+err_closing:
+	unlink(tmp_path);
+	free(tmp_path);
 	return ret;
 }
 
-// return the length of the line, using '\n' as End-Of-Line mark
-static size_t line_length(char *line)
+// a line that wasn't modified, its text is in the file
+static int points_into_file(struct line *line)
 {
-	char *start = line;
-	for (; *line != '\n'; line++);
-	return line - start;
+	return line->storage == NULL && line->length > 0;
 }
 
-static void split_in_lines(char *buf, size_t n_lines, struct line_linked_list_node *lines)
+// Whether something still needs the contents the file had: lines not
+// loaded yet, the column widths being sampled, or lines not modified (in
+// the buffer, the undo history or the clipboard)
+static char file_is_referenced(struct single_buffer_editor_data *p)
 {
-	struct line_linked_list_node *current_node = lines;
-	current_node->prev = NULL;
-	struct line_linked_list_node *next_node;
-	for (size_t i = 0; i < n_lines; i++) {
-		size_t line_to_copy_length = line_length(buf);
-		// TODO: Choose minimum between 2*length and 32, 64 or 128
-		current_node->line.size = line_to_copy_length * 2;
-		if (current_node->line.size == 0)
-			// TODO: Don't hardcode this
-			current_node->line.size = 64;
-
-		current_node->line.length = line_to_copy_length;
-		current_node->line.line_str = (char *)malloc(current_node->line.size * sizeof(char));
-		// TODO: Error handling here !!
-		buf[line_to_copy_length] = '\0';
-		snprintf(current_node->line.line_str, current_node->line.size, "%s", buf);
-		// TODO: Error handling here ?
-		buf += line_to_copy_length + 1;
-
-		next_node = (struct line_linked_list_node *)malloc(sizeof(struct line_linked_list_node));
-		// TODO: Error handling here !!
-		next_node->prev = current_node;
-		current_node->next = next_node;
-		current_node = next_node;
+	if (p->first_loaded_y > 0 || p->n_unloaded_lines > 0 || sampling_columns(p))
+		return 1;
+
+	for (struct line_linked_list_node *it = p->lines; it != NULL; it = it->next)
+		if (points_into_file(&it->line))
+			return 1;
+	for (size_t i = 0; i < p->clipboard.n_spans; i++)
+		if (points_into_file(&p->clipboard.spans[i]))
+			return 1;
+	for (size_t i = 0; i < p->undo_history.n_records; i++) {
+		struct undo_record *record = &p->undo_history.records[i];
+		size_t n_lines = 0;
+		for (size_t j = 0; j < record->n_hunks; j++)
+			n_lines += record->hunks[j].n_insert;
+		for (size_t j = 0; j < n_lines; j++)
+			if (points_into_file(&record->lines[j]))
+				return 1;
 	}
-	next_node->next = NULL;
-	next_node->line.size = 0;
-	next_node->line.length = 0;
+
+	return 0;
 }
 
-static struct line_linked_list_node *alloc_linked_list_node(size_t size)
+// Overwriting the file would change the lines not modified under us, so
+// its contents move to an unnamed temporary file first, mapped where the
+// file was. It goes next to the file (where copying can share its blocks,
+// if the filesystem can), or in the temporary directory
+static int move_file_contents(struct single_buffer_editor_data *p, const char *path)
 {
-	struct line_linked_list_node *ret =
-		(struct line_linked_list_node *)malloc(sizeof(struct line_linked_list_node));
+	char *dir = strdup(path);
+	if (dir == NULL)
+		return -errno;
+	int fd = open(dirname(dir), O_RDWR | O_TMPFILE | O_CLOEXEC, 0600);
+	free(dir);
+	if (fd < 0)
+		fd = open(temporary_directory(), O_RDWR | O_TMPFILE | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -errno;
 
-	if (ret == NULL) {
-		// TODO: Critical bug, but this is not acceptable behavior
-		exit(1);
+	struct save_writer *writer = (struct save_writer *)malloc(sizeof(struct save_writer));
+	if (writer == NULL) {
+		close(fd);
+		return -errno;
 	}
-
-	ret->line.line_str = (char *)malloc(size * sizeof(char));
-	if (ret->line.line_str == NULL) {
-		// TODO: Critical bug, but this is not acceptable behavior
-		exit(1);
+	save_writer_init(writer, fd, p->file_fd, p->file_data);
+	int ret = save_writer_copy(writer, 0, p->file_size);
+	if (ret == 0)
+		ret = save_writer_flush(writer);
+	free(writer);
+	if (ret < 0)
+		goto err_copying;
+
+	if (p->file_size > 0 && mmap(p->file_data, p->file_size, PROT_READ,
+		MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		ret = -errno;
+		goto err_copying;
 	}
+	close(p->file_fd);
+	p->file_fd = fd;
 
-	ret->line.size = size;
-	ret->line.line_str[0] = '\0';
-	ret->line.length = 0;
+	return 0;
 
+err_copying:
+	close(fd);
 	return ret;
 }
 
-static void free_linked_list_node(struct line_linked_list_node *node)
+// Nothing needs the contents of the file, but the mapping stays where it
+// is. It's left without the file, so it can't fault once the file is
+// shorter
+static int drop_file_contents(struct single_buffer_editor_data *p)
 {
-	free(node->line.line_str);
-	free(node);
+	if (p->file_size > 0 && mmap(p->file_data, p->file_size, PROT_READ,
+		MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS, -1, 0) == MAP_FAILED)
+		return -errno;
+
+	return 0;
 }
 
-static void resize_line_buffer(struct line *line)
+// Copies the size bytes of from over to, which ends up as long
+static int copy_over(int from, int to, size_t size)
 {
-	line->size *= 2;
-	line->line_str = realloc(line->line_str, line->size);
-	if (line->line_str == NULL) {
-		// TODO: Critical failure. Handle in another way
-		exit(1);
+	char *data = NULL;
+	if (size > 0) {
+		data = (char *)mmap(NULL, size, PROT_READ, MAP_SHARED, from, 0);
+		if (data == MAP_FAILED)
+			return -errno;
 	}
-}
 
-static void move_str_right_1_char(char *begin, char *end)
-{
-	for (; end != begin; end--)
-		*end = *(end - 1);
-}
+	int ret = 0;
+	struct save_writer *writer = (struct save_writer *)malloc(sizeof(struct save_writer));
+	if (writer == NULL) {
+		ret = -errno;
+		goto err_malloc_writer;
+	}
+	save_writer_init(writer, to, from, data);
+	ret = save_writer_copy(writer, 0, size);
+	if (ret == 0)
+		ret = save_writer_flush(writer);
+	free(writer);
+	if (ret == 0 && (ftruncate(to, size) < 0 || fsync(to) < 0))
+		ret = -errno;
 
-static void move_str_left_1_char(char *begin, char *end)
-{
-	for (; begin != end; begin++)
-		*begin = *(begin + 1);
+err_malloc_writer:
+	if (data != NULL)
+		munmap(data, size);
+	return ret;
 }
 
-static void concat_lines(struct line *dst, struct line *src)
+// When the file can't be replaced it's written in place, which costs more.
+// The buffer goes to a temporary file first (next to the file if it can,
+// so copying shares blocks), which is then copied over the file: if
+// writing the buffer fails, the file is left as it was, and if copying it
+// does, the temporary file is kept and the user told where it is. If
+// something still needs what the file had, that's copied too, the first
+// time only (see move_file_contents())
+static int rewrite_file(struct single_buffer_editor_data *p, const char *path,
+	size_t *bytes_written, size_t *bytes_copied)
 {
-	// we need at least dst->length + src->length + 1 ('\0' char) bytes
-	if (dst->length + src->length >= dst->size) {
-		dst->size += src->length;
-		dst->size += 2;
-		dst->line_str = realloc(dst->line_str, dst->size);
-		// TODO: A function for handling all the realloc stuff
-		if (dst->line_str == NULL) {
-			// TODO: Handle this in a more acceptable way
-			exit(1);
-		}
-	}
+	int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+	if (fd < 0)
+		return -errno;
 
-	strncpy(&dst->line_str[dst->length], src->line_str, src->length + 1);
-	dst->length += src->length;
-}
+	int ret = 0;
+	char *real_path = realpath(path, NULL);
+	if (real_path == NULL) {
+		ret = -errno;
+		goto err_real_path;
+	}
+	char *tmp_path;
+	int tmp_fd = create_temporary(real_path, &tmp_path);
+	if (tmp_fd < 0 && tmp_fd != -ENOMEM) {
+		char prefix[PATH_MAX];
+		snprintf(prefix, sizeof(prefix), "%s/enano-save", temporary_directory());
+		tmp_fd = create_temporary(prefix, &tmp_path);
+	}
+	if (tmp_fd < 0) {
+		ret = tmp_fd;
+		goto err_opening_temporary;
+	}
 
-// returns the maximum number of characters of str that fill into
-// an screen line of line_size characters
-static unsigned int str_length_to_fill_line(char *str, unsigned int line_size)
-{
-	unsigned int ret = 0;
-	while (*str && ret < line_size) {
-		if (*str != '\t' && ret + 1 <= line_size)
-			ret++;
-		else if (*str == '\t' && ret + SPACES_IN_A_TAB <= line_size)
-			ret += SPACES_IN_A_TAB;
+	ret = write_buffer(p, tmp_fd, bytes_written, bytes_copied);
+	if (ret < 0)
+		goto err_writing;
+	// a previous save might have moved what we have mapped somewhere else
+	// already, or replaced the file
+	struct stat mapped, st;
+	if (fstat(p->file_fd, &mapped) < 0 || fstat(fd, &st) < 0) {
+		ret = -errno;
+		goto err_writing;
+	}
+	if (mapped.st_dev == st.st_dev && mapped.st_ino == st.st_ino) {
+		ret = file_is_referenced(p) ? move_file_contents(p, real_path) :
+			drop_file_contents(p);
+		if (ret < 0)
+			goto err_writing;
+	}
 
-		str++;
+	ret = copy_over(tmp_fd, fd, *bytes_written + *bytes_copied);
+	if (ret < 0) {
+		snprintf(p->message, sizeof(p->message), "Couldn't write %s (%s), saved to %s",
+			path, strerror(-ret), tmp_path);
+		close(tmp_fd);
+		free(tmp_path);
+		goto err_opening_temporary;
 	}
 
+	close(tmp_fd);
+	unlink(tmp_path);
+	free(tmp_path);
+	free(real_path);
+	if (close(fd) < 0)
+		return -errno;
+	return 0;
+
+err_writing:
+	close(tmp_fd);
+	unlink(tmp_path);
+	free(tmp_path);
+err_opening_temporary:
+	free(real_path);
+err_real_path:
+	close(fd);
 	return ret;
 }
 
-static void clean_screen_line(WINDOW *win, unsigned int y)
+static int save_buffer(struct single_buffer_editor_data *p, char *path)
 {
-	wmove(win, y, 0);
-	wclrtoeol(win);
+	uint64_t start_ns = stats_now_ns();
+	size_t bytes_written = 0, bytes_copied = 0;
+	int ret = 1;
+	if (can_replace_file(path))
+		ret = replace_file(p, path, &bytes_written, &bytes_copied);
+	if (ret == 1)
+		ret = rewrite_file(p, path, &bytes_written, &bytes_copied);
+	if (ret < 0)
+		return ret;
+	// the file we loaded isn't there anymore (although we still have it
+	// mapped)
+	line_index_remove_cache(&p->file_stat);
+
+	uint64_t end_ns = stats_now_ns();
+	editor_stats.save_ns = end_ns - start_ns;
+	editor_stats.n_saves++;
+	editor_stats.save_bytes_written = bytes_written;
+	editor_stats.save_bytes_copied = bytes_copied;
+	trace_record("save", "io", start_ns, end_ns);
+
+	snprintf(p->message, sizeof(p->message),
+		"Saved: %zu bytes written, %zu copied from the file (%.1f ms)",
+		bytes_written, bytes_copied, (end_ns - start_ns) / 1000000.0);
+
+	return 0;
 }
 
-//----------------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------------//
 
-// Functions that implement editor capabilities: Like moving the cursor, copy, paste, ....
+// Event handling functions
 
-static void show_cursor(struct single_buffer_editor_data *p)
+static void handle_event_show_cursor
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	p->show_cursor = 1;
+	show_cursor(p);
 }
 
-static void hide_cursor(struct single_buffer_editor_data *p)
+static void handle_event_hide_cursor
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	p->show_cursor = 0;
+	hide_cursor(p);
 }
 
-static void move_cursor_left(struct single_buffer_editor_data *p)
+static void handle_event_move_cursor_left
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	if (p->pos_x > 0)
-		p->pos_x--;
-	else if (p->pos_x == 0 && p->pos_y > 0) {
-		p->pos_y--;
-		p->line_y = p->line_y->prev;
-		p->pos_x = p->line_y->line.length;
-	}
+	move_all_cursors(p, move_cursor_left);
 }
 
-static void move_cursor_right(struct single_buffer_editor_data *p)
+static void handle_event_move_cursor_right
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	if (p->pos_x < p->line_y->line.length)
-		p->pos_x++;
-	else if (p->pos_x == p->line_y->line.length && p->pos_y < p->n_lines) {
-		p->pos_x = 0;
-		p->pos_y++;
-		p->line_y = p->line_y->next;
-	}
+	move_all_cursors(p, move_cursor_right);
 }
 
-static void move_cursor_up(struct single_buffer_editor_data *p)
+static void handle_event_move_cursor_up
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	if (p->pos_y > 0) {
-		p->pos_y--;
-		p->line_y = p->line_y->prev;
-		p->pos_x = (p->line_y->line.length >= p->pos_x) ? p->pos_x : p->line_y->line.length;
-	}
+	move_all_cursors(p, move_cursor_up);
 }
 
-static void move_cursor_down(struct single_buffer_editor_data *p)
+static void handle_event_move_cursor_down
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	if (p->pos_y < p->n_lines) {
-		p->pos_y++;
-		p->line_y = p->line_y->next;
-		p->pos_x = (p->line_y->line.length >= p->pos_x) ? p->pos_x : p->line_y->line.length;
-	}
+	move_all_cursors(p, move_cursor_down);
 }
 
-// TODO: This could be further optimized if when p->pos_x == 0 we just
-// place a new line before the current line
-static void insert_new_line(struct single_buffer_editor_data *p)
+// TODO: Rename this function and its associated event
+static void handle_event_delete_key_entered
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	struct line_linked_list_node *current_line = p->line_y;
-	// TODO: Put '64' in a constant
-	size_t new_line_size = max(current_line->line.length - p->pos_x + 1, 64);
-	struct line_linked_list_node *new_line = alloc_linked_list_node(new_line_size);
-	new_line->next = current_line->next;
-	new_line->prev = current_line;
-	current_line->next = new_line;
-	if (new_line->next != NULL)
-		new_line->next->prev = new_line;
-
-	if (p->pos_x != current_line->line.length) {
-		strncpy(new_line->line.line_str,
-			&current_line->line.line_str[p->pos_x], new_line->line.size);
-
-		new_line->line.length = current_line->line.length - p->pos_x;
-		current_line->line.line_str[p->pos_x] = '\0';
-		current_line->line.length = p->pos_x;
+	p->mark_set = 0;
+	if (p->n_cursors > 0)
+		remove_character_all_cursors(p);
+	else if (p->pos_x > 0) {
+		undo_begin_typing(p);
+		remove_current_character(p);
+		undo_commit(p);
+		p->typing = 1;
+	}
+	else if (p->pos_y > 0) {
+		undo_begin(p, prev_line(p, p->line_y), p->pos_y - 1, 2);
+		remove_current_character(p);
+		undo_commit(p);
 	}
-
-	p->pos_x = 0;
-	p->pos_y++;
-	p->n_lines++;
-	p->line_y = new_line;
-
-	p->clear_window = 1;
 }
 
-static void remove_current_character(struct single_buffer_editor_data *p)
+static void handle_event_character_entered
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	struct line_linked_list_node *current_line = p->line_y;
-	struct line_linked_list_node *prev_line = p->line_y->prev;
-	if (p->pos_x == 0) {
-		if (p->pos_y == 0)
-			return;
-
-		size_t prev_line_length = prev_line->line.length;
-		concat_lines(&prev_line->line, &current_line->line);
-		prev_line->next = current_line->next;
-		if (prev_line->next != NULL)
-			prev_line->next->prev = prev_line;
-
-		free_linked_list_node(current_line);
-		p->n_lines--;
-		p->pos_y--;
-		p->pos_x = prev_line_length;
-		p->line_y = prev_line;
+	// TODO: Better name for this
+	char user_entered_character = *((char *)event->additional_data);
+	p->mark_set = 0;
+	if (p->n_cursors > 0) {
+		if (user_entered_character == '\n')
+			insert_new_line_all_cursors(p);
+		else
+			put_character_all_cursors(p, user_entered_character);
+	}
+	else if (user_entered_character == '\n') {
+		undo_begin(p, p->line_y, p->pos_y, 1);
+		insert_new_line(p);
+		undo_commit(p);
 	}
 	else {
-		// if (p->pos_x < current_line->line.length)
-		move_str_left_1_char(
-			&current_line->line.line_str[p->pos_x - 1],
-			&current_line->line.line_str[current_line->line.length]);
-		p->pos_x--;
-		current_line->line.length--;
-		current_line->line.line_str[current_line->line.length] = '\0';
+		undo_begin_typing(p);
+		put_character(p, (char *)event->additional_data);
+		undo_commit(p);
+		p->typing = 1;
 	}
-
-	// TODO: Right now we're triggering a full window rewrite everytime
-	// the user removes something. It'll be probably more efficient (although
-	// it's not sure, testing is needed) to have a clear_window flag per line
-	// and fully rewrite those lines by printing '\0' to fill the gap between
-	// the line new end and window_ncols characters that fit on the screen line
-	p->clear_window = 1;
 }
 
-// *c MUST be different from '\n'
-static void put_character(struct single_buffer_editor_data *p, char *c)
+static void handle_event_toggle_mark
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	struct line *line = &p->line_y->line;
-	// make sure there is space available
-	if (line->length + 1 >= line->size)
-		resize_line_buffer(line);
+	toggle_mark(p);
+}
 
-	// are we inserting at the end of the line?
-	if (line->length == p->pos_x) {
-		line->line_str[p->pos_x] = *c;
-		p->pos_x++;
-		line->line_str[p->pos_x] = '\0';
-		line->length++;
-	}
-	else {
-		move_str_right_1_char(
-			&line->line_str[p->pos_x], &line->line_str[line->length + 1]);
-		line->line_str[p->pos_x] = *c;
-		p->pos_x++;
-		line->length++;
+static void handle_event_cut
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
+{
+	if (p->n_cursors > 0) {
+		snprintf(p->message, sizeof(p->message),
+			"Cut works with a single cursor, remove the others first");
+		return;
 	}
+	cut_or_copy(p, 1);
+}
+
+static void handle_event_copy
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
+{
+	cut_or_copy(p, 0);
 }
 
-// TODO: Some error handling here
-// TODO: Write files back to this in a more safer way (using a tmp file buffer)
-// to prevent any data loss
-static void save_buffer(struct single_buffer_editor_data *p, char *path)
+static void handle_event_paste
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	FILE *descriptor = fopen(path, "w");
-	if (!descriptor) {
+	if (p->n_cursors > 0) {
+		snprintf(p->message, sizeof(p->message),
+			"Paste works with a single cursor, remove the others first");
 		return;
 	}
-
-	for (struct line_linked_list_node *it = p->lines; it != NULL; it = it->next) {
-		if (fwrite(it->line.line_str, 1, it->line.length, descriptor) != it->line.length ||
-			fwrite("\n", 1, 1, descriptor) != 1) {
-			// TODO: Handle this better
-			endwin();
-			exit(1);
-		}
+	if (p->clipboard.n_spans > 0) {
+		undo_begin(p, p->line_y, p->pos_y, 1);
+		paste(p);
+		undo_commit(p);
 	}
+}
 
-	fclose(descriptor);
+static void handle_event_add_cursor_next_match
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
+{
+	add_cursor_at_next_match(p);
 }
 
-//---------------------------------------------------------------------------------------//
+static void handle_event_add_cursor_below
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
+{
+	add_cursor_below(p);
+}
 
-// Event handling functions
+static void handle_event_remove_extra_cursors
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
+{
+	remove_extra_cursors(p);
+}
 
-static void handle_event_show_cursor
+static void handle_event_undo
 (struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	show_cursor(p);
+	undo(p);
 }
 
-static void handle_event_hide_cursor
+static void handle_event_redo
 (struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	hide_cursor(p);
+	redo(p);
 }
 
-static void handle_event_move_cursor_left
+static void handle_event_replace_all
 (struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	move_cursor_left(p);
+	replace_all(p, (struct replace_all_data *)event->additional_data);
 }
 
-static void handle_event_move_cursor_right
+static void handle_event_sort_lines
 (struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	move_cursor_right(p);
+	sort_lines(p);
 }
 
-static void handle_event_move_cursor_up
+static void handle_event_unique_lines
 (struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	move_cursor_up(p);
+	unique_lines(p);
 }
 
-static void handle_event_move_cursor_down
+static void handle_event_filter_lines
 (struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	move_cursor_down(p);
+	filter_lines(p, (struct filter_lines_data *)event->additional_data);
 }
 
-// TODO: Rename this function and its associated event
-static void handle_event_delete_key_entered
+static void handle_event_pipe_lines
 (struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	remove_current_character(p);
+	pipe_lines(p, (struct pipe_lines_data *)event->additional_data);
 }
 
-static void handle_event_character_entered
+static void handle_event_go_to
 (struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	// TODO: Better name for this
-	char user_entered_character = *((char *)event->additional_data);
-	if (user_entered_character == '\n')
-		insert_new_line(p);
-        else
-		put_character(p, (char *)event->additional_data);
+	go_to_line(p, (struct go_to_data *)event->additional_data);
+}
+
+static void handle_event_cancel_job
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
+{
+	cancel_job(p);
+}
+
+static void handle_event_tick
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
+{
+	if (p->replace_all_job != NULL)
+		check_replace_all(p);
+	if (p->pipe_command_job != NULL)
+		check_pipe_command(p);
+	if (sampling_columns(p)) {
+		sample_column_widths(p);
+		if (p->message[0] == '\0' && sampling_columns(p))
+			snprintf(p->message, sizeof(p->message), "Measuring columns... %zu%%",
+				p->column_sample_next * 100 / p->line_index.n_offsets);
+	}
+}
+
+static void handle_event_toggle_columns
+(struct single_buffer_editor_data *p, struct event *event, struct result *result)
+{
+	toggle_columns(p);
 }
 
 static void handle_event_save_buffer
 (struct single_buffer_editor_data *p, struct event *event, struct result *result)
 {
-	save_buffer(p, p->file_path);
+	int ret = save_buffer(p, p->file_path);
+	if (ret < 0) {
+		result->result_type = ERROR_OCCURRED_ERRNO_SET;
+		// save_buffer() might have told more already
+		if (p->message[0] == '\0')
+			snprintf(p->message, sizeof(p->message), "Couldn't save: %s", strerror(-ret));
+	}
 }
 
-// TODO: Put all events declared at events.h here, pointing to an empty function if
-// necessary, to prevent segmentation faults.
-static void (*event_handler_table[])
+// Events without a handler (NULL) are silently ignored
+static void (*event_handler_table[NR_EVENTS])
 (struct single_buffer_editor_data *p, struct event *event, struct result *result) = {
 	[EVENT_SAVE_BUFFER] = handle_event_save_buffer,
 	[EVENT_SHOW_CURSOR] = handle_event_show_cursor,
@@ -473,38 +2868,77 @@ static void (*event_handler_table[])
 	[EVENT_MOVE_CURSOR_UP] = handle_event_move_cursor_up,
 	[EVENT_MOVE_CURSOR_DOWN] = handle_event_move_cursor_down,
 	[EVENT_CHARACTER_ENTERED] = handle_event_character_entered,
-	[EVENT_DELETE_KEY_ENTERED] = handle_event_delete_key_entered
+	[EVENT_DELETE_KEY_ENTERED] = handle_event_delete_key_entered,
+	[EVENT_TOGGLE_MARK] = handle_event_toggle_mark,
+	[EVENT_CUT] = handle_event_cut,
+	[EVENT_COPY] = handle_event_copy,
+	[EVENT_PASTE] = handle_event_paste,
+	[EVENT_ADD_CURSOR_NEXT_MATCH] = handle_event_add_cursor_next_match,
+	[EVENT_ADD_CURSOR_BELOW] = handle_event_add_cursor_below,
+	[EVENT_REMOVE_EXTRA_CURSORS] = handle_event_remove_extra_cursors,
+	[EVENT_UNDO] = handle_event_undo,
+	[EVENT_REDO] = handle_event_redo,
+	[EVENT_REPLACE_ALL] = handle_event_replace_all,
+	[EVENT_SORT_LINES] = handle_event_sort_lines,
+	[EVENT_UNIQUE_LINES] = handle_event_unique_lines,
+	[EVENT_FILTER_LINES] = handle_event_filter_lines,
+	[EVENT_PIPE_LINES] = handle_event_pipe_lines,
+	[EVENT_GO_TO] = handle_event_go_to,
+	[EVENT_TOGGLE_COLUMNS] = handle_event_toggle_columns,
+	[EVENT_CANCEL_JOB] = handle_event_cancel_job,
+	[EVENT_TICK] = handle_event_tick
+};
+
+// Events that can't be handled while a background job is running, a
+// replace-all's workers read the lines of the buffer and a command's output
+// takes the place of some of them
+static const char event_modifies_buffer[NR_EVENTS] = {
+	[EVENT_CHARACTER_ENTERED] = 1,
+	[EVENT_DELETE_KEY_ENTERED] = 1,
+	[EVENT_CUT] = 1,
+	[EVENT_PASTE] = 1,
+	[EVENT_UNDO] = 1,
+	[EVENT_REDO] = 1,
+	[EVENT_REPLACE_ALL] = 1,
+	[EVENT_SORT_LINES] = 1,
+	[EVENT_UNIQUE_LINES] = 1,
+	[EVENT_FILTER_LINES] = 1,
+	[EVENT_PIPE_LINES] = 1
 };
 
 //---------------------------------------------------------------------------------------//
 
 // Functions that implement the editor_object interface defined at common/interface.h
 
-static int init_single_buffer_editor(struct editor_object *self, const char *path, int nlines, int ncols, int y, int x)
+// for the editors created from now on
+static size_t configured_line_cache_budget = DEFAULT_LINE_CACHE_BUDGET;
+
+void single_buffer_editor_set_line_cache_budget(size_t bytes)
+{
+	configured_line_cache_budget = bytes;
+}
+
+static int init_single_buffer_editor(struct editor_object *self, const char *path, struct display_object *display)
 {
 	int ret = 0;
+	uint64_t start_ns = stats_now_ns();
 	struct single_buffer_editor_data *p = (struct single_buffer_editor_data *)malloc(sizeof(struct single_buffer_editor_data));
 	if (p == NULL)
 		return -errno;
 
 	self->data = (void *)p;
 
-	p->window = newwin(nlines, ncols, y, x);
-	if (!p->window) {
-		ret = -EFAULT;
-		goto err_creating_window;
-	}
-
-	p->window_nlines = nlines;
-	p->window_ncols = ncols;
-	FILE *file_descriptor = fopen(path, "r");
-	if (!file_descriptor) {
+	p->display = display;
+	p->window_nlines = display->nlines;
+	p->window_ncols = display->ncols;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
 		ret = -errno;
 		goto err_opening_file;
 	}
 
 	struct stat st;
-	if (stat(path, &st) < 0) {
+	if (fstat(fd, &st) < 0) {
 		ret = -errno;
 		goto err_stating_file;
 	}
@@ -516,54 +2950,85 @@ static int init_single_buffer_editor(struct editor_object *self, const char *pat
 		goto err_malloc_path_size;
 	}
 	strncpy(p->file_path, path, path_size);
-
-	char *buffer;
-	size_t buffer_size = st.st_size;
-	buffer = (char *)malloc(buffer_size * sizeof(char));
-	if (buffer == NULL) {
-		ret = -errno;
-		goto err_malloc_buffer;
-	}
-
-	if (fread(buffer, buffer_size, 1, file_descriptor) != 1) {
-		ret = -EBADFD;
-		goto err_fread;
+	p->file_stat = st;
+	p->file_fd = fd;
+
+	// TODO: If someone truncates the file while we have it mapped, we get
+	// a SIGBUS
+	p->file_size = st.st_size;
+	p->file_data = NULL;
+	if (p->file_size > 0) {
+		p->file_data = (char *)mmap(NULL, p->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p->file_data == MAP_FAILED) {
+			ret = -errno;
+			goto err_mapping_file;
+		}
 	}
 
-	p->n_lines = count_lines(buffer, buffer_size);
-	p->lines = (struct line_linked_list_node *)malloc(sizeof(struct line_linked_list_node));
-	if (p->lines == NULL) {
-		ret = -errno;
-		goto err_malloc_p_lines;
+	// we only need to know how many lines there are, the lines
+	// themselves are created as we go
+	ret = line_index_load(&p->line_index, p->file_data, &st);
+	if (ret < 0)
+		goto err_loading_index;
+	// building the index read the whole file, which we don't need in
+	// memory
+	release_file_range(p, 0, p->file_size);
+
+	p->n_lines = p->line_index.n_newlines;
+	p->n_unloaded_lines = p->n_lines + 1;
+	p->unloaded_offset = 0;
+	p->first_loaded_y = 0;
+	p->line_cache_budget = configured_line_cache_budget;
+	p->first_lines_pinned = 0;
+	p->last_lines_pinned = 0;
+	p->compression_scan = NULL;
+	p->compression_idle = 0;
+	if (p->file_size == 0) {
+		p->lines = alloc_linked_list_node(MIN_LINE_SIZE);
+		p->lines->prev = p->lines->next = NULL;
+		p->n_unloaded_lines = 0;
 	}
-
-	split_in_lines(buffer, p->n_lines, p->lines);
-	free(buffer);
+	else
+		load_lines(p, NULL, LOAD_BATCH_LINES);
 
 	p->pos_x = 0;
 	p->pos_y = 0;
 	p->line_y = p->lines;
 	p->show_cursor = 1;
 	p->clear_window = 0;
+	p->mark_set = 0;
+	p->clipboard.n_spans = 0;
+	p->clipboard.spans = NULL;
+	p->cursors = NULL;
+	p->n_cursors = 0;
+	p->cursors_size = 0;
+	undo_history_init(&p->undo_history);
+	p->undo_pending = 0;
+	p->typing = 0;
+	p->replace_all_job = NULL;
+	p->pipe_command_job = NULL;
+	p->columns_view = 0;
+	p->columns_drawn_version = 0;
+	p->columns_drawn_first = 0;
 
 	p->top_print_line = p->lines;
 	p->top_print_line_y = 0;
 
-	fclose(file_descriptor);
+	uint64_t end_ns = stats_now_ns();
+	editor_stats.load_ns = end_ns - start_ns;
+	trace_record("load", "io", start_ns, end_ns);
 
 	return 0;
 
-err_malloc_p_lines:
-err_fread:
-	free(buffer);
-err_malloc_buffer:
+err_loading_index:
+	if (p->file_data != NULL)
+		munmap(p->file_data, p->file_size);
+err_mapping_file:
 	free(p->file_path);
 err_malloc_path_size:
 err_stating_file:
-	fclose(file_descriptor);
+	close(fd);
 err_opening_file:
-	delwin(p->window);
-err_creating_window:
 	free(p);
 	return ret;
 }
@@ -572,14 +3037,36 @@ static void uninit_single_buffer_editor(struct editor_object *self)
 {
 	struct single_buffer_editor_data *p = (struct single_buffer_editor_data *)self->data;
 
-	delwin(p->window);
+	if (p->replace_all_job != NULL) {
+		struct replace_all_result result;
+		replace_all_finish(p->replace_all_job, &result);
+		for (size_t i = 0; i < result.n_lines; i++)
+			line_clear(&result.lines[i].line);
+		free(result.lines);
+	}
+	if (p->pipe_command_job != NULL) {
+		pipe_command_cancel(p->pipe_command_job);
+		finish_pipe_command(p);
+	}
+	undo_history_uninit(&p->undo_history);
+	if (p->columns_view)
+		column_layout_free(&p->columns);
+
 	struct line_linked_list_node *current_node = p->lines;
 	while (current_node->next != NULL) {
 		current_node = current_node->next;
 		free_linked_list_node(current_node->prev);
 	}
 	free_linked_list_node(current_node);
+	clear_clipboard(&p->clipboard);
+	free(p->cursors);
+	line_index_free(&p->line_index);
+	// the lines pointing into it are gone
+	if (p->file_data != NULL)
+		munmap(p->file_data, p->file_size);
+	close(p->file_fd);
 	free(p->file_path);
+	free(p);
 }
 
 static void single_buffer_editor_handle_event
@@ -587,13 +3074,44 @@ static void single_buffer_editor_handle_event
 {
 	struct single_buffer_editor_data *p = (struct single_buffer_editor_data *)self->data;
 
-	if (event->event_type <= NR_EVENTS) {
-		// the event handler may override this
-		result->result_type = EVENT_HANDLING_SUCCESS;
+	result->additional_data = NULL;
+	if (event->event_type >= NR_EVENTS) {
+		result->result_type = ERROR_EVENT_NOT_FOUND;
+		return;
+	}
+
+	p->message[0] = '\0';
+	if (event->event_type != EVENT_CHARACTER_ENTERED &&
+		event->event_type != EVENT_DELETE_KEY_ENTERED && event->event_type != EVENT_TICK)
+		p->typing = 0;
+
+	// the event handler may override this
+	result->result_type = EVENT_HANDLING_SUCCESS;
+	char job_running = p->replace_all_job != NULL || p->pipe_command_job != NULL;
+	if (job_running && event_modifies_buffer[event->event_type])
+		snprintf(p->message, sizeof(p->message), "Busy %s, try again when it's done",
+			(p->replace_all_job != NULL) ? "replacing" : "piping");
+	else if (event_handler_table[event->event_type] != NULL)
 		event_handler_table[event->event_type](p, event, result);
+	// the modified lines that didn't let us unload lines might be gone
+	if (event->event_type == EVENT_CUT || event->event_type == EVENT_UNDO ||
+		event->event_type == EVENT_REDO || event->event_type == EVENT_SORT_LINES ||
+		event->event_type == EVENT_UNIQUE_LINES || event->event_type == EVENT_FILTER_LINES)
+		p->first_lines_pinned = p->last_lines_pinned = 0;
+	// lines might be gone (or moved), and there might be new ones to
+	// compress
+	if (event_modifies_buffer[event->event_type]) {
+		p->compression_scan = NULL;
+		p->compression_idle = 0;
 	}
-	else
-		result->result_type = ERROR_EVENT_NOT_FOUND;
+
+	// sampling the column widths needs ticks too, but doesn't keep
+	// anyone from editing
+	if ((p->replace_all_job != NULL || p->pipe_command_job != NULL || sampling_columns(p)) &&
+		result->result_type == EVENT_HANDLING_SUCCESS)
+		result->result_type = BACKGROUND_JOB_RUNNING;
+	if (p->message[0] != '\0')
+		result->additional_data = (void *)p->message;
 }
 
 // TODO: Don't refresh the full window all the time
@@ -620,24 +3138,53 @@ static void single_buffer_editor_refresh(struct editor_object *self)
 		}
 	}
 
-	if (top_has_changed || p->clear_window) {
-		wclear(p->window);
+	// the extra cursors are drawn over the text, the window has to be
+	// rewritten for them to move. Columns may have changed their width
+	char columns_moved = p->columns_view && fit_columns(p);
+	if (top_has_changed || p->clear_window || p->n_cursors > 0 || columns_moved) {
+		p->display->clear(p->display);
 		p->clear_window = 0;
 	}
 
+	// the selection, from (select_start_y, select_start_x)
+	// to (select_end_y, select_end_x)
+	size_t select_start_x = 0, select_start_y = 1, select_end_x = 0, select_end_y = 0;
+	if (p->mark_set) {
+		if (p->mark_y < p->pos_y || (p->mark_y == p->pos_y && p->mark_x < p->pos_x)) {
+			select_start_x = p->mark_x;
+			select_start_y = p->mark_y;
+			select_end_x = p->pos_x;
+			select_end_y = p->pos_y;
+		}
+		else {
+			select_start_x = p->pos_x;
+			select_start_y = p->pos_y;
+			select_end_x = p->mark_x;
+			select_end_y = p->mark_y;
+		}
+	}
+
 	unsigned int cursor_x = 0;
 	unsigned int cursor_y = 0;
-	struct line_linked_list_node *current_line = p->top_print_line;
+	// first character drawn of the line of the cursor
+	size_t cursor_line_start = 0;
+	if (p->columns_view)
+		draw_columns(p, select_start_x, select_start_y, select_end_x, select_end_y,
+			&cursor_x, &cursor_y);
+	struct line_linked_list_node *current_line = p->columns_view ? NULL :
+		readable_line(p->top_print_line);
 	for (int i = 0; i < p->window_nlines && current_line != NULL; i++) {
 		// tabs ocuppy 8 spaces in screen, so a line with less characters
 		// than the screen width (or the line size) might not fit in a line
 		char *line_str = current_line->line.line_str;
+		size_t line_y = p->top_print_line_y + i;
+		// first character of the line we draw
+		size_t line_start = 0;
 
 		// TODO: Try to refactor this on a clearer way
-		if (p->top_print_line_y + i == p->pos_y) {
-			unsigned int n_tabs = count_tabs(line_str, p->pos_x);
+		if (line_y == p->pos_y) {
 			// position of cursor on a screen with infinite columns
-			cursor_x = (p->pos_x + n_tabs*(SPACES_IN_A_TAB - 1));
+			cursor_x = str_columns(line_str, p->pos_x, 0);
 			cursor_y = p->pos_y - p->top_print_line_y;
 			if (cursor_x >= p->window_ncols) {
 				// we need to calculate the first position of the
@@ -653,8 +3200,10 @@ static void single_buffer_editor_refresh(struct editor_object *self)
 					(cursor_x / p->window_ncols) * p->window_ncols;
 				while (cursor_line_new_start < max_cursor_line_new_start) {
 					if (line_str[line_new_start_pos] == '\t') {
-						if (cursor_line_new_start + SPACES_IN_A_TAB <= max_cursor_line_new_start)
-							cursor_line_new_start += SPACES_IN_A_TAB;
+						unsigned int tab_width = SPACES_IN_A_TAB -
+							cursor_line_new_start % SPACES_IN_A_TAB;
+						if (cursor_line_new_start + tab_width <= max_cursor_line_new_start)
+							cursor_line_new_start += tab_width;
 						else
 							break;
 					}
@@ -663,30 +3212,74 @@ static void single_buffer_editor_refresh(struct editor_object *self)
 					}
 					line_new_start_pos++;
 				}
+				line_start = line_new_start_pos;
+				cursor_line_start = line_start;
 				line_str = &line_str[line_new_start_pos];
 				cursor_x -= cursor_line_new_start;
 			}
 
-			clean_screen_line(p->window, i);
+			p->display->clear_line(p->display, i, 0);
 		}
 
 		unsigned int length_to_write = str_length_to_fill_line(line_str,
-			p->window_ncols);
+			current_line->line.length - line_start, p->window_ncols);
+
+		// the line is drawn in up to 3 parts: before, inside and after
+		// the selection
+		size_t select_from = length_to_write, select_to = length_to_write;
+		if (select_start_y <= line_y && line_y <= select_end_y) {
+			size_t from = (line_y == select_start_y) ? select_start_x : 0;
+			size_t to = (line_y == select_end_y) ? select_end_x : current_line->line.length;
+			from = (from > line_start) ? from - line_start : 0;
+			to = (to > line_start) ? to - line_start : 0;
+			select_from = (from < length_to_write) ? from : length_to_write;
+			select_to = (to < length_to_write) ? to : length_to_write;
+		}
 
-		mvwaddnstr(p->window, i, 0, line_str, length_to_write);
+		p->display->put_str(p->display, i, 0, line_str, select_from,
+			DISPLAY_ATTRIBUTE_NORMAL);
+		p->display->put_str(p->display, i, str_columns(line_str, select_from, 0),
+			&line_str[select_from], select_to - select_from, DISPLAY_ATTRIBUTE_REVERSE);
+		p->display->put_str(p->display, i, str_columns(line_str, select_to, 0),
+			&line_str[select_to], length_to_write - select_to, DISPLAY_ATTRIBUTE_NORMAL);
 		// TODO: Put > & < with background white color at the end of truncated lines
 
-		current_line = current_line->next;
+		current_line = next_line(p, current_line);
 	}
 
-	mvwprintw(p->window, 0, 0, "%d %d", p->pos_x, p->pos_y);
-	// TODO: Use a handmade cursor
-	if (p->show_cursor) {
-		mvwprintw(p->window, 1, 0, " %d ", p->window_ncols);
-		wmove(p->window, cursor_y, cursor_x);
+	for (size_t i = 0; i < p->n_cursors && !p->columns_view; i++) {
+		struct cursor *cursor = &p->cursors[i];
+		if (cursor->y < p->top_print_line_y ||
+			cursor->y >= p->top_print_line_y + p->window_nlines)
+			continue;
+
+		size_t line_start = (cursor->y == p->pos_y) ? cursor_line_start : 0;
+		if (cursor->x < line_start)
+			continue;
+
+		struct line *line = &cursor->line->line;
+		unsigned int column = str_columns(&line->line_str[line_start],
+			cursor->x - line_start, 0);
+		if (column >= p->window_ncols)
+			continue;
+
+		char c = (cursor->x < line->length && line->line_str[cursor->x] != '\t') ?
+			line->line_str[cursor->x] : ' ';
+		p->display->put_str(p->display, cursor->y - p->top_print_line_y, column,
+			&c, 1, DISPLAY_ATTRIBUTE_REVERSE);
 	}
 
-	wrefresh(p->window);
+	// TODO: Use a handmade cursor
+	if (p->show_cursor)
+		p->display->move_cursor(p->display, cursor_y, cursor_x);
+	p->display->show_cursor(p->display, p->show_cursor);
+
+	p->display->flush(p->display);
+
+	// once the frame is out, it doesn't delay it
+	evict_lines(p);
+	compress_cold_lines(p);
+	prefetch_lines(p);
 }
 
 struct editor_object single_buffer_editor_object = {
@@ -17,8 +17,14 @@
 #ifndef ENANO_SINGLE_FILE_EDITOR_H
 #define ENANO_SINGLE_FILE_EDITOR_H
 
+#include <stddef.h>
+
 #include <common/interface.h>
 
 extern struct editor_object single_buffer_editor_object;
 
+// how much memory the lines loaded from the file can take, for the
+// editors created after the call
+void single_buffer_editor_set_line_cache_budget(size_t bytes);
+
 #endif /* ENANO_SINGLE_FILE_EDITOR */
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <backend/undo.h>
+
+// Past either limit the oldest records are dropped (the last one is kept
+// no matter its size)
+#define MAX_UNDO_RECORDS 1024
+#define MAX_UNDO_BYTES (64 * 1024 * 1024)
+
+// the bytes of memory the lines keep referenced, lines still in the file
+// don't count
+static size_t lines_size(struct line *lines, size_t n_lines)
+{
+	size_t size = 0;
+	for (size_t i = 0; i < n_lines; i++)
+		if (lines[i].storage != NULL)
+			size += lines[i].length;
+	return size;
+}
+
+void undo_record_alloc(struct undo_record *record, size_t n_hunks, size_t n_lines)
+{
+	// malloc(0) might return NULL
+	record->hunks = (struct undo_hunk *)malloc((n_hunks + 1) * sizeof(struct undo_hunk));
+	record->lines = (struct line *)malloc((n_lines + 1) * sizeof(struct line));
+	if (record->hunks == NULL || record->lines == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+	record->n_hunks = n_hunks;
+}
+
+void undo_record_free(struct undo_record *record)
+{
+	size_t n_lines = 0;
+	for (size_t i = 0; i < record->n_hunks; i++)
+		n_lines += record->hunks[i].n_insert;
+
+	for (size_t i = 0; i < n_lines; i++)
+		line_clear(&record->lines[i]);
+
+	free(record->lines);
+	free(record->hunks);
+}
+
+struct line_linked_list_node *undo_record_apply(struct undo_record *record,
+	struct line_linked_list_node **lines, size_t *n_lines,
+	struct line_linked_list_node *node, size_t *node_y)
+{
+	size_t insert_end = 0, remove_end = 0;
+	for (size_t i = 0; i < record->n_hunks; i++) {
+		insert_end += record->hunks[i].n_insert;
+		remove_end += record->hunks[i].n_remove;
+	}
+	size_t n_removed = remove_end;
+
+	// the lines we take out, they're the lines of the inverse
+	struct line *removed = (struct line *)malloc((remove_end + 1) * sizeof(struct line));
+	if (removed == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+
+	// bottom up, so the line numbers of the hunks left don't change
+	size_t y = *node_y;
+	for (size_t i = record->n_hunks; i-- > 0;) {
+		struct undo_hunk *hunk = &record->hunks[i];
+		insert_end -= hunk->n_insert;
+		remove_end -= hunk->n_remove;
+
+		// the line before the hunk, NULL if the hunk starts the buffer
+		struct line_linked_list_node *prev = NULL;
+		if (hunk->y > 0) {
+			node = walk_lines(node, y, hunk->y - 1);
+			y = hunk->y - 1;
+			prev = node;
+		}
+
+		struct line_linked_list_node *it = (prev != NULL) ? prev->next : *lines;
+		for (size_t j = 0; j < hunk->n_remove; j++) {
+			struct line_linked_list_node *next = it->next;
+			// the line moves to removed, no reference is dropped
+			removed[remove_end + j] = it->line;
+			it->line.storage = NULL;
+			unlink_linked_list_node(it);
+			free_linked_list_node(it);
+			it = next;
+		}
+		if (prev == NULL)
+			*lines = it;
+
+		// it is the line after the hunk now
+		struct line_linked_list_node *last = prev;
+		for (size_t j = 0; j < hunk->n_insert; j++) {
+			struct line *line = &record->lines[insert_end + j];
+			struct line_linked_list_node *new_node = alloc_span_linked_list_node(line);
+			line_clear(line);
+			if (last != NULL)
+				link_linked_list_node(last, new_node);
+			else {
+				new_node->prev = NULL;
+				new_node->next = it;
+				if (it != NULL)
+					it->prev = new_node;
+				*lines = new_node;
+			}
+			last = new_node;
+		}
+		*n_lines = *n_lines + hunk->n_insert - hunk->n_remove;
+
+		if (prev == NULL) {
+			node = *lines;
+			y = 0;
+		}
+	}
+
+	// make it the inverse
+	long long delta = 0;
+	for (size_t i = 0; i < record->n_hunks; i++) {
+		struct undo_hunk *hunk = &record->hunks[i];
+		size_t n_insert = hunk->n_insert;
+		hunk->y += delta;
+		delta += (long long)hunk->n_insert - (long long)hunk->n_remove;
+		hunk->n_insert = hunk->n_remove;
+		hunk->n_remove = n_insert;
+	}
+	free(record->lines);
+	record->lines = removed;
+	record->size = lines_size(removed, n_removed);
+
+	size_t cursor_x = record->cursor_x, cursor_y = record->cursor_y;
+	record->cursor_x = record->inverse_cursor_x;
+	record->cursor_y = record->inverse_cursor_y;
+	record->inverse_cursor_x = cursor_x;
+	record->inverse_cursor_y = cursor_y;
+
+	*node_y = y;
+	return node;
+}
+
+void undo_history_init(struct undo_history *history)
+{
+	history->records = NULL;
+	history->n_records = 0;
+	history->size = 0;
+	history->current = 0;
+}
+
+void undo_history_uninit(struct undo_history *history)
+{
+	for (size_t i = 0; i < history->n_records; i++)
+		undo_record_free(&history->records[i]);
+
+	free(history->records);
+}
+
+void undo_history_push(struct undo_history *history, struct undo_record *record)
+{
+	for (size_t i = history->current; i < history->n_records; i++)
+		undo_record_free(&history->records[i]);
+	history->n_records = history->current;
+
+	size_t n_lines = 0;
+	for (size_t i = 0; i < record->n_hunks; i++)
+		n_lines += record->hunks[i].n_insert;
+	record->size = lines_size(record->lines, n_lines);
+
+	// all the records left are on the undo side, so their sizes are up to
+	// date
+	size_t size = record->size;
+	for (size_t i = 0; i < history->n_records; i++)
+		size += history->records[i].size;
+	size_t n_dropped = 0;
+	while (n_dropped < history->n_records &&
+		(history->n_records - n_dropped >= MAX_UNDO_RECORDS || size > MAX_UNDO_BYTES)) {
+		size -= history->records[n_dropped].size;
+		undo_record_free(&history->records[n_dropped]);
+		n_dropped++;
+	}
+	if (n_dropped > 0) {
+		history->n_records -= n_dropped;
+		memmove(history->records, history->records + n_dropped,
+			history->n_records * sizeof(struct undo_record));
+	}
+
+	if (history->n_records == history->size) {
+		size_t new_size = (history->size == 0) ? 64 : history->size * 2;
+		struct undo_record *new_records = (struct undo_record *)realloc(history->records,
+			new_size * sizeof(struct undo_record));
+		if (new_records == NULL) {
+			// TODO: Critical failure. Handle in another way
+			exit(1);
+		}
+		history->records = new_records;
+		history->size = new_size;
+	}
+
+	history->records[history->n_records++] = *record;
+	history->current = history->n_records;
+}
+
+struct undo_record *undo_history_to_undo(struct undo_history *history)
+{
+	return (history->current > 0) ? &history->records[history->current - 1] : NULL;
+}
+
+struct undo_record *undo_history_to_redo(struct undo_history *history)
+{
+	return (history->current < history->n_records) ?
+		&history->records[history->current] : NULL;
+}
+
+void undo_history_undone(struct undo_history *history)
+{
+	history->current--;
+}
+
+void undo_history_redone(struct undo_history *history)
+{
+	history->current++;
+}
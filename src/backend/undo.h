@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_UNDO_H
+#define ENANO_UNDO_H
+
+#include <stddef.h>
+
+#include <backend/lines.h>
+
+/*
+ * An undo record is what it takes to revert an edit: a list of hunks, each
+ * one replacing n_remove lines starting at line y by n_insert lines. The
+ * lines are spans (see backend/lines.h), so keeping the old contents of a
+ * line around is just taking a reference to its storage.
+ *
+ * Applying a record turns it into its inverse, so the very same record
+ * goes back and forth between the undo and the redo sides of the history.
+ */
+struct undo_hunk {
+	// line numbers of the buffer the record is applied to
+	size_t y;
+	size_t n_remove;
+	size_t n_insert;
+};
+
+struct undo_record {
+	// sorted by y and not overlapping
+	struct undo_hunk *hunks;
+	size_t n_hunks;
+	// the lines to insert: those of hunks[0], then those of hunks[1], ...
+	struct line *lines;
+	// where the cursor goes when the record is applied, and where it
+	// goes when its inverse is
+	size_t cursor_x;
+	size_t cursor_y;
+	size_t inverse_cursor_x;
+	size_t inverse_cursor_y;
+	// bytes of memory the lines hold on to, set by the history
+	size_t size;
+};
+
+struct undo_history {
+	struct undo_record *records;
+	size_t n_records;
+	size_t size;
+	// records [0, current) can be undone, [current, n_records) redone
+	size_t current;
+};
+
+// room for n_hunks hunks and n_lines lines, which are left for the caller
+// to fill
+void undo_record_alloc(struct undo_record *record, size_t n_hunks, size_t n_lines);
+void undo_record_free(struct undo_record *record);
+// Applies the record to the list of lines starting at *lines (which can
+// change) and turns it into its inverse. node has to be a line of the
+// list and *node_y its line number; on return they're a line that's still
+// there, near the first hunk
+struct line_linked_list_node *undo_record_apply(struct undo_record *record,
+	struct line_linked_list_node **lines, size_t *n_lines,
+	struct line_linked_list_node *node, size_t *node_y);
+
+void undo_history_init(struct undo_history *history);
+void undo_history_uninit(struct undo_history *history);
+// drops whatever could be redone and adds record (the history takes
+// ownership of its hunks and lines). The oldest records are dropped once
+// the history holds too many of them or too much memory
+void undo_history_push(struct undo_history *history, struct undo_record *record);
+// the record to undo (or redo) next, NULL if there isn't any. Once it's
+// applied, undo_history_undone()/undo_history_redone() move the history
+struct undo_record *undo_history_to_undo(struct undo_history *history);
+struct undo_record *undo_history_to_redo(struct undo_history *history);
+void undo_history_undone(struct undo_history *history);
+void undo_history_redone(struct undo_history *history);
+
+#endif /* ENANO_UNDO_H */
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_DISPLAY_H
+#define ENANO_DISPLAY_H
+
+enum {
+	DISPLAY_ATTRIBUTE_NORMAL=0,
+	DISPLAY_ATTRIBUTE_BOLD=1,
+	// black on white, like the upper bar
+	DISPLAY_ATTRIBUTE_REVERSE=2
+};
+
+// returned by get_key() when no key arrived before the timeout
+#define DISPLAY_NO_KEY (-1)
+
+/*
+ * Same idea as struct editor_object (see common/interface.h): this is the
+ * interface every "display" has to comply with. A display is a rectangular
+ * region of a screen where someone (an editor, the upper bar, ...) draws.
+ * Instantiating one is done by making a copy of the struct, pointing
+ * screen to the screen the region belongs to (if the implementation
+ * needs one) and calling init().
+ *
+ * Nothing drawn is guaranteed to reach the terminal until flush() is
+ * called. flush() sends the changes made to ALL the regions of the screen,
+ * so a frame is a single flush() no matter how many regions changed.
+ */
+struct display_object {
+	void *data;
+	void *screen;
+	// size of the region, valid after init()
+	int nlines;
+	int ncols;
+	int (*init)(struct display_object *, int nlines, int ncols, int y, int x);
+	void (*uninit)(struct display_object *);
+	void (*clear)(struct display_object *);
+	// clears from column x to the end of line y
+	void (*clear_line)(struct display_object *, int y, int x);
+	// draws (at most) n characters of str. Tabs are expanded and
+	// whatever doesn't fit in the line is cut
+	void (*put_str)(struct display_object *, int y, int x, const char *str, int n, int attributes);
+	void (*move_cursor)(struct display_object *, int y, int x);
+	void (*show_cursor)(struct display_object *, int show);
+	void (*flush)(struct display_object *);
+	// returns a key (using the ncurses KEY_* codes for special keys) or
+	// DISPLAY_NO_KEY if none arrives in timeout_ms (-1 waits forever)
+	int (*get_key)(struct display_object *, int timeout_ms);
+};
+
+#endif /* ENANO_DISPLAY_H */
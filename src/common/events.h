@@ -36,6 +36,43 @@ enum {
 	EVENT_CHARACTER_ENTERED,
 
 	EVENT_DELETE_KEY_ENTERED,
+	// Selection and clipboard
+	EVENT_TOGGLE_MARK,
+	// cut/copy the selection, or the current line if nothing is selected
+	EVENT_CUT,
+	EVENT_COPY,
+	EVENT_PASTE,
+	// Multiple cursors: the edits happen at every cursor
+	// add a cursor at the next occurrence of the selection (or of the
+	// word under the cursor)
+	EVENT_ADD_CURSOR_NEXT_MATCH,
+	// add a cursor on the line below the last cursor, same column
+	EVENT_ADD_CURSOR_BELOW,
+	EVENT_REMOVE_EXTRA_CURSORS,
+	EVENT_UNDO,
+	EVENT_REDO,
+	// additional_data is a struct replace_all_data
+	EVENT_REPLACE_ALL,
+	// Line operations, on the lines of the selection (whole) or on the
+	// whole buffer if nothing is selected
+	EVENT_SORT_LINES,
+	// drop the lines equal to an earlier one
+	EVENT_UNIQUE_LINES,
+	// additional_data is a struct filter_lines_data
+	EVENT_FILTER_LINES,
+	// replace the lines with the output of a command they're the input
+	// of. additional_data is a struct pipe_lines_data
+	EVENT_PIPE_LINES,
+	// stop the background job, if there's one. Nothing changes
+	EVENT_CANCEL_JOB,
+	// move the cursor to a line (an offset, in the hex view).
+	// additional_data is a struct go_to_data
+	EVENT_GO_TO,
+	// draw the rows as CSV/TSV columns, or as lines again
+	EVENT_TOGGLE_COLUMNS,
+	// sent periodically while the backend has a background job running
+	// (see BACKGROUND_JOB_RUNNING), so it can check on it
+	EVENT_TICK,
 	// TODO: Check if we can rid of this one
 	EVENT_VOID,
 	NR_EVENTS
@@ -47,11 +84,36 @@ struct event {
 	void *additional_data;
 };
 
+struct replace_all_data {
+	const char *search;
+	const char *replacement;
+};
+
+struct filter_lines_data {
+	const char *pattern;
+	// keep the lines containing pattern, or drop them
+	char keep;
+};
+
+struct pipe_lines_data {
+	// run by sh
+	const char *command;
+};
+
+struct go_to_data {
+	// as the user typed it: decimal, or hex starting with 0x
+	const char *position;
+};
+
 enum {
 	// TODO: Do we really need this success?
 	EVENT_HANDLING_SUCCESS=0,
 	ERROR_EVENT_NOT_FOUND,
-	ERROR_OCCURRED_ERRNO_SET
+	ERROR_OCCURRED_ERRNO_SET,
+	// the event was handled, but the backend is still working on
+	// something in the background. The caller should send EVENT_TICK
+	// every now and then until it gets another result type
+	BACKGROUND_JOB_RUNNING
 };
 
 // A struct result is the way the backends can return
@@ -61,7 +123,8 @@ enum {
 // or whatever other thing
 struct result {
 	unsigned int result_type;
-	// often this will be NULL too
+	// often this will be NULL too. If it's not, for EVENT_HANDLING_SUCCESS
+	// and BACKGROUND_JOB_RUNNING it's a message (char *) for the user
 	void *additional_data;
 };
 
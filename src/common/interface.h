@@ -17,6 +17,7 @@
 #ifndef ENANO_INTERFACE_H
 #define ENANO_INTERFACE_H
 
+#include <common/display.h>
 #include <common/events.h>
 
 /*
@@ -28,7 +29,8 @@
  */
 struct editor_object {
 	void *data;
-	int (*init)(struct editor_object *, const char *, int, int, int, int);
+	// the editor draws on the given display, which MUST outlive it
+	int (*init)(struct editor_object *, const char *, struct display_object *);
 	void (*uninit)(struct editor_object *);
 	void (*handle_event)(struct editor_object *, struct event *, struct result *);
 	// ncurses defines a macro called refresh(), so we can't use that name
@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <common/remote.h>
+
+// the room made for what recv() brings, see remote_buffer_receive_some()
+#define RECEIVE_SIZE 4096
+
+void remote_default_socket_path(char *path, size_t size)
+{
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (runtime_dir != NULL && runtime_dir[0] != '\0')
+		snprintf(path, size, "%s/enano.sock", runtime_dir);
+	else
+		snprintf(path, size, "/tmp/enano-%u.sock", (unsigned int)getuid());
+}
+
+static int socket_address(const char *path, struct sockaddr_un *address)
+{
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address->sun_path))
+		return -ENAMETOOLONG;
+	strcpy(address->sun_path, path);
+
+	return 0;
+}
+
+int remote_connect(const char *path)
+{
+	struct sockaddr_un address;
+	int ret = socket_address(path, &address);
+	if (ret < 0)
+		return ret;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	return fd;
+}
+
+int remote_listen(const char *path)
+{
+	struct sockaddr_un address;
+	int ret = socket_address(path, &address);
+	if (ret < 0)
+		return ret;
+
+	// someone is answering there
+	int fd = remote_connect(path);
+	if (fd >= 0) {
+		close(fd);
+		return -EADDRINUSE;
+	}
+	// a server that is gone left it behind
+	unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	// only we can talk to our buffers
+	mode_t old_umask = umask(0077);
+	ret = bind(fd, (struct sockaddr *)&address, sizeof(address));
+	umask(old_umask);
+	if (ret < 0 || listen(fd, 16) < 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	return fd;
+}
+
+void remote_buffer_free(struct remote_buffer *buffer)
+{
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->length = buffer->size = buffer->read = 0;
+}
+
+static void reserve(struct remote_buffer *buffer, size_t size)
+{
+	if (size <= buffer->size)
+		return;
+
+	size_t new_size = (buffer->size == 0) ? 4096 : buffer->size;
+	while (new_size < size)
+		new_size *= 2;
+	char *new_data = realloc(buffer->data, new_size);
+	if (new_data == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+	buffer->data = new_data;
+	buffer->size = new_size;
+}
+
+void remote_buffer_start(struct remote_buffer *buffer, uint32_t type)
+{
+	struct remote_header header = { .type = type, .length = 0 };
+	buffer->length = buffer->read = 0;
+	remote_buffer_append(buffer, &header, sizeof(header));
+}
+
+void remote_buffer_append(struct remote_buffer *buffer, const void *data, size_t length)
+{
+	reserve(buffer, buffer->length + length);
+	memcpy(&buffer->data[buffer->length], data, length);
+	buffer->length += length;
+}
+
+// the header tells how long the message turned out to be
+static void finish_message(struct remote_buffer *buffer)
+{
+	struct remote_header header;
+	memcpy(&header, buffer->data, sizeof(header));
+	header.length = buffer->length - sizeof(header);
+	memcpy(buffer->data, &header, sizeof(header));
+}
+
+int remote_buffer_send(int fd, struct remote_buffer *buffer)
+{
+	finish_message(buffer);
+
+	for (size_t sent = 0; sent < buffer->length;) {
+		// a client that went away shouldn't kill the server with SIGPIPE
+		ssize_t n = send(fd, &buffer->data[sent], buffer->length - sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		sent += n;
+	}
+
+	return 0;
+}
+
+int remote_buffer_send_some(int fd, struct remote_buffer *buffer)
+{
+	if (buffer->read == 0)
+		finish_message(buffer);
+
+	while (buffer->read < buffer->length) {
+		ssize_t n = send(fd, &buffer->data[buffer->read], buffer->length - buffer->read,
+			MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -errno;
+		}
+		buffer->read += n;
+	}
+
+	return 1;
+}
+
+static int receive_all(int fd, char *data, size_t length)
+{
+	while (length > 0) {
+		ssize_t n = recv(fd, data, length, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		if (n == 0)
+			return -ECONNRESET;
+		data += n;
+		length -= n;
+	}
+
+	return 0;
+}
+
+int remote_buffer_receive(int fd, struct remote_buffer *buffer, uint32_t *type)
+{
+	struct remote_header header;
+	int ret = receive_all(fd, (char *)&header, sizeof(header));
+	if (ret < 0)
+		return ret;
+	if (header.length > REMOTE_MAX_MESSAGE_SIZE)
+		return -EMSGSIZE;
+
+	reserve(buffer, header.length);
+	ret = receive_all(fd, buffer->data, header.length);
+	if (ret < 0)
+		return ret;
+
+	buffer->length = header.length;
+	buffer->read = 0;
+	*type = header.type;
+	return 0;
+}
+
+int remote_buffer_receive_some(int fd, struct remote_buffer *input)
+{
+	reserve(input, input->length + RECEIVE_SIZE);
+	for (;;) {
+		ssize_t n = recv(fd, &input->data[input->length], input->size - input->length, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -errno;
+		if (n == 0)
+			return -ECONNRESET;
+		input->length += n;
+		return 0;
+	}
+}
+
+int remote_buffer_next_message(struct remote_buffer *input, struct remote_buffer *buffer,
+	uint32_t *type)
+{
+	struct remote_header header;
+	if (input->length < sizeof(header))
+		return 0;
+	memcpy(&header, input->data, sizeof(header));
+	if (header.length > REMOTE_MAX_MESSAGE_SIZE)
+		return -EMSGSIZE;
+	size_t end = sizeof(header) + header.length;
+	if (input->length < end)
+		return 0;
+
+	reserve(buffer, header.length);
+	memcpy(buffer->data, &input->data[sizeof(header)], header.length);
+	buffer->length = header.length;
+	buffer->read = 0;
+	*type = header.type;
+
+	memmove(input->data, &input->data[end], input->length - end);
+	input->length -= end;
+	return 1;
+}
+
+const void *remote_buffer_take(struct remote_buffer *buffer, size_t length)
+{
+	if (length > buffer->length - buffer->read)
+		return NULL;
+
+	const void *ret = &buffer->data[buffer->read];
+	buffer->read += length;
+	return ret;
+}
+
+void remote_put_event(struct remote_buffer *buffer, struct event *event)
+{
+	struct remote_event remote_event = { .event_type = event->event_type };
+	struct replace_all_data *replace_all_data = NULL;
+	const char *pattern = NULL;
+	if (event->event_type == EVENT_CHARACTER_ENTERED)
+		remote_event.c = *(int *)event->additional_data;
+	else if (event->event_type == EVENT_REPLACE_ALL) {
+		replace_all_data = (struct replace_all_data *)event->additional_data;
+		remote_event.search_length = strlen(replace_all_data->search);
+		remote_event.replacement_length = strlen(replace_all_data->replacement);
+	}
+	else if (event->event_type == EVENT_FILTER_LINES) {
+		struct filter_lines_data *filter_lines_data =
+			(struct filter_lines_data *)event->additional_data;
+		remote_event.c = filter_lines_data->keep;
+		remote_event.search_length = strlen(filter_lines_data->pattern);
+		pattern = filter_lines_data->pattern;
+	}
+	// the command goes as the pattern would
+	else if (event->event_type == EVENT_PIPE_LINES) {
+		pattern = ((struct pipe_lines_data *)event->additional_data)->command;
+		remote_event.search_length = strlen(pattern);
+	}
+	else if (event->event_type == EVENT_GO_TO) {
+		pattern = ((struct go_to_data *)event->additional_data)->position;
+		remote_event.search_length = strlen(pattern);
+	}
+
+	remote_buffer_append(buffer, &remote_event, sizeof(remote_event));
+	if (replace_all_data != NULL) {
+		remote_buffer_append(buffer, replace_all_data->search,
+			remote_event.search_length + 1);
+		remote_buffer_append(buffer, replace_all_data->replacement,
+			remote_event.replacement_length + 1);
+	}
+	if (pattern != NULL)
+		remote_buffer_append(buffer, pattern, remote_event.search_length + 1);
+}
+
+// a string of length characters (and its '\0') of a received message
+static const char *take_string(struct remote_buffer *buffer, size_t length)
+{
+	if (length >= REMOTE_MAX_MESSAGE_SIZE)
+		return NULL;
+
+	const char *str = remote_buffer_take(buffer, length + 1);
+	return (str != NULL && str[length] == '\0') ? str : NULL;
+}
+
+int remote_take_event(struct remote_buffer *buffer, struct remote_event_data *data)
+{
+	struct remote_event remote_event;
+	const void *p = remote_buffer_take(buffer, sizeof(remote_event));
+	if (p == NULL)
+		return -EINVAL;
+	memcpy(&remote_event, p, sizeof(remote_event));
+	if (remote_event.event_type >= NR_EVENTS)
+		return -EINVAL;
+
+	data->event.event_type = remote_event.event_type;
+	data->event.additional_data = NULL;
+	if (remote_event.event_type == EVENT_CHARACTER_ENTERED) {
+		data->c = remote_event.c;
+		data->event.additional_data = (void *)&data->c;
+	}
+	else if (remote_event.event_type == EVENT_REPLACE_ALL) {
+		data->replace_all_data.search = take_string(buffer, remote_event.search_length);
+		data->replace_all_data.replacement =
+			take_string(buffer, remote_event.replacement_length);
+		if (data->replace_all_data.search == NULL ||
+			data->replace_all_data.replacement == NULL)
+			return -EINVAL;
+		data->event.additional_data = (void *)&data->replace_all_data;
+	}
+	else if (remote_event.event_type == EVENT_FILTER_LINES) {
+		data->filter_lines_data.pattern = take_string(buffer, remote_event.search_length);
+		data->filter_lines_data.keep = remote_event.c;
+		if (data->filter_lines_data.pattern == NULL)
+			return -EINVAL;
+		data->event.additional_data = (void *)&data->filter_lines_data;
+	}
+	else if (remote_event.event_type == EVENT_PIPE_LINES) {
+		data->pipe_lines_data.command = take_string(buffer, remote_event.search_length);
+		if (data->pipe_lines_data.command == NULL)
+			return -EINVAL;
+		data->event.additional_data = (void *)&data->pipe_lines_data;
+	}
+	else if (remote_event.event_type == EVENT_GO_TO) {
+		data->go_to_data.position = take_string(buffer, remote_event.search_length);
+		if (data->go_to_data.position == NULL)
+			return -EINVAL;
+		data->event.additional_data = (void *)&data->go_to_data;
+	}
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_REMOTE_H
+#define ENANO_REMOTE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <common/events.h>
+
+#define REMOTE_PROTOCOL_VERSION 1
+// we don't expect anything bigger, and won't allocate it
+#define REMOTE_MAX_MESSAGE_SIZE (16 * 1024 * 1024)
+
+/*
+ * What an editor server (frontend/server.c) and its clients (run_client()
+ * at frontend/editor.c) say to each other over a Unix socket. Every
+ * message is a struct remote_header followed by length bytes. Both ends
+ * are the same program on the same machine, so the structs go as they are
+ * in memory.
+ *
+ * client -> server:
+ *  - REMOTE_ATTACH: a struct remote_attach and the (absolute) path of the
+ *    file, '\0' included. Once, before anything else
+ *  - REMOTE_EVENT: a struct remote_event and its strings, '\0' included
+ * server -> client:
+ *  - REMOTE_FRAME: a struct remote_frame, its message and n_runs times a
+ *    struct remote_run followed by its characters. Frames are the cells
+ *    that changed since the last one the client got
+ */
+enum {
+	REMOTE_ATTACH=0,
+	REMOTE_EVENT,
+	REMOTE_FRAME
+};
+
+struct remote_header {
+	uint32_t type;
+	uint32_t length;
+};
+
+struct remote_attach {
+	uint32_t version;
+	// the size of the buffer display of the client
+	uint16_t nlines;
+	uint16_t ncols;
+};
+
+struct remote_event {
+	uint32_t event_type;
+	// EVENT_CHARACTER_ENTERED, keep for EVENT_FILTER_LINES
+	int32_t c;
+	// EVENT_REPLACE_ALL, the pattern is the search of EVENT_FILTER_LINES
+	uint32_t search_length;
+	uint32_t replacement_length;
+};
+
+struct remote_frame {
+	// the frame that answers the last event of the client, others come
+	// from events of other clients (or the background jobs of the server)
+	uint8_t is_reply;
+	uint8_t cursor_visible;
+	uint16_t cursor_y;
+	uint16_t cursor_x;
+	uint16_t message_length;
+	uint32_t n_runs;
+};
+
+// n characters drawn with the same attributes, starting at (y, x)
+struct remote_run {
+	uint16_t y;
+	uint16_t x;
+	// bytes of its characters, which are UTF-8
+	uint16_t n;
+	uint16_t attributes;
+};
+
+// A message being built or the last one received (its payload, without
+// the header)
+struct remote_buffer {
+	char *data;
+	size_t length;
+	size_t size;
+	// how much of a received message has been read
+	size_t read;
+};
+
+// the event of a REMOTE_EVENT, additional_data points in here (or into
+// the message)
+struct remote_event_data {
+	struct event event;
+	int c;
+	struct replace_all_data replace_all_data;
+	struct filter_lines_data filter_lines_data;
+	struct pipe_lines_data pipe_lines_data;
+	struct go_to_data go_to_data;
+};
+
+// the socket both sides use if they aren't told another one
+void remote_default_socket_path(char *path, size_t size);
+
+// connects to, or listens on, the socket at path. Return the socket or
+// -errno
+int remote_connect(const char *path);
+int remote_listen(const char *path);
+
+// functions below return 0 on success, -errno on failure
+void remote_buffer_free(struct remote_buffer *buffer);
+// starts a new message of the given type
+void remote_buffer_start(struct remote_buffer *buffer, uint32_t type);
+void remote_buffer_append(struct remote_buffer *buffer, const void *data, size_t length);
+int remote_buffer_send(int fd, struct remote_buffer *buffer);
+// waits for the next message. -ECONNRESET if the other side is gone
+int remote_buffer_receive(int fd, struct remote_buffer *buffer, uint32_t *type);
+// For non-blocking sockets. Sends what fd takes of the message, read
+// counts what went already. Returns 1 once all of it did, 0 if the rest
+// has to wait until fd is writable
+int remote_buffer_send_some(int fd, struct remote_buffer *buffer);
+// appends to input what there is to read on fd (maybe nothing)
+int remote_buffer_receive_some(int fd, struct remote_buffer *input);
+// moves the first message of input to buffer. Returns 1 if there was a
+// whole one, 0 if the rest of it hasn't arrived yet
+int remote_buffer_next_message(struct remote_buffer *input, struct remote_buffer *buffer,
+	uint32_t *type);
+// takes the next length bytes of a received message. NULL if there
+// aren't as many left
+const void *remote_buffer_take(struct remote_buffer *buffer, size_t length);
+
+// an event (and its additional_data) for a REMOTE_EVENT
+void remote_put_event(struct remote_buffer *buffer, struct event *event);
+int remote_take_event(struct remote_buffer *buffer, struct remote_event_data *data);
+
+#endif /* ENANO_REMOTE_H */
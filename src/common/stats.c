@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <common/stats.h>
+
+// we stop recording once we reach this many trace events, so a very long
+// session can't eat all the memory
+#define MAX_TRACE_EVENTS (1 << 20)
+
+struct trace_event {
+	const char *name;
+	const char *category;
+	uint64_t start_ns;
+	uint64_t end_ns;
+};
+
+struct editor_stats editor_stats;
+
+static const char *event_names[NR_EVENTS] = {
+	[EVENT_SAVE_BUFFER] = "save_buffer",
+	[EVENT_SAVE_BUFFER_AS] = "save_buffer_as",
+	[EVENT_CLOSE_BUFFER] = "close_buffer",
+	[EVENT_SHOW_CURSOR] = "show_cursor",
+	[EVENT_HIDE_CURSOR] = "hide_cursor",
+	[EVENT_MOVE_CURSOR_LEFT] = "move_cursor_left",
+	[EVENT_MOVE_CURSOR_RIGHT] = "move_cursor_right",
+	[EVENT_MOVE_CURSOR_UP] = "move_cursor_up",
+	[EVENT_MOVE_CURSOR_DOWN] = "move_cursor_down",
+	[EVENT_CHARACTER_ENTERED] = "character_entered",
+	[EVENT_DELETE_KEY_ENTERED] = "delete_key_entered",
+	[EVENT_TOGGLE_MARK] = "toggle_mark",
+	[EVENT_CUT] = "cut",
+	[EVENT_COPY] = "copy",
+	[EVENT_PASTE] = "paste",
+	[EVENT_ADD_CURSOR_NEXT_MATCH] = "add_cursor_next_match",
+	[EVENT_ADD_CURSOR_BELOW] = "add_cursor_below",
+	[EVENT_REMOVE_EXTRA_CURSORS] = "remove_extra_cursors",
+	[EVENT_UNDO] = "undo",
+	[EVENT_REDO] = "redo",
+	[EVENT_REPLACE_ALL] = "replace_all",
+	[EVENT_SORT_LINES] = "sort_lines",
+	[EVENT_UNIQUE_LINES] = "unique_lines",
+	[EVENT_FILTER_LINES] = "filter_lines",
+	[EVENT_PIPE_LINES] = "pipe_lines",
+	[EVENT_CANCEL_JOB] = "cancel_job",
+	[EVENT_GO_TO] = "go_to",
+	[EVENT_TOGGLE_COLUMNS] = "toggle_columns",
+	[EVENT_TICK] = "tick",
+	[EVENT_VOID] = "void"
+};
+
+static struct trace_event *trace_events = NULL;
+static size_t trace_events_size = 0;
+static size_t n_trace_events = 0;
+static char trace_enabled = 0;
+// trace timestamps are relative to this
+static uint64_t trace_start_ns;
+
+uint64_t stats_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void latency_histogram_add(struct latency_histogram *h, uint64_t ns)
+{
+	unsigned int bucket = 0;
+	for (uint64_t v = ns; v > 1 && bucket < LATENCY_HISTOGRAM_BUCKETS - 1; v >>= 1)
+		bucket++;
+
+	h->buckets[bucket]++;
+	h->count++;
+	h->total_ns += ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+}
+
+uint64_t latency_histogram_percentile(struct latency_histogram *h, double p)
+{
+	if (h->count == 0)
+		return 0;
+
+	uint64_t wanted = (uint64_t)(p * h->count);
+	if (wanted == 0)
+		wanted = 1;
+
+	uint64_t seen = 0;
+	for (unsigned int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= wanted) {
+			uint64_t upper_bound = 1ull << (i + 1);
+			return (upper_bound < h->max_ns) ? upper_bound : h->max_ns;
+		}
+	}
+
+	return h->max_ns;
+}
+
+const char *stats_event_name(unsigned int event_type)
+{
+	if (event_type < NR_EVENTS && event_names[event_type] != NULL)
+		return event_names[event_type];
+
+	return "unknown_event";
+}
+
+void trace_enable(void)
+{
+	trace_enabled = 1;
+	trace_start_ns = stats_now_ns();
+}
+
+void trace_record(const char *name, const char *category, uint64_t start_ns, uint64_t end_ns)
+{
+	if (!trace_enabled || n_trace_events == MAX_TRACE_EVENTS)
+		return;
+
+	if (n_trace_events == trace_events_size) {
+		size_t new_size = (trace_events_size == 0) ? 1024 : trace_events_size * 2;
+		struct trace_event *new_events =
+			realloc(trace_events, new_size * sizeof(struct trace_event));
+		// losing trace events is better than stopping the editor
+		if (new_events == NULL)
+			return;
+
+		trace_events = new_events;
+		trace_events_size = new_size;
+	}
+
+	struct trace_event *event = &trace_events[n_trace_events++];
+	event->name = name;
+	event->category = category;
+	event->start_ns = start_ns;
+	event->end_ns = end_ns;
+}
+
+int trace_dump(const char *path)
+{
+	FILE *descriptor = fopen(path, "w");
+	if (!descriptor)
+		return -errno;
+
+	fprintf(descriptor, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (size_t i = 0; i < n_trace_events; i++) {
+		struct trace_event *event = &trace_events[i];
+		// Chrome traces use microseconds
+		fprintf(descriptor,
+			"%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+			"\"ts\":%.3f,\"dur\":%.3f}",
+			(i == 0) ? "" : ",", event->name, event->category,
+			(event->start_ns - trace_start_ns) / 1000.0,
+			(event->end_ns - event->start_ns) / 1000.0);
+	}
+	fprintf(descriptor, "\n]}\n");
+
+	if (fclose(descriptor) != 0)
+		return -errno;
+
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_STATS_H
+#define ENANO_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <common/events.h>
+
+// bucket i counts the samples that took [2^i, 2^(i+1)) nanoseconds
+#define LATENCY_HISTOGRAM_BUCKETS 40
+
+struct latency_histogram {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+};
+
+// Everything we know about how the editor is behaving at runtime.
+// There is a single instance (editor_stats) shared by the frontend
+// and the backends, as there is only one editor running per process.
+struct editor_stats {
+	struct latency_histogram event_latency[NR_EVENTS];
+	struct latency_histogram refresh_latency;
+	// EVENT_TICKs sent while a background job runs. Nobody pressed a key
+	// for them, so they're counted here instead of in the histograms
+	uint64_t n_ticks;
+
+	uint64_t load_ns;
+	uint64_t save_ns;
+	uint64_t n_saves;
+	// by the last save. Copied bytes never went through the editor
+	uint64_t save_bytes_written;
+	uint64_t save_bytes_copied;
+
+	// what we send to the terminal (only known with the vt renderer)
+	uint64_t frames;
+	uint64_t frame_bytes;
+	uint64_t max_frame_bytes;
+
+	// lines loaded from the file (see backend/single_buffer_editor.c):
+	// found already loaded, batches loaded, lines unloaded, and what the
+	// loaded ones take
+	uint64_t line_cache_hits;
+	uint64_t line_cache_misses;
+	uint64_t line_cache_evictions;
+	uint64_t line_cache_bytes;
+
+	// modified lines compressed (see backend/line_compression.h): what
+	// they take and what they would take, and how long reading them back
+	// takes
+	uint64_t compressed_bytes;
+	uint64_t compressed_raw_bytes;
+	struct latency_histogram decompress_latency;
+
+	// bytes currently held by the buffer storage (lines + nodes)
+	int64_t allocated_bytes;
+	int64_t peak_allocated_bytes;
+};
+
+extern struct editor_stats editor_stats;
+
+// monotonic clock, in nanoseconds
+uint64_t stats_now_ns(void);
+
+void latency_histogram_add(struct latency_histogram *h, uint64_t ns);
+// returns an upper bound of the p-th percentile (0 <= p <= 1)
+uint64_t latency_histogram_percentile(struct latency_histogram *h, double p);
+
+// line storage can be allocated from background threads (see
+// backend/replace_all.c), so these are atomic
+static inline void stats_count_alloc(size_t size)
+{
+	int64_t allocated = __atomic_add_fetch(&editor_stats.allocated_bytes, size,
+		__ATOMIC_RELAXED);
+	int64_t peak = __atomic_load_n(&editor_stats.peak_allocated_bytes, __ATOMIC_RELAXED);
+	while (allocated > peak &&
+		!__atomic_compare_exchange_n(&editor_stats.peak_allocated_bytes, &peak,
+			allocated, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline void stats_count_free(size_t size)
+{
+	__atomic_sub_fetch(&editor_stats.allocated_bytes, size, __ATOMIC_RELAXED);
+}
+
+const char *stats_event_name(unsigned int event_type);
+
+// Trace recording. Nothing is recorded until trace_enable() is called.
+// Names MUST be string literals (or live as long as the process), they
+// are not copied.
+void trace_enable(void);
+void trace_record(const char *name, const char *category, uint64_t start_ns, uint64_t end_ns);
+// writes the recorded trace as a Chrome trace (JSON) file
+int trace_dump(const char *path);
+
+#endif /* ENANO_STATS_H */
@@ -16,92 +16,729 @@
 
 #include <curses.h>
 
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <backend/hex_editor.h>
 #include <backend/single_buffer_editor.h>
 #include <common/events.h>
+#include <common/remote.h>
+#include <common/stats.h>
+#include <frontend/editor.h>
+#include <frontend/ncurses_display.h>
+#include <frontend/vt_display.h>
 
 #define ctrl(x)           ((x) & 0x1f)
+// Alt+x arrives as ESC followed by x. We give it a value out of the
+// range of the ncurses KEY_* constants
+#define meta(x)           ((x) | 0x1000)
+
+#define ESCAPE_KEY 27
+// how long to wait (ms) for the second half of an Alt+x sequence
+#define META_KEY_TIMEOUT 50
+#define PROMPT_ANSWER_SIZE 256
+
+// keystroke-to-screen latencies, one per key, in nanoseconds
+struct latency_samples {
+	uint64_t *ns;
+	size_t n;
+	size_t size;
+};
+
+static void latency_samples_add(struct latency_samples *samples, uint64_t ns)
+{
+	if (samples->n == samples->size) {
+		size_t new_size = (samples->size == 0) ? 4096 : samples->size * 2;
+		uint64_t *new_ns = realloc(samples->ns, new_size * sizeof(uint64_t));
+		// we'd rather lose samples than the user's session
+		if (new_ns == NULL)
+			return;
+
+		samples->ns = new_ns;
+		samples->size = new_size;
+	}
+
+	samples->ns[samples->n++] = ns;
+}
+
+static int compare_uint64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint64_t latency_samples_percentile(struct latency_samples *samples, double p)
+{
+	// samples MUST be sorted
+	size_t i = (size_t)(p * samples->n);
+	if (i >= samples->n)
+		i = samples->n - 1;
+
+	return samples->ns[i];
+}
+
+static int write_latency_report(const char *path, struct latency_samples *samples)
+{
+	FILE *descriptor = fopen(path, "w");
+	if (!descriptor)
+		return -errno;
+
+	fprintf(descriptor, "keys %zu\n", samples->n);
+	if (samples->n > 0) {
+		qsort(samples->ns, samples->n, sizeof(uint64_t), compare_uint64);
+		fprintf(descriptor, "p50_ns %llu\np99_ns %llu\nmax_ns %llu\n",
+			(unsigned long long)latency_samples_percentile(samples, 0.5),
+			(unsigned long long)latency_samples_percentile(samples, 0.99),
+			(unsigned long long)samples->ns[samples->n - 1]);
+	}
+
+	if (fclose(descriptor) != 0)
+		return -errno;
+
+	return 0;
+}
+
+static void format_ns(char *buf, size_t buf_size, uint64_t ns)
+{
+	if (ns < 1000)
+		snprintf(buf, buf_size, "%lluns", (unsigned long long)ns);
+	else if (ns < 1000000)
+		snprintf(buf, buf_size, "%.1fus", ns / 1000.0);
+	else if (ns < 1000000000)
+		snprintf(buf, buf_size, "%.1fms", ns / 1000000.0);
+	else
+		snprintf(buf, buf_size, "%.2fs", ns / 1000000000.0);
+}
+
+static void draw_stats(struct display_object *bar)
+{
+	// all the event types together
+	struct latency_histogram events = {0};
+	for (unsigned int i = 0; i < NR_EVENTS; i++) {
+		struct latency_histogram *h = &editor_stats.event_latency[i];
+		for (unsigned int j = 0; j < LATENCY_HISTOGRAM_BUCKETS; j++)
+			events.buckets[j] += h->buckets[j];
+		events.count += h->count;
+		events.total_ns += h->total_ns;
+		if (h->max_ns > events.max_ns)
+			events.max_ns = h->max_ns;
+	}
+
+	char event_p50[16], event_p99[16], event_max[16];
+	char refresh_p50[16], refresh_p99[16], load[16], save[16];
+	format_ns(event_p50, sizeof(event_p50), latency_histogram_percentile(&events, 0.5));
+	format_ns(event_p99, sizeof(event_p99), latency_histogram_percentile(&events, 0.99));
+	format_ns(event_max, sizeof(event_max), events.max_ns);
+	format_ns(refresh_p50, sizeof(refresh_p50),
+		latency_histogram_percentile(&editor_stats.refresh_latency, 0.5));
+	format_ns(refresh_p99, sizeof(refresh_p99),
+		latency_histogram_percentile(&editor_stats.refresh_latency, 0.99));
+	format_ns(load, sizeof(load), editor_stats.load_ns);
+	format_ns(save, sizeof(save), editor_stats.save_ns);
+
+	char stats_str[256];
+	int length = snprintf(stats_str, sizeof(stats_str),
+		"ev %llu p50 %s p99 %s max %s | refresh p50 %s p99 %s | load %s save %s (%lluK written)"
+		" | heap %lldK",
+		(unsigned long long)events.count, event_p50, event_p99, event_max,
+		refresh_p50, refresh_p99, load, save,
+		(unsigned long long)(editor_stats.save_bytes_written / 1024),
+		(long long)(editor_stats.allocated_bytes / 1024));
+	if (length < sizeof(stats_str))
+		length += snprintf(&stats_str[length], sizeof(stats_str) - length,
+			" | cache %lluK miss %llu/%llu evicted %llu",
+			(unsigned long long)(editor_stats.line_cache_bytes / 1024),
+			(unsigned long long)editor_stats.line_cache_misses,
+			(unsigned long long)(editor_stats.line_cache_hits +
+				editor_stats.line_cache_misses),
+			(unsigned long long)editor_stats.line_cache_evictions);
+	if (editor_stats.compressed_bytes > 0 && length < sizeof(stats_str)) {
+		char decompress_p99[16];
+		format_ns(decompress_p99, sizeof(decompress_p99),
+			latency_histogram_percentile(&editor_stats.decompress_latency, 0.99));
+		length += snprintf(&stats_str[length], sizeof(stats_str) - length,
+			" | packed %lluK/%lluK p99 %s",
+			(unsigned long long)(editor_stats.compressed_bytes / 1024),
+			(unsigned long long)(editor_stats.compressed_raw_bytes / 1024),
+			decompress_p99);
+	}
+	if (editor_stats.n_ticks > 0 && length < sizeof(stats_str))
+		length += snprintf(&stats_str[length], sizeof(stats_str) - length, " | ticks %llu",
+			(unsigned long long)editor_stats.n_ticks);
+	if (editor_stats.frames > 0 && length < sizeof(stats_str))
+		snprintf(&stats_str[length], sizeof(stats_str) - length, " | out %lluB/frame",
+			(unsigned long long)(editor_stats.frame_bytes / editor_stats.frames));
+
+	bar->put_str(bar, 0, 12, stats_str, strlen(stats_str),
+		DISPLAY_ATTRIBUTE_BOLD | DISPLAY_ATTRIBUTE_REVERSE);
+}
+
+static void clear_upper_bar(struct display_object *bar)
+{
+	// the whole bar is black on white (and bold, for bright white color :)
+	for (int x = 0; x < bar->ncols; x++)
+		bar->put_str(bar, 0, x, " ", 1, DISPLAY_ATTRIBUTE_BOLD | DISPLAY_ATTRIBUTE_REVERSE);
+}
 
 // TODO: Put upper and lower bar in different files
-static void draw_upper_bar(WINDOW *window)
-{
-        wbkgd(window, COLOR_PAIR(1));
-	// TODO: Put some error checking in this functions
-	// TODO: Check this: Bolding isn't working
-	wattron(window, A_BOLD);
-        mvwprintw(window, 0, 2, "(e)nano");
-	wattroff(window, A_BOLD);
-}
-
-void run_editor(char *path)
-{
-	initscr();
-	// raw() allows to use certain combinations like Control+S which
-	// otherwise would raise a signal
-	raw();
-	start_color();
-	cbreak();
-	noecho();
-	WINDOW *upper_bar_window = newwin(1, COLS, 0, 0);
-	// for bright white color :)
-	wattron(upper_bar_window, A_BOLD);
-	// for capturing special keys in wgetch()
-	keypad(upper_bar_window, TRUE);
-	init_pair(1, COLOR_BLACK, COLOR_WHITE);
-	draw_upper_bar(upper_bar_window);
-	wrefresh(upper_bar_window);
-	struct editor_object editor = single_buffer_editor_object;
-	int retval = editor.init(&editor, path, LINES - 1, COLS, 1, 0);
+// message (the last one the backend gave us) can be empty
+static void draw_upper_bar(struct display_object *bar, char show_stats, const char *message)
+{
+	clear_upper_bar(bar);
+	bar->put_str(bar, 0, 2, "(e)nano", strlen("(e)nano"),
+		DISPLAY_ATTRIBUTE_BOLD | DISPLAY_ATTRIBUTE_REVERSE);
+	// the stats take the whole bar
+	if (show_stats)
+		draw_stats(bar);
+	else
+		bar->put_str(bar, 0, 12, message, strlen(message),
+			DISPLAY_ATTRIBUTE_BOLD | DISPLAY_ATTRIBUTE_REVERSE);
+}
+
+// *arrival_ns is set to the time the (first byte of the) key was read.
+// Returns DISPLAY_NO_KEY if none arrives in timeout_ms (-1 waits forever)
+static int read_key(struct display_object *display, int timeout_ms, uint64_t *arrival_ns)
+{
+	int c = display->get_key(display, timeout_ms);
+	*arrival_ns = stats_now_ns();
+	if (c != ESCAPE_KEY)
+		return c;
+
+	int next = display->get_key(display, META_KEY_TIMEOUT);
+
+	return (next == DISPLAY_NO_KEY) ? ESCAPE_KEY : meta(next);
+}
+
+// Asks the user for a string in the upper bar. Returns 0 once Enter is
+// pressed, -1 if the user gives up (Ctrl+C or Escape)
+static int prompt(struct display_object *bar, const char *question, char *answer, size_t answer_size)
+{
+	size_t length = 0;
+	answer[0] = '\0';
+	for (;;) {
+		clear_upper_bar(bar);
+		bar->put_str(bar, 0, 0, question, strlen(question),
+			DISPLAY_ATTRIBUTE_BOLD | DISPLAY_ATTRIBUTE_REVERSE);
+		// only the end of the answer if it doesn't fit
+		int x = strlen(question);
+		size_t shown = (x + length < bar->ncols) ? 0 : x + length + 1 - bar->ncols;
+		bar->put_str(bar, 0, x, &answer[shown], length - shown,
+			DISPLAY_ATTRIBUTE_BOLD | DISPLAY_ATTRIBUTE_REVERSE);
+		bar->move_cursor(bar, 0, x + length - shown);
+		bar->flush(bar);
+
+		uint64_t arrival_ns;
+		int c = read_key(bar, -1, &arrival_ns);
+		switch (c) {
+			case '\n':
+				return 0;
+			case ctrl('c'):
+			case ESCAPE_KEY:
+				return -1;
+			case KEY_BACKSPACE:
+			case KEY_DC:
+				if (length > 0)
+					answer[--length] = '\0';
+			break;
+			default:
+				if (((32 <= c && c <= 255) || c == '\t') && length + 1 < answer_size) {
+					answer[length++] = c;
+					answer[length] = '\0';
+				}
+		}
+	}
+}
+
+// takes over the terminal with the renderer the user asked for. After this
+// displays are made by copying *display_class (+ .screen) and calling init()
+static int start_terminal(struct editor_options *options, struct vt_screen *vt_screen,
+	struct display_object *display_class, int *nlines, int *ncols)
+{
+	if (options->renderer == RENDERER_VT) {
+		int ret = vt_terminal_init(vt_screen, STDIN_FILENO, STDOUT_FILENO);
+		if (ret < 0)
+			return ret;
+
+		*display_class = vt_display_object;
+		display_class->screen = (void *)vt_screen;
+		*nlines = vt_screen->nlines;
+		*ncols = vt_screen->ncols;
+	}
+	else {
+		ncurses_screen_init(nlines, ncols);
+		*display_class = ncurses_display_object;
+	}
+
+	return 0;
+}
+
+static void stop_terminal(struct editor_options *options, struct vt_screen *vt_screen)
+{
+	if (options->renderer == RENDERER_VT)
+		vt_terminal_uninit(vt_screen);
+	else
+		ncurses_screen_uninit();
+}
+
+// The terminal side of a session, run_editor()'s or run_client()'s
+struct frontend {
+	struct vt_screen vt_screen;
+	struct display_object upper_bar;
+	struct display_object buffer_display;
+	char show_stats;
+	// the last message from the backend
+	char message[128];
+
+	// the additional_data of the events we make points in here
+	int c;
+	struct replace_all_data replace_all_data;
+	struct filter_lines_data filter_lines_data;
+	struct pipe_lines_data pipe_lines_data;
+	struct go_to_data go_to_data;
+	char search[PROMPT_ANSWER_SIZE];
+	char replacement[PROMPT_ANSWER_SIZE];
+	char command[PROMPT_ANSWER_SIZE];
+	char position[PROMPT_ANSWER_SIZE];
+
+	struct latency_samples latencies;
+};
+
+static int start_frontend(struct editor_options *options, struct frontend *f)
+{
+	if (options->trace_path != NULL)
+		trace_enable();
+
+	struct display_object display_class;
+	int nlines, ncols;
+	int retval = start_terminal(options, &f->vt_screen, &display_class, &nlines, &ncols);
+	if (retval < 0) {
+		printf("Critical error taking over the terminal: %s\n", strerror(-retval));
+		return retval;
+	}
+
+	f->upper_bar = display_class;
+	f->buffer_display = display_class;
+	if ((retval = f->upper_bar.init(&f->upper_bar, 1, ncols, 0, 0)) < 0 ||
+		(retval = f->buffer_display.init(&f->buffer_display, nlines - 1, ncols, 1, 0)) < 0) {
+		stop_terminal(options, &f->vt_screen);
+		printf("Critical error creating the displays: %s\n", strerror(-retval));
+		return retval;
+	}
+
+	f->show_stats = 0;
+	f->message[0] = '\0';
+	memset(&f->latencies, 0, sizeof(f->latencies));
+	draw_upper_bar(&f->upper_bar, f->show_stats, f->message);
+
+	return 0;
+}
+
+static void stop_frontend(struct editor_options *options, struct frontend *f)
+{
+	f->buffer_display.uninit(&f->buffer_display);
+	f->upper_bar.uninit(&f->upper_bar);
+	stop_terminal(options, &f->vt_screen);
+}
+
+// once the terminal is given back
+static void write_reports(struct editor_options *options, struct frontend *f)
+{
+	if (options->trace_path != NULL) {
+		int retval = trace_dump(options->trace_path);
+		if (retval < 0)
+			printf("Couldn't write trace to %s: %s\n", options->trace_path,
+				strerror(-retval));
+	}
+	if (options->latency_report_path != NULL) {
+		int retval = write_latency_report(options->latency_report_path, &f->latencies);
+		if (retval < 0)
+			printf("Couldn't write latency report to %s: %s\n",
+				options->latency_report_path, strerror(-retval));
+	}
+	free(f->latencies.ns);
+}
+
+// Turns key c into an event (EVENT_VOID if the key doesn't make one).
+// Returns 1 if the user wants to leave
+static int key_to_event(struct frontend *f, int c, struct event *event)
+{
+	event->event_type = EVENT_VOID;
+	event->additional_data = NULL;
+	// TODO: Use jump table here
+	switch (c) {
+		case DISPLAY_NO_KEY:
+			event->event_type = EVENT_TICK;
+		break;
+		case ctrl('x'):
+			return 1;
+		case meta('d'):
+		case meta('D'):
+			f->show_stats = !f->show_stats;
+			draw_upper_bar(&f->upper_bar, f->show_stats, f->message);
+		break;
+		case ctrl('s'):
+			event->event_type = EVENT_SAVE_BUFFER;
+		break;
+		case KEY_UP:
+			event->event_type = EVENT_MOVE_CURSOR_UP;
+		break;
+		case KEY_DOWN:
+			event->event_type = EVENT_MOVE_CURSOR_DOWN;
+		break;
+		case KEY_LEFT:
+			event->event_type = EVENT_MOVE_CURSOR_LEFT;
+		break;
+		case KEY_RIGHT:
+			event->event_type = EVENT_MOVE_CURSOR_RIGHT;
+		break;
+		case KEY_BACKSPACE:
+		case KEY_DC:
+			event->event_type = EVENT_DELETE_KEY_ENTERED;
+		break;
+		case meta('a'):
+		case meta('A'):
+		case ctrl('^'):
+			event->event_type = EVENT_TOGGLE_MARK;
+		break;
+		case ctrl('k'):
+			event->event_type = EVENT_CUT;
+		break;
+		case meta('6'):
+			event->event_type = EVENT_COPY;
+		break;
+		case ctrl('u'):
+			event->event_type = EVENT_PASTE;
+		break;
+		case meta('n'):
+		case meta('N'):
+			event->event_type = EVENT_ADD_CURSOR_NEXT_MATCH;
+		break;
+		case meta('c'):
+		case meta('C'):
+			event->event_type = EVENT_ADD_CURSOR_BELOW;
+		break;
+		case meta('q'):
+		case meta('Q'):
+			event->event_type = EVENT_REMOVE_EXTRA_CURSORS;
+		break;
+		case meta('u'):
+		case meta('U'):
+			event->event_type = EVENT_UNDO;
+		break;
+		case meta('e'):
+		case meta('E'):
+			event->event_type = EVENT_REDO;
+		break;
+		case ctrl('\\'):
+			if (prompt(&f->upper_bar, "Search (to replace): ", f->search, sizeof(f->search)) == 0 &&
+				prompt(&f->upper_bar, "Replace with: ", f->replacement,
+					sizeof(f->replacement)) == 0) {
+				f->replace_all_data.search = f->search;
+				f->replace_all_data.replacement = f->replacement;
+				event->event_type = EVENT_REPLACE_ALL;
+				event->additional_data = (void *)&f->replace_all_data;
+			}
+			draw_upper_bar(&f->upper_bar, f->show_stats, f->message);
+		break;
+		case meta('s'):
+		case meta('S'):
+			event->event_type = EVENT_SORT_LINES;
+		break;
+		case meta('i'):
+		case meta('I'):
+			event->event_type = EVENT_UNIQUE_LINES;
+		break;
+		// like grep and grep -v
+		case meta('f'):
+		case meta('F'):
+		case meta('v'):
+		case meta('V'):
+			f->filter_lines_data.keep = (c == meta('f') || c == meta('F'));
+			if (prompt(&f->upper_bar, f->filter_lines_data.keep ? "Keep lines containing: " :
+				"Drop lines containing: ", f->search, sizeof(f->search)) == 0) {
+				f->filter_lines_data.pattern = f->search;
+				event->event_type = EVENT_FILTER_LINES;
+				event->additional_data = (void *)&f->filter_lines_data;
+			}
+			draw_upper_bar(&f->upper_bar, f->show_stats, f->message);
+		break;
+		// like GNU nano's "Execute Command" with a '|'
+		case ctrl('t'):
+			if (prompt(&f->upper_bar, "Pipe lines through: ", f->command,
+				sizeof(f->command)) == 0) {
+				f->pipe_lines_data.command = f->command;
+				event->event_type = EVENT_PIPE_LINES;
+				event->additional_data = (void *)&f->pipe_lines_data;
+			}
+			draw_upper_bar(&f->upper_bar, f->show_stats, f->message);
+		break;
+		case ctrl('c'):
+			event->event_type = EVENT_CANCEL_JOB;
+		break;
+		case meta('g'):
+		case meta('G'):
+		case ctrl('_'):
+			if (prompt(&f->upper_bar, "Go to line/offset: ", f->position,
+				sizeof(f->position)) == 0) {
+				f->go_to_data.position = f->position;
+				event->event_type = EVENT_GO_TO;
+				event->additional_data = (void *)&f->go_to_data;
+			}
+			draw_upper_bar(&f->upper_bar, f->show_stats, f->message);
+		break;
+		case meta('t'):
+		case meta('T'):
+			event->event_type = EVENT_TOGGLE_COLUMNS;
+		break;
+		default:
+			// TODO: Constants for this
+			if (0 <= c && c <= 255) {
+				f->c = c;
+				event->event_type = EVENT_CHARACTER_ENTERED;
+				event->additional_data = (void *)&f->c;
+			}
+	}
+
+	return 0;
+}
+
+// new_message can be NULL (no message)
+static void show_message(struct frontend *f, const char *new_message)
+{
+	// messages last until the next event
+	if (new_message == NULL)
+		new_message = "";
+	if (f->show_stats || strcmp(new_message, f->message) != 0) {
+		snprintf(f->message, sizeof(f->message), "%s", new_message);
+		draw_upper_bar(&f->upper_bar, f->show_stats, f->message);
+	}
+}
+
+// start_ns to handled_ns is handling the event, handled_ns to end_ns is
+// drawing its result
+static void account_event(struct editor_options *options, struct frontend *f,
+	unsigned int event_type, int c, uint64_t key_arrival_ns,
+	uint64_t start_ns, uint64_t handled_ns, uint64_t end_ns)
+{
+	if (event_type == EVENT_TICK) {
+		editor_stats.n_ticks++;
+		return;
+	}
+	latency_histogram_add(&editor_stats.event_latency[event_type], handled_ns - start_ns);
+	latency_histogram_add(&editor_stats.refresh_latency, end_ns - handled_ns);
+	trace_record(stats_event_name(event_type), "event", start_ns, handled_ns);
+	trace_record("refresh", "render", handled_ns, end_ns);
+	// the frame (bar included) has been flushed to the terminal by now
+	if (options->latency_report_path != NULL && c != DISPLAY_NO_KEY)
+		latency_samples_add(&f->latencies, end_ns - key_arrival_ns);
+}
+
+struct editor_object editor_class_for(const char *path, struct editor_options *options)
+{
+	if (options->hex_view || hex_editor_file_is_binary(path))
+		return hex_editor_object;
+
+	return single_buffer_editor_object;
+}
+
+void run_editor(char *path, struct editor_options *options)
+{
+	struct frontend f;
+	if (start_frontend(options, &f) < 0)
+		return;
+
+	struct editor_object editor = editor_class_for(path, options);
+	if (options->line_cache_budget > 0)
+		single_buffer_editor_set_line_cache_budget(options->line_cache_budget);
+	int retval = editor.init(&editor, path, &f.buffer_display);
 	if (retval < 0) {
-		endwin();
+		stop_frontend(options, &f);
 		printf("Critical error at editor.init(): %s\n", strerror(-retval));
 		return;
 	}
 	struct event reusable_event;
 	struct result reusable_result;
-	int exit = 0;
+	char job_running = 0;
 	editor.refresh_(&editor);
-	// TODO: Use jump table here
-	while (!exit) {
-		reusable_event.event_type = EVENT_VOID;
-		int c = wgetch(upper_bar_window);
-		switch (c) {
-			case ctrl('x'):
-				exit = 1;
-			break;
-			case ctrl('s'):
-				reusable_event.event_type = EVENT_SAVE_BUFFER;
-			break;
-			case KEY_UP:
-				reusable_event.event_type = EVENT_MOVE_CURSOR_UP;
-			break;
-			case KEY_DOWN:
-				reusable_event.event_type = EVENT_MOVE_CURSOR_DOWN;
-			break;
-			case KEY_LEFT:
-				reusable_event.event_type = EVENT_MOVE_CURSOR_LEFT;
-			break;
-			case KEY_RIGHT:
-				reusable_event.event_type = EVENT_MOVE_CURSOR_RIGHT;
+	for (;;) {
+		uint64_t key_arrival_ns;
+		int c = read_key(&f.buffer_display, job_running ? BACKGROUND_JOB_TICK : -1,
+			&key_arrival_ns);
+		if (key_to_event(&f, c, &reusable_event))
 			break;
-			case KEY_BACKSPACE:
-			case KEY_DC:
-				reusable_event.event_type = EVENT_DELETE_KEY_ENTERED;
+
+		unsigned int event_type = reusable_event.event_type;
+		uint64_t start_ns = stats_now_ns();
+		editor.handle_event(&editor, &reusable_event, &reusable_result);
+		uint64_t handled_ns = stats_now_ns();
+		job_running = (reusable_result.result_type == BACKGROUND_JOB_RUNNING);
+		show_message(&f, (const char *)reusable_result.additional_data);
+		// refresh_() only returns once the frame has been flushed
+		editor.refresh_(&editor);
+		account_event(options, &f, event_type, c, key_arrival_ns, start_ns, handled_ns,
+			stats_now_ns());
+	}
+	editor.uninit(&editor);
+	stop_frontend(options, &f);
+	write_reports(options, &f);
+}
+
+// Draws a REMOTE_FRAME. Returns 1 if it's the answer to our last event, 0
+// if it isn't, -EPROTO if the frame makes no sense
+static int draw_frame(struct frontend *f, struct remote_buffer *message)
+{
+	struct remote_frame frame;
+	const void *p = remote_buffer_take(message, sizeof(frame));
+	if (p == NULL)
+		return -EPROTO;
+	memcpy(&frame, p, sizeof(frame));
+
+	char frame_message[sizeof(f->message)];
+	const char *text = remote_buffer_take(message, frame.message_length);
+	if (text == NULL)
+		return -EPROTO;
+	snprintf(frame_message, sizeof(frame_message), "%.*s", (int)frame.message_length, text);
+
+	struct display_object *display = &f->buffer_display;
+	for (uint32_t i = 0; i < frame.n_runs; i++) {
+		struct remote_run run;
+		if ((p = remote_buffer_take(message, sizeof(run))) == NULL)
+			return -EPROTO;
+		memcpy(&run, p, sizeof(run));
+		const char *str = remote_buffer_take(message, run.n);
+		if (str == NULL)
+			return -EPROTO;
+		// the display cuts what doesn't fit, if our terminal is smaller
+		// than the one the buffer was opened with
+		display->put_str(display, run.y, run.x, str, run.n, run.attributes);
+	}
+	display->show_cursor(display, frame.cursor_visible);
+	if (frame.cursor_visible)
+		display->move_cursor(display, frame.cursor_y, frame.cursor_x);
+
+	show_message(f, frame_message);
+	display->flush(display);
+
+	return frame.is_reply;
+}
+
+// draws the frames the server sends until the answer to our last event
+// arrives
+static int wait_for_reply(int fd, struct frontend *f, struct remote_buffer *message)
+{
+	for (;;) {
+		uint32_t type;
+		int ret = remote_buffer_receive(fd, message, &type);
+		if (ret < 0)
+			return ret;
+		if (type != REMOTE_FRAME)
+			return -EPROTO;
+
+		ret = draw_frame(f, message);
+		if (ret != 0)
+			return ret;
+	}
+}
+
+void run_client(char *path, const char *socket_path, struct editor_options *options)
+{
+	// the server could be somewhere else
+	char absolute_path[PATH_MAX];
+	if (realpath(path, absolute_path) == NULL) {
+		printf("Couldn't open %s: %s\n", path, strerror(errno));
+		return;
+	}
+	int fd = remote_connect(socket_path);
+	if (fd < 0) {
+		printf("Couldn't connect to the server at %s: %s\n", socket_path, strerror(-fd));
+		return;
+	}
+
+	struct frontend f;
+	if (start_frontend(options, &f) < 0) {
+		close(fd);
+		return;
+	}
+
+	struct remote_buffer message = {0};
+	struct remote_attach attach = {
+		.version = REMOTE_PROTOCOL_VERSION,
+		.nlines = f.buffer_display.nlines,
+		.ncols = f.buffer_display.ncols
+	};
+	remote_buffer_start(&message, REMOTE_ATTACH);
+	remote_buffer_append(&message, &attach, sizeof(attach));
+	remote_buffer_append(&message, absolute_path, strlen(absolute_path) + 1);
+	int retval = remote_buffer_send(fd, &message);
+	if (retval == 0)
+		retval = wait_for_reply(fd, &f, &message);
+
+	struct event reusable_event;
+	struct pollfd fds[2] = {
+		{ .fd = STDIN_FILENO, .events = POLLIN },
+		{ .fd = fd, .events = POLLIN }
+	};
+	int exit = 0;
+	while (retval >= 0 && !exit) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			retval = -errno;
 			break;
-			default:
-				// TODO: Constants for this
-				if (0 <= c && c <= 255) {
-					reusable_event.event_type = EVENT_CHARACTER_ENTERED;
-					reusable_event.additional_data = (void *)&c;
-				}
 		}
-		if (!exit) {
-			editor.handle_event(&editor, &reusable_event, &reusable_result);
-			editor.refresh_(&editor);
+
+		// someone else changed the buffer
+		if (fds[1].revents != 0) {
+			uint32_t type;
+			retval = remote_buffer_receive(fd, &message, &type);
+			if (retval == 0)
+				retval = (type == REMOTE_FRAME) ? draw_frame(&f, &message) : -EPROTO;
+			continue;
+		}
+		if (fds[0].revents == 0)
+			continue;
+
+		// all the keys that arrived, the display might have read some
+		// of them already
+		for (;;) {
+			uint64_t key_arrival_ns;
+			int c = read_key(&f.buffer_display, 0, &key_arrival_ns);
+			if (c == DISPLAY_NO_KEY)
+				break;
+			if ((exit = key_to_event(&f, c, &reusable_event)))
+				break;
+			// the server ticks its own jobs
+			if (reusable_event.event_type == EVENT_VOID ||
+				reusable_event.event_type == EVENT_TICK)
+				continue;
+
+			unsigned int event_type = reusable_event.event_type;
+			uint64_t start_ns = stats_now_ns();
+			remote_buffer_start(&message, REMOTE_EVENT);
+			remote_put_event(&message, &reusable_event);
+			retval = remote_buffer_send(fd, &message);
+			if (retval == 0)
+				retval = wait_for_reply(fd, &f, &message);
+			if (retval < 0)
+				break;
+			// there's no telling handling from drawing apart from here,
+			// the whole round trip goes to the event
+			uint64_t end_ns = stats_now_ns();
+			account_event(options, &f, event_type, c, key_arrival_ns, start_ns, end_ns,
+				end_ns);
 		}
 	}
-	editor.uninit(&editor);
-	endwin();
+	stop_frontend(options, &f);
+	close(fd);
+	remote_buffer_free(&message);
+	if (retval < 0)
+		printf("Lost the connection to the server: %s%s%s\n", strerror(-retval),
+			(f.message[0] != '\0') ? ". Last message: " : "", f.message);
+	write_reports(options, &f);
 }
@@ -17,6 +17,39 @@
 #ifndef ENANO_EDITOR_H
 #define ENANO_EDITOR_H
 
-void run_editor(char *path);
+#include <stddef.h>
+
+#include <common/interface.h>
+
+// how often (ms) we check on the backend while it has a job running
+#define BACKGROUND_JOB_TICK 50
+
+enum {
+	// draw through ncurses
+	RENDERER_NCURSES=0,
+	// draw with our own diffing renderer (frontend/vt_display.c)
+	RENDERER_VT
+};
+
+struct editor_options {
+	// if not NULL, a Chrome trace of the session is written here on exit
+	const char *trace_path;
+	// if not NULL, keystroke-to-screen latencies are measured and
+	// their p50/p99/max written here on exit
+	const char *latency_report_path;
+	unsigned int renderer;
+	// memory for the lines loaded from the file, 0 for the default
+	size_t line_cache_budget;
+	// open every file in the hex view, not just the binary ones
+	char hex_view;
+};
+
+// the backend for the file at path
+struct editor_object editor_class_for(const char *path, struct editor_options *options);
+
+void run_editor(char *path, struct editor_options *options);
+// same, but the buffer lives in an editor server (see frontend/server.h)
+// listening on socket_path
+void run_client(char *path, const char *socket_path, struct editor_options *options);
 
 #endif /* ENANO_EDITOR_H */
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <curses.h>
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <frontend/ncurses_display.h>
+
+// every display is a ncurses window
+struct ncurses_display_data {
+	WINDOW *window;
+	struct ncurses_display_data *next;
+};
+
+// all the windows we have to push to the terminal on flush()
+static struct ncurses_display_data *displays = NULL;
+// the window holding the cursor has to be the last one we push
+static struct ncurses_display_data *cursor_display = NULL;
+
+void ncurses_screen_init(int *nlines, int *ncols)
+{
+	initscr();
+	// raw() allows to use certain combinations like Control+S which
+	// otherwise would raise a signal. No cbreak() after it, it turns
+	// signals back on (and Control+\ would quit)
+	raw();
+	start_color();
+	noecho();
+	init_pair(1, COLOR_BLACK, COLOR_WHITE);
+	// we read keys from stdscr, which we never draw on. Push it now so
+	// wgetch() doesn't find it modified and refresh it over our windows
+	wnoutrefresh(stdscr);
+	// for capturing special keys in wgetch()
+	keypad(stdscr, TRUE);
+
+	*nlines = LINES;
+	*ncols = COLS;
+}
+
+void ncurses_screen_uninit(void)
+{
+	endwin();
+}
+
+static int ncurses_display_init(struct display_object *self, int nlines, int ncols, int y, int x)
+{
+	struct ncurses_display_data *p =
+		(struct ncurses_display_data *)malloc(sizeof(struct ncurses_display_data));
+	if (p == NULL)
+		return -errno;
+
+	p->window = newwin(nlines, ncols, y, x);
+	if (!p->window) {
+		free(p);
+		return -EFAULT;
+	}
+	// the cursor is left alone unless move_cursor() is called
+	leaveok(p->window, TRUE);
+
+	p->next = displays;
+	displays = p;
+
+	self->data = (void *)p;
+	self->nlines = nlines;
+	self->ncols = ncols;
+
+	return 0;
+}
+
+static void ncurses_display_uninit(struct display_object *self)
+{
+	struct ncurses_display_data *p = (struct ncurses_display_data *)self->data;
+
+	struct ncurses_display_data **it = &displays;
+	while (*it != p)
+		it = &(*it)->next;
+	*it = p->next;
+	if (cursor_display == p)
+		cursor_display = NULL;
+
+	delwin(p->window);
+	free(p);
+}
+
+static void ncurses_display_clear(struct display_object *self)
+{
+	struct ncurses_display_data *p = (struct ncurses_display_data *)self->data;
+	// werase() instead of wclear(): we don't want to repaint the whole
+	// terminal, just to let ncurses find out what changed
+	werase(p->window);
+}
+
+static void ncurses_display_clear_line(struct display_object *self, int y, int x)
+{
+	struct ncurses_display_data *p = (struct ncurses_display_data *)self->data;
+	wmove(p->window, y, x);
+	wclrtoeol(p->window);
+}
+
+static void ncurses_display_put_str
+(struct display_object *self, int y, int x, const char *str, int n, int attributes)
+{
+	struct ncurses_display_data *p = (struct ncurses_display_data *)self->data;
+	if (n <= 0)
+		return;
+
+	int ncurses_attributes = 0;
+	if (attributes & DISPLAY_ATTRIBUTE_BOLD)
+		ncurses_attributes |= A_BOLD;
+	if (attributes & DISPLAY_ATTRIBUTE_REVERSE)
+		ncurses_attributes |= COLOR_PAIR(1);
+
+	wattron(p->window, ncurses_attributes);
+	mvwaddnstr(p->window, y, x, str, n);
+	wattroff(p->window, ncurses_attributes);
+}
+
+static void ncurses_display_move_cursor(struct display_object *self, int y, int x)
+{
+	struct ncurses_display_data *p = (struct ncurses_display_data *)self->data;
+	leaveok(p->window, FALSE);
+	wmove(p->window, y, x);
+	cursor_display = p;
+}
+
+static void ncurses_display_show_cursor(struct display_object *self, int show)
+{
+	curs_set(show ? 1 : 0);
+}
+
+static void ncurses_display_flush(struct display_object *self)
+{
+	for (struct ncurses_display_data *it = displays; it != NULL; it = it->next)
+		if (it != cursor_display)
+			wnoutrefresh(it->window);
+
+	if (cursor_display != NULL)
+		wnoutrefresh(cursor_display->window);
+
+	doupdate();
+}
+
+static int ncurses_display_get_key(struct display_object *self, int timeout_ms)
+{
+	wtimeout(stdscr, timeout_ms);
+	int c = wgetch(stdscr);
+
+	return (c == ERR) ? DISPLAY_NO_KEY : c;
+}
+
+struct display_object ncurses_display_object = {
+	.data = NULL,
+	.screen = NULL,
+	.init = ncurses_display_init,
+	.uninit = ncurses_display_uninit,
+	.clear = ncurses_display_clear,
+	.clear_line = ncurses_display_clear_line,
+	.put_str = ncurses_display_put_str,
+	.move_cursor = ncurses_display_move_cursor,
+	.show_cursor = ncurses_display_show_cursor,
+	.flush = ncurses_display_flush,
+	.get_key = ncurses_display_get_key
+};
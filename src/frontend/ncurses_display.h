@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_NCURSES_DISPLAY_H
+#define ENANO_NCURSES_DISPLAY_H
+
+#include <common/display.h>
+
+// ncurses only handles one screen (the terminal), so .screen is unused
+extern struct display_object ncurses_display_object;
+
+// take over and give back the terminal
+void ncurses_screen_init(int *nlines, int *ncols);
+void ncurses_screen_uninit(void);
+
+#endif /* ENANO_NCURSES_DISPLAY_H */
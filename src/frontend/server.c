@@ -0,0 +1,523 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// for accept4()
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <backend/single_buffer_editor.h>
+#include <common/interface.h>
+#include <common/remote.h>
+#include <common/stats.h>
+#include <frontend/server.h>
+#include <frontend/vt_display.h>
+
+// cells that didn't change can go in a run, if a new run would take more
+#define MAX_UNCHANGED_IN_RUN (sizeof(struct remote_run))
+
+// A buffer is drawn on a screen no terminal sees, the clients get what
+// changed on it
+struct server_buffer {
+	char *path;
+	struct editor_object editor;
+	struct vt_screen screen;
+	struct display_object display;
+	char job_running;
+	// the one of the last event
+	char message[128];
+	struct server_buffer *next;
+};
+
+struct server_client {
+	int fd;
+	// NULL until it attaches
+	struct server_buffer *buffer;
+	// the cells the client shows, frames are what changed since
+	struct vt_cell *shown;
+	// Its socket doesn't block. input has what we received of its next
+	// messages, output the frame it still has to get (output.read bytes
+	// of it went already)
+	struct remote_buffer input;
+	struct remote_buffer output;
+	// the buffer changed since the frame in output. The next frame waits
+	// until that one is sent, by then it has all the changes
+	char frame_pending;
+	char reply_pending;
+	// we lost it, it goes away once we're done with everyone
+	char gone;
+	struct server_client *next;
+};
+
+struct server {
+	int listen_fd;
+	struct server_buffer *buffers;
+	struct server_client *clients;
+	size_t n_clients;
+	// the message received last
+	struct remote_buffer message;
+	uint64_t next_tick_ns;
+	// the ones we were started with
+	struct editor_options *options;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signal_number)
+{
+	stop_requested = 1;
+}
+
+// Auxiliary functions go here
+
+static int same_cell(const struct vt_cell *a, const struct vt_cell *b)
+{
+	return memcmp(a->c, b->c, VT_CELL_BYTES) == 0 && a->attributes == b->attributes;
+}
+
+static void free_buffer(struct server_buffer *buffer)
+{
+	buffer->editor.uninit(&buffer->editor);
+	buffer->display.uninit(&buffer->display);
+	vt_screen_uninit(&buffer->screen);
+	free(buffer->path);
+	free(buffer);
+}
+
+// Finds the buffer of path, or loads it with a display of nlines x ncols.
+// Returns NULL (and sets *error) if it can't be loaded
+static struct server_buffer *open_buffer(struct server *server, const char *path,
+	int nlines, int ncols, int *error)
+{
+	for (struct server_buffer *it = server->buffers; it != NULL; it = it->next)
+		if (strcmp(it->path, path) == 0)
+			return it;
+
+	struct server_buffer *buffer = (struct server_buffer *)malloc(sizeof(struct server_buffer));
+	if (buffer == NULL || (buffer->path = strdup(path)) == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+
+	*error = vt_screen_init(&buffer->screen, -1, -1, nlines, ncols);
+	if (*error < 0) {
+		free(buffer->path);
+		free(buffer);
+		return NULL;
+	}
+	buffer->display = vt_display_object;
+	buffer->display.screen = (void *)&buffer->screen;
+	if ((*error = buffer->display.init(&buffer->display, nlines, ncols, 0, 0)) < 0) {
+		vt_screen_uninit(&buffer->screen);
+		free(buffer->path);
+		free(buffer);
+		return NULL;
+	}
+	buffer->editor = editor_class_for(path, server->options);
+	if ((*error = buffer->editor.init(&buffer->editor, path, &buffer->display)) < 0) {
+		buffer->display.uninit(&buffer->display);
+		vt_screen_uninit(&buffer->screen);
+		free(buffer->path);
+		free(buffer);
+		return NULL;
+	}
+	buffer->editor.refresh_(&buffer->editor);
+	buffer->job_running = 0;
+	buffer->message[0] = '\0';
+
+	buffer->next = server->buffers;
+	server->buffers = buffer;
+	return buffer;
+}
+
+// Builds the frame for client: the cells of its buffer that changed since
+// the last one, in runs with the same attributes
+static void put_frame(struct server_client *client, struct remote_buffer *message,
+	uint8_t is_reply, const char *text)
+{
+	struct vt_screen *screen = &client->buffer->screen;
+	struct remote_frame frame = {
+		.is_reply = is_reply,
+		.cursor_visible = screen->cursor_visible,
+		.cursor_y = screen->cursor_y,
+		.cursor_x = screen->cursor_x,
+		.message_length = strlen(text),
+		.n_runs = 0
+	};
+	remote_buffer_start(message, REMOTE_FRAME);
+	size_t frame_offset = message->length;
+	remote_buffer_append(message, &frame, sizeof(frame));
+	remote_buffer_append(message, text, frame.message_length);
+
+	for (int y = 0; y < screen->nlines; y++) {
+		struct vt_cell *back = &screen->back[y * screen->ncols];
+		struct vt_cell *shown = &client->shown[y * screen->ncols];
+		for (int x = 0; x < screen->ncols;) {
+			if (same_cell(&back[x], &shown[x])) {
+				x++;
+				continue;
+			}
+
+			int last_changed = x;
+			for (int end = x + 1; end < screen->ncols &&
+				back[end].attributes == back[x].attributes &&
+				end - last_changed <= MAX_UNCHANGED_IN_RUN; end++)
+				if (!same_cell(&back[end], &shown[end]))
+					last_changed = end;
+
+			struct remote_run run = {
+				.y = y,
+				.x = x,
+				.n = 0,
+				.attributes = back[x].attributes
+			};
+			for (int i = x; i <= last_changed; i++)
+				run.n += vt_cell_length(&back[i]);
+			remote_buffer_append(message, &run, sizeof(run));
+			for (int i = x; i <= last_changed; i++) {
+				remote_buffer_append(message, back[i].c, vt_cell_length(&back[i]));
+				shown[i] = back[i];
+			}
+			frame.n_runs++;
+			x = last_changed + 1;
+		}
+	}
+
+	memcpy(&message->data[frame_offset], &frame, sizeof(frame));
+}
+
+// Sends what the socket of client takes. Once the frame in output is gone,
+// the next one (if there's one pending) takes its place
+static void flush_client(struct server_client *client)
+{
+	for (;;) {
+		if (client->output.read == client->output.length) {
+			if (!client->frame_pending)
+				return;
+			put_frame(client, &client->output, client->reply_pending,
+				client->buffer->message);
+			client->frame_pending = 0;
+			client->reply_pending = 0;
+		}
+
+		int ret = remote_buffer_send_some(client->fd, &client->output);
+		if (ret < 0)
+			client->gone = 1;
+		if (ret <= 0)
+			return;
+	}
+}
+
+// Sends the new frame of buffer to its clients, sender (if any) gets it as
+// the answer to its event. Clients not done with the last one get it later
+static void send_frames(struct server *server, struct server_buffer *buffer,
+	struct server_client *sender)
+{
+	for (struct server_client *it = server->clients; it != NULL; it = it->next) {
+		if (it->buffer != buffer || it->gone)
+			continue;
+
+		it->frame_pending = 1;
+		it->reply_pending |= (it == sender);
+		flush_client(it);
+	}
+}
+
+static void handle_buffer_event(struct server *server, struct server_buffer *buffer,
+	struct event *event, struct server_client *sender)
+{
+	struct result result;
+	uint64_t start_ns = stats_now_ns();
+	buffer->editor.handle_event(&buffer->editor, event, &result);
+	uint64_t handled_ns = stats_now_ns();
+	buffer->job_running = (result.result_type == BACKGROUND_JOB_RUNNING);
+	snprintf(buffer->message, sizeof(buffer->message), "%s",
+		(result.additional_data != NULL) ? (const char *)result.additional_data : "");
+	buffer->editor.refresh_(&buffer->editor);
+	send_frames(server, buffer, sender);
+	uint64_t end_ns = stats_now_ns();
+
+	// see editor_stats.n_ticks
+	if (event->event_type == EVENT_TICK) {
+		editor_stats.n_ticks++;
+		return;
+	}
+	latency_histogram_add(&editor_stats.event_latency[event->event_type],
+		handled_ns - start_ns);
+	latency_histogram_add(&editor_stats.refresh_latency, end_ns - handled_ns);
+	trace_record(stats_event_name(event->event_type), "event", start_ns, handled_ns);
+	trace_record("refresh", "render", handled_ns, end_ns);
+}
+
+static int handle_attach(struct server *server, struct server_client *client)
+{
+	struct remote_attach attach;
+	const void *p = remote_buffer_take(&server->message, sizeof(attach));
+	if (p == NULL || client->buffer != NULL)
+		return -EPROTO;
+	memcpy(&attach, p, sizeof(attach));
+	size_t path_length = server->message.length - server->message.read;
+	const char *path = remote_buffer_take(&server->message, path_length);
+	if (attach.version != REMOTE_PROTOCOL_VERSION || path_length == 0 ||
+		path[path_length - 1] != '\0' || attach.nlines == 0 || attach.ncols == 0)
+		return -EPROTO;
+
+	uint64_t start_ns = stats_now_ns();
+	int error = 0;
+	struct server_buffer *buffer = open_buffer(server, path, attach.nlines, attach.ncols, &error);
+	if (buffer == NULL) {
+		// an empty frame, the client shows its message when we hang up.
+		// It's the first thing on the socket, so it fits
+		char text[128];
+		snprintf(text, sizeof(text), "Couldn't open %s: %s", path, strerror(-error));
+		struct remote_frame frame = { .is_reply = 1, .message_length = strlen(text) };
+		remote_buffer_start(&client->output, REMOTE_FRAME);
+		remote_buffer_append(&client->output, &frame, sizeof(frame));
+		remote_buffer_append(&client->output, text, frame.message_length);
+		remote_buffer_send_some(client->fd, &client->output);
+		return error;
+	}
+
+	struct vt_screen *screen = &buffer->screen;
+	client->shown = (struct vt_cell *)malloc(screen->nlines * screen->ncols * sizeof(struct vt_cell));
+	if (client->shown == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+	// a new terminal is blank
+	for (int i = 0; i < screen->nlines * screen->ncols; i++) {
+		memset(client->shown[i].c, '\0', VT_CELL_BYTES);
+		client->shown[i].c[0] = ' ';
+		client->shown[i].attributes = DISPLAY_ATTRIBUTE_NORMAL;
+	}
+	client->buffer = buffer;
+	client->frame_pending = 1;
+	client->reply_pending = 1;
+	flush_client(client);
+	trace_record("attach", "server", start_ns, stats_now_ns());
+
+	return 0;
+}
+
+// Returns 0 if the client is still with us
+static int handle_message(struct server *server, struct server_client *client, uint32_t type)
+{
+	switch (type) {
+		case REMOTE_ATTACH:
+			return handle_attach(server, client);
+		case REMOTE_EVENT: {
+			struct remote_event_data data;
+			if (client->buffer == NULL || remote_take_event(&server->message, &data) < 0)
+				return -EPROTO;
+			handle_buffer_event(server, client->buffer, &data.event, client);
+			return 0;
+		}
+	}
+
+	return -EPROTO;
+}
+
+// the messages that arrived whole. Returns 0 if the client is still with us
+static int handle_input(struct server *server, struct server_client *client)
+{
+	int ret = remote_buffer_receive_some(client->fd, &client->input);
+	if (ret < 0)
+		return ret;
+
+	uint32_t type;
+	while (!client->gone &&
+		(ret = remote_buffer_next_message(&client->input, &server->message, &type)) > 0)
+		if ((ret = handle_message(server, client, type)) < 0)
+			return ret;
+
+	return ret;
+}
+
+static void accept_client(struct server *server)
+{
+	int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd < 0)
+		return;
+
+	struct server_client *client = (struct server_client *)malloc(sizeof(struct server_client));
+	if (client == NULL) {
+		// TODO: Critical failure. Handle in another way
+		exit(1);
+	}
+	client->fd = fd;
+	client->buffer = NULL;
+	client->shown = NULL;
+	client->input = (struct remote_buffer){0};
+	client->output = (struct remote_buffer){0};
+	client->frame_pending = 0;
+	client->reply_pending = 0;
+	client->gone = 0;
+	client->next = server->clients;
+	server->clients = client;
+	server->n_clients++;
+}
+
+static void remove_gone_clients(struct server *server)
+{
+	struct server_client **it = &server->clients;
+	while (*it != NULL) {
+		struct server_client *client = *it;
+		if (!client->gone) {
+			it = &client->next;
+			continue;
+		}
+
+		*it = client->next;
+		close(client->fd);
+		free(client->shown);
+		remote_buffer_free(&client->input);
+		remote_buffer_free(&client->output);
+		free(client);
+		server->n_clients--;
+	}
+}
+
+// the buffers with a job running get their EVENT_TICK
+static void tick_buffers(struct server *server)
+{
+	struct event tick = { .event_type = EVENT_TICK, .additional_data = NULL };
+	for (struct server_buffer *it = server->buffers; it != NULL; it = it->next)
+		if (it->job_running)
+			handle_buffer_event(server, it, &tick, NULL);
+	server->next_tick_ns = stats_now_ns() + BACKGROUND_JOB_TICK * 1000000ull;
+}
+
+static int jobs_running(struct server *server)
+{
+	for (struct server_buffer *it = server->buffers; it != NULL; it = it->next)
+		if (it->job_running)
+			return 1;
+
+	return 0;
+}
+
+static void serve(struct server *server)
+{
+	struct pollfd *fds = NULL;
+	size_t fds_size = 0;
+	while (!stop_requested) {
+		if (fds_size < server->n_clients + 1) {
+			fds_size = (server->n_clients + 1) * 2;
+			fds = (struct pollfd *)realloc(fds, fds_size * sizeof(struct pollfd));
+			if (fds == NULL) {
+				// TODO: Critical failure. Handle in another way
+				exit(1);
+			}
+		}
+
+		size_t n_fds = 0;
+		fds[n_fds++] = (struct pollfd){ .fd = server->listen_fd, .events = POLLIN };
+		// clients with a frame on its way wait until they can take more
+		for (struct server_client *it = server->clients; it != NULL; it = it->next)
+			fds[n_fds++] = (struct pollfd){ .fd = it->fd, .events = POLLIN |
+				((it->output.read < it->output.length) ? POLLOUT : 0) };
+
+		int timeout_ms = -1;
+		if (jobs_running(server)) {
+			uint64_t now_ns = stats_now_ns();
+			timeout_ms = (server->next_tick_ns > now_ns) ?
+				(server->next_tick_ns - now_ns) / 1000000 : 0;
+		}
+		int ret = poll(fds, n_fds, timeout_ms);
+		if (ret < 0 && errno != EINTR)
+			break;
+
+		if (ret > 0) {
+			// the clients are in the same order as their fds
+			size_t i = 1;
+			for (struct server_client *it = server->clients; it != NULL && i < n_fds;
+				it = it->next, i++) {
+				if (it->gone)
+					continue;
+				if (fds[i].revents & POLLOUT)
+					flush_client(it);
+				if ((fds[i].revents & ~POLLOUT) != 0 && handle_input(server, it) < 0)
+					it->gone = 1;
+			}
+			if (fds[0].revents & POLLIN)
+				accept_client(server);
+		}
+		if (jobs_running(server) && stats_now_ns() >= server->next_tick_ns)
+			tick_buffers(server);
+
+		remove_gone_clients(server);
+	}
+	free(fds);
+}
+
+void run_server(const char *socket_path, struct editor_options *options)
+{
+	if (options->trace_path != NULL)
+		trace_enable();
+	if (options->line_cache_budget > 0)
+		single_buffer_editor_set_line_cache_budget(options->line_cache_budget);
+
+	struct server server = {
+		.buffers = NULL,
+		.clients = NULL,
+		.n_clients = 0,
+		.message = {0},
+		.next_tick_ns = 0,
+		.options = options
+	};
+	server.listen_fd = remote_listen(socket_path);
+	if (server.listen_fd < 0) {
+		printf("Couldn't listen on %s: %s\n", socket_path, strerror(-server.listen_fd));
+		return;
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = request_stop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGHUP, &action, NULL);
+
+	printf("Serving on %s\n", socket_path);
+	fflush(stdout);
+	serve(&server);
+
+	for (struct server_client *it = server.clients; it != NULL; it = it->next)
+		it->gone = 1;
+	remove_gone_clients(&server);
+	while (server.buffers != NULL) {
+		struct server_buffer *next = server.buffers->next;
+		free_buffer(server.buffers);
+		server.buffers = next;
+	}
+	close(server.listen_fd);
+	unlink(socket_path);
+	remote_buffer_free(&server.message);
+
+	if (options->trace_path != NULL) {
+		int retval = trace_dump(options->trace_path);
+		if (retval < 0)
+			printf("Couldn't write trace to %s: %s\n", options->trace_path,
+				strerror(-retval));
+	}
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_SERVER_H
+#define ENANO_SERVER_H
+
+#include <frontend/editor.h>
+
+/*
+ * An editor server keeps buffers loaded (and their indexes, caches, ...)
+ * for clients (see run_client() at frontend/editor.h) that attach to them
+ * over the Unix socket at socket_path. Clients send the events made of
+ * the keys of their terminal and get back the cells of the buffer display
+ * that changed. A buffer is opened by the first client asking for its
+ * file and stays loaded once they leave, attaching again only costs a
+ * frame. Clients of the same buffer share it, cursor included, and all of
+ * them see what any of them does.
+ *
+ * Runs until SIGINT, SIGTERM or SIGHUP.
+ */
+void run_server(const char *socket_path, struct editor_options *options);
+
+#endif /* ENANO_SERVER_H */
@@ -0,0 +1,736 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// we only need the KEY_* constants, get_key() must return the same codes
+// as the ncurses display does
+#include <curses.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <common/stats.h>
+#include <frontend/vt_display.h>
+
+#define SPACES_IN_A_TAB 8
+
+#define ESCAPE_KEY 27
+// how long (ms) we wait for the rest of an escape sequence
+#define ESCAPE_SEQUENCE_TIMEOUT 25
+// cursor moves of up to this many columns are done by rewriting the
+// characters already on the screen, when possible
+#define MAX_REWRITE_MOVE 4
+// we only scroll (part of) the terminal when it saves rewriting at least
+// this many rows
+#define MIN_SCROLL_GAIN 2
+
+// a region of a vt_screen
+struct vt_display_data {
+	struct vt_screen *screen;
+	int y;
+	int x;
+};
+
+static const struct vt_cell blank_cell = { { ' ' }, DISPLAY_ATTRIBUTE_NORMAL };
+
+// Auxiliary functions go here
+
+static int same_cell(const struct vt_cell *a, const struct vt_cell *b)
+{
+	return memcmp(a->c, b->c, VT_CELL_BYTES) == 0 && a->attributes == b->attributes;
+}
+
+// Returns the length of the UTF-8 sequence at str (n bytes at most),
+// or 0 if there isn't a valid one
+static int utf8_decode(const char *str, int n, uint32_t *code_point)
+{
+	static const uint32_t min_code_point[VT_CELL_BYTES + 1] = { 0, 0, 0x80, 0x800, 0x10000 };
+	unsigned char c = str[0];
+	int length;
+	if ((c & 0xe0) == 0xc0) {
+		length = 2;
+		*code_point = c & 0x1f;
+	}
+	else if ((c & 0xf0) == 0xe0) {
+		length = 3;
+		*code_point = c & 0x0f;
+	}
+	else if ((c & 0xf8) == 0xf0) {
+		length = 4;
+		*code_point = c & 0x07;
+	}
+	else
+		return 0;
+
+	if (length > n)
+		return 0;
+	for (int i = 1; i < length; i++) {
+		if (((unsigned char)str[i] & 0xc0) != 0x80)
+			return 0;
+		*code_point = (*code_point << 6) | (str[i] & 0x3f);
+	}
+	// overlong encodings, surrogates and what's past Unicode aren't valid
+	if (*code_point < min_code_point[length] || *code_point > 0x10ffff ||
+		(0xd800 <= *code_point && *code_point <= 0xdfff))
+		return 0;
+
+	return length;
+}
+
+// Whether the terminal draws the character in a single column. We have
+// to know where its cursor ends up, so the rest (C1 controls, combining
+// marks, wide characters, ...) are drawn as '?'. It's a rough list, not
+// the one of wcwidth()
+static int takes_one_column(uint32_t code_point)
+{
+	static const uint32_t other_widths[][2] = {
+		{ 0x80, 0x9f }, { 0x300, 0x36f }, { 0x200b, 0x200f }, { 0x2028, 0x202e },
+		{ 0x1100, 0x115f }, { 0x2e80, 0xa4cf }, { 0xac00, 0xd7a3 }, { 0xf900, 0xfaff },
+		{ 0xfe00, 0xfe0f }, { 0xfe30, 0xfe4f }, { 0xff00, 0xff60 }, { 0xffe0, 0xffe6 },
+		{ 0x1f300, 0x1faff }, { 0x20000, 0x10ffff }
+	};
+	for (size_t i = 0; i < sizeof(other_widths) / sizeof(other_widths[0]); i++)
+		if (other_widths[i][0] <= code_point && code_point <= other_widths[i][1])
+			return 0;
+
+	return 1;
+}
+
+static void fill_cells(struct vt_cell *cells, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		cells[i] = blank_cell;
+}
+
+static void out_append(struct vt_screen *screen, const char *str, size_t length)
+{
+	if (screen->out_length + length > screen->out_size) {
+		size_t new_size = screen->out_size * 2;
+		while (new_size < screen->out_length + length)
+			new_size *= 2;
+
+		char *new_out = realloc(screen->out, new_size);
+		if (new_out == NULL) {
+			// TODO: Critical failure. Handle in another way
+			exit(1);
+		}
+		screen->out = new_out;
+		screen->out_size = new_size;
+	}
+
+	memcpy(&screen->out[screen->out_length], str, length);
+	screen->out_length += length;
+}
+
+static void out_append_str(struct vt_screen *screen, const char *str)
+{
+	out_append(screen, str, strlen(str));
+}
+
+static int write_all(int fd, const char *buf, size_t length)
+{
+	while (length > 0) {
+		ssize_t written = write(fd, buf, length);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += written;
+		length -= written;
+	}
+
+	return 0;
+}
+
+static void set_attributes(struct vt_screen *screen, int attributes)
+{
+	if (screen->term_attributes == attributes)
+		return;
+
+	char sgr[16];
+	snprintf(sgr, sizeof(sgr), "\033[0%s%sm",
+		(attributes & DISPLAY_ATTRIBUTE_BOLD) ? ";1" : "",
+		(attributes & DISPLAY_ATTRIBUTE_REVERSE) ? ";30;47" : "");
+	out_append_str(screen, sgr);
+	screen->term_attributes = attributes;
+}
+
+// Moves the terminal cursor to (y, x) with the shortest sequence we know
+static void move_to(struct vt_screen *screen, int y, int x)
+{
+	if (screen->term_y == y && screen->term_x == x)
+		return;
+
+	char best[32];
+	if (y == 0 && x == 0)
+		snprintf(best, sizeof(best), "\033[H");
+	else
+		snprintf(best, sizeof(best), "\033[%d;%dH", y + 1, x + 1);
+
+	char candidate[MAX_REWRITE_MOVE * VT_CELL_BYTES + 16];
+	if (screen->term_y == y && screen->term_x >= 0) {
+		int dx = x - screen->term_x;
+		struct vt_cell *back = &screen->back[y * screen->ncols];
+		struct vt_cell *front = &screen->front[y * screen->ncols];
+
+		// rewriting what's already there moves the cursor too
+		char can_rewrite = 0 < dx && dx <= MAX_REWRITE_MOVE;
+		for (int i = screen->term_x; can_rewrite && i < x; i++)
+			can_rewrite = same_cell(&back[i], &front[i]) &&
+				front[i].attributes == screen->term_attributes;
+
+		if (can_rewrite) {
+			size_t length = 0;
+			for (int i = screen->term_x; i < x; i++) {
+				memcpy(&candidate[length], front[i].c, vt_cell_length(&front[i]));
+				length += vt_cell_length(&front[i]);
+			}
+			candidate[length] = '\0';
+		}
+		else if (dx > 0)
+			snprintf(candidate, sizeof(candidate), (dx == 1) ? "\033[C" : "\033[%dC", dx);
+		else if (x == 0)
+			snprintf(candidate, sizeof(candidate), "\r");
+		else if (dx >= -MAX_REWRITE_MOVE) {
+			for (int i = 0; i < -dx; i++)
+				candidate[i] = '\b';
+			candidate[-dx] = '\0';
+		}
+		else
+			snprintf(candidate, sizeof(candidate), "\033[%dD", -dx);
+
+		if (strlen(candidate) < strlen(best))
+			strcpy(best, candidate);
+	}
+	else if (screen->term_y >= 0 && y == screen->term_y + 1 && x == 0) {
+		// we're never on the last line here, so this can't scroll
+		strcpy(best, "\r\n");
+	}
+
+	out_append_str(screen, best);
+	screen->term_y = y;
+	screen->term_x = x;
+}
+
+static uint64_t hash_row(const struct vt_cell *row, int ncols)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for (int x = 0; x < ncols; x++) {
+		for (int i = 0; i < VT_CELL_BYTES; i++)
+			hash = (hash ^ (unsigned char)row[x].c[i]) * 1099511628211ull;
+		hash = (hash ^ row[x].attributes) * 1099511628211ull;
+	}
+
+	return hash;
+}
+
+static int same_row(struct vt_screen *screen, int back_y, int front_y)
+{
+	return screen->back_hashes[back_y] == screen->front_hashes[front_y] &&
+		memcmp(&screen->back[back_y * screen->ncols], &screen->front[front_y * screen->ncols],
+			screen->ncols * sizeof(struct vt_cell)) == 0;
+}
+
+// Inserting or removing a line moves everything under it, and scrolling
+// moves everything. Instead of rewriting all those rows we find the shift
+// that fixes most of them and ask the terminal to scroll that part of the
+// screen, the rest is left for the diff
+static void scroll_moved_rows(struct vt_screen *screen)
+{
+	int nlines = screen->nlines;
+	int ncols = screen->ncols;
+	for (int y = 0; y < nlines; y++) {
+		screen->back_hashes[y] = hash_row(&screen->back[y * ncols], ncols);
+		screen->front_hashes[y] = hash_row(&screen->front[y * ncols], ncols);
+	}
+
+	// the content of front row y + best_shift belongs in row y
+	int best_shift = 0;
+	int best_gain = MIN_SCROLL_GAIN - 1;
+	int top = 0, bottom = 0;
+	for (int shift = -nlines / 2; shift <= nlines / 2; shift++) {
+		if (shift == 0)
+			continue;
+
+		int gain = 0;
+		int shift_top = nlines, shift_bottom = -1;
+		for (int y = 0; y < nlines; y++) {
+			int from = y + shift;
+			if (from < 0 || from >= nlines || same_row(screen, y, y))
+				continue;
+
+			if (same_row(screen, y, from)) {
+				gain++;
+				int low = (y < from) ? y : from;
+				int high = (y < from) ? from : y;
+				shift_top = (low < shift_top) ? low : shift_top;
+				shift_bottom = (high > shift_bottom) ? high : shift_bottom;
+			}
+		}
+
+		if (gain > best_gain) {
+			best_gain = gain;
+			best_shift = shift;
+			top = shift_top;
+			bottom = shift_bottom;
+		}
+	}
+
+	if (best_shift == 0)
+		return;
+
+	char sequence[48];
+	int n = (best_shift > 0) ? best_shift : -best_shift;
+	// scroll up (S) moves the content up, scroll down (T) moves it down.
+	// Setting the scrolling region moves the cursor home
+	snprintf(sequence, sizeof(sequence), "\033[%d;%dr\033[%d%c\033[r",
+		top + 1, bottom + 1, n, (best_shift > 0) ? 'S' : 'T');
+	set_attributes(screen, DISPLAY_ATTRIBUTE_NORMAL);
+	out_append_str(screen, sequence);
+	screen->term_y = screen->term_x = 0;
+
+	// now do the same on our copy of the terminal
+	struct vt_cell *region = &screen->front[top * ncols];
+	int region_lines = bottom - top + 1;
+	if (best_shift > 0) {
+		memmove(region, &region[n * ncols], (region_lines - n) * ncols * sizeof(struct vt_cell));
+		fill_cells(&region[(region_lines - n) * ncols], n * ncols);
+	}
+	else {
+		memmove(&region[n * ncols], region, (region_lines - n) * ncols * sizeof(struct vt_cell));
+		fill_cells(region, n * ncols);
+	}
+}
+
+//---------------------------------------------------------------------------------------//
+
+// Key decoding
+
+// makes sure there are at least n bytes in screen->input, waiting at most
+// timeout_ms for each read. Returns 0 if they're there
+static int read_input(struct vt_screen *screen, size_t n, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = screen->input_fd, .events = POLLIN };
+	while (screen->input_length < n) {
+		int ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+
+		ssize_t n_read = read(screen->input_fd, &screen->input[screen->input_length],
+			sizeof(screen->input) - screen->input_length);
+		if (n_read <= 0)
+			return -1;
+
+		screen->input_length += n_read;
+	}
+
+	return 0;
+}
+
+static void consume_input(struct vt_screen *screen, size_t n)
+{
+	memmove(screen->input, &screen->input[n], screen->input_length - n);
+	screen->input_length -= n;
+}
+
+static int decode_escape_sequence(unsigned char final, int parameter)
+{
+	switch (final) {
+		case 'A':
+			return KEY_UP;
+		case 'B':
+			return KEY_DOWN;
+		case 'C':
+			return KEY_RIGHT;
+		case 'D':
+			return KEY_LEFT;
+		case 'H':
+			return KEY_HOME;
+		case 'F':
+			return KEY_END;
+		case 'P':
+		case 'Q':
+		case 'R':
+		case 'S':
+			return KEY_F(final - 'P' + 1);
+		case '~':
+			switch (parameter) {
+				case 1:
+				case 7:
+					return KEY_HOME;
+				case 2:
+					return KEY_IC;
+				case 3:
+					return KEY_DC;
+				case 4:
+				case 8:
+					return KEY_END;
+				case 5:
+					return KEY_PPAGE;
+				case 6:
+					return KEY_NPAGE;
+			}
+	}
+
+	return KEY_MAX;
+}
+
+// ESC [ <parameter> ; ... <final> or ESC O <final>, with input[0] == ESC
+static int read_escape_sequence(struct vt_screen *screen)
+{
+	if (read_input(screen, 2, ESCAPE_SEQUENCE_TIMEOUT) < 0 ||
+		(screen->input[1] != '[' && screen->input[1] != 'O')) {
+		// a lone ESC, or the first half of Alt+something
+		consume_input(screen, 1);
+		return ESCAPE_KEY;
+	}
+
+	int parameter = 0;
+	char first_parameter = 1;
+	for (size_t i = 2; ; i++) {
+		if (i == sizeof(screen->input) || read_input(screen, i + 1, ESCAPE_SEQUENCE_TIMEOUT) < 0) {
+			// garbage, drop it
+			consume_input(screen, screen->input_length);
+			return KEY_MAX;
+		}
+
+		unsigned char c = screen->input[i];
+		if ('0' <= c && c <= '9') {
+			if (first_parameter)
+				parameter = parameter * 10 + (c - '0');
+		}
+		else if (c == ';')
+			first_parameter = 0;
+		else {
+			consume_input(screen, i + 1);
+			return decode_escape_sequence(c, parameter);
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------//
+
+// Functions to manage screens
+
+int vt_screen_init(struct vt_screen *screen, int input_fd, int output_fd, int nlines, int ncols)
+{
+	screen->input_fd = input_fd;
+	screen->output_fd = output_fd;
+	screen->nlines = nlines;
+	screen->ncols = ncols;
+	screen->back = (struct vt_cell *)malloc(nlines * ncols * sizeof(struct vt_cell));
+	screen->front = (struct vt_cell *)malloc(nlines * ncols * sizeof(struct vt_cell));
+	screen->out_size = 4096;
+	screen->out = (char *)malloc(screen->out_size);
+	screen->back_hashes = (uint64_t *)malloc(nlines * sizeof(uint64_t));
+	screen->front_hashes = (uint64_t *)malloc(nlines * sizeof(uint64_t));
+	if (screen->back == NULL || screen->front == NULL || screen->out == NULL ||
+		screen->back_hashes == NULL || screen->front_hashes == NULL) {
+		vt_screen_uninit(screen);
+		return -ENOMEM;
+	}
+
+	fill_cells(screen->back, nlines * ncols);
+	fill_cells(screen->front, nlines * ncols);
+	screen->out_length = 0;
+	screen->cursor_y = 0;
+	screen->cursor_x = 0;
+	screen->cursor_visible = 1;
+	screen->front_is_stale = 1;
+	screen->term_y = -1;
+	screen->term_x = -1;
+	screen->term_attributes = -1;
+	screen->term_cursor_visible = -1;
+	screen->input_length = 0;
+	screen->raw_mode = 0;
+
+	return 0;
+}
+
+void vt_screen_uninit(struct vt_screen *screen)
+{
+	free(screen->back);
+	free(screen->front);
+	free(screen->out);
+	free(screen->back_hashes);
+	free(screen->front_hashes);
+}
+
+void vt_screen_render(struct vt_screen *screen)
+{
+	screen->out_length = 0;
+
+	if (screen->front_is_stale) {
+		screen->term_attributes = -1;
+		set_attributes(screen, DISPLAY_ATTRIBUTE_NORMAL);
+		out_append_str(screen, "\033[H\033[2J");
+		screen->term_y = 0;
+		screen->term_x = 0;
+		fill_cells(screen->front, screen->nlines * screen->ncols);
+		screen->front_is_stale = 0;
+	}
+	else
+		scroll_moved_rows(screen);
+
+	for (int y = 0; y < screen->nlines; y++) {
+		struct vt_cell *back = &screen->back[y * screen->ncols];
+		struct vt_cell *front = &screen->front[y * screen->ncols];
+
+		// everything after last_used is blank in the new frame
+		int last_used = screen->ncols - 1;
+		while (last_used >= 0 && same_cell(&back[last_used], &blank_cell))
+			last_used--;
+
+		for (int x = 0; x < screen->ncols; x++) {
+			if (same_cell(&back[x], &front[x]))
+				continue;
+
+			move_to(screen, y, x);
+			if (x > last_used) {
+				set_attributes(screen, DISPLAY_ATTRIBUTE_NORMAL);
+				out_append_str(screen, "\033[K");
+				fill_cells(&front[x], screen->ncols - x);
+				break;
+			}
+
+			set_attributes(screen, back[x].attributes);
+			out_append(screen, back[x].c, vt_cell_length(&back[x]));
+			front[x] = back[x];
+			screen->term_x++;
+			// the terminal might be waiting to wrap, don't trust it
+			if (screen->term_x == screen->ncols)
+				screen->term_y = screen->term_x = -1;
+		}
+	}
+
+	if (screen->cursor_visible)
+		move_to(screen, screen->cursor_y, screen->cursor_x);
+
+	if (screen->cursor_visible != screen->term_cursor_visible) {
+		out_append_str(screen, screen->cursor_visible ? "\033[?25h" : "\033[?25l");
+		screen->term_cursor_visible = screen->cursor_visible;
+	}
+
+	editor_stats.frames++;
+	editor_stats.frame_bytes += screen->out_length;
+	if (screen->out_length > editor_stats.max_frame_bytes)
+		editor_stats.max_frame_bytes = screen->out_length;
+}
+
+void vt_screen_flush(struct vt_screen *screen)
+{
+	vt_screen_render(screen);
+	if (screen->output_fd >= 0 && screen->out_length > 0)
+		write_all(screen->output_fd, screen->out, screen->out_length);
+}
+
+int vt_terminal_init(struct vt_screen *screen, int input_fd, int output_fd)
+{
+	struct winsize window_size;
+	if (ioctl(output_fd, TIOCGWINSZ, &window_size) < 0)
+		return -errno;
+
+	int ret = vt_screen_init(screen, input_fd, output_fd,
+		window_size.ws_row, window_size.ws_col);
+	if (ret < 0)
+		return ret;
+
+	if (tcgetattr(input_fd, &screen->saved_termios) < 0) {
+		ret = -errno;
+		vt_screen_uninit(screen);
+		return ret;
+	}
+
+	// raw mode allows to use certain combinations like Control+S which
+	// otherwise would raise a signal
+	struct termios raw = screen->saved_termios;
+	cfmakeraw(&raw);
+	if (tcsetattr(input_fd, TCSAFLUSH, &raw) < 0) {
+		ret = -errno;
+		vt_screen_uninit(screen);
+		return ret;
+	}
+	screen->raw_mode = 1;
+
+	// alternate screen, so we leave the terminal as we found it
+	write_all(output_fd, "\033[?1049h", strlen("\033[?1049h"));
+
+	return 0;
+}
+
+void vt_terminal_uninit(struct vt_screen *screen)
+{
+	const char *restore = "\033[0m\033[?25h\033[?1049l";
+	write_all(screen->output_fd, restore, strlen(restore));
+	if (screen->raw_mode)
+		tcsetattr(screen->input_fd, TCSAFLUSH, &screen->saved_termios);
+
+	vt_screen_uninit(screen);
+}
+
+//---------------------------------------------------------------------------------------//
+
+// Functions that implement the display_object interface defined at common/display.h
+
+static int vt_display_init(struct display_object *self, int nlines, int ncols, int y, int x)
+{
+	struct vt_display_data *p = (struct vt_display_data *)malloc(sizeof(struct vt_display_data));
+	if (p == NULL)
+		return -errno;
+
+	p->screen = (struct vt_screen *)self->screen;
+	if (y + nlines > p->screen->nlines || x + ncols > p->screen->ncols) {
+		free(p);
+		return -EINVAL;
+	}
+	p->y = y;
+	p->x = x;
+
+	self->data = (void *)p;
+	self->nlines = nlines;
+	self->ncols = ncols;
+
+	return 0;
+}
+
+static void vt_display_uninit(struct display_object *self)
+{
+	free(self->data);
+}
+
+static void vt_display_clear_line(struct display_object *self, int y, int x)
+{
+	struct vt_display_data *p = (struct vt_display_data *)self->data;
+	struct vt_screen *screen = p->screen;
+	if (y < 0 || y >= self->nlines || x < 0 || x >= self->ncols)
+		return;
+
+	fill_cells(&screen->back[(p->y + y) * screen->ncols + p->x + x], self->ncols - x);
+}
+
+static void vt_display_clear(struct display_object *self)
+{
+	for (int y = 0; y < self->nlines; y++)
+		vt_display_clear_line(self, y, 0);
+}
+
+static void vt_display_put_str
+(struct display_object *self, int y, int x, const char *str, int n, int attributes)
+{
+	struct vt_display_data *p = (struct vt_display_data *)self->data;
+	struct vt_screen *screen = p->screen;
+	if (y < 0 || y >= self->nlines || x < 0)
+		return;
+
+	struct vt_cell *line = &screen->back[(p->y + y) * screen->ncols + p->x];
+	for (int i = 0; i < n && str[i] != '\0' && x < self->ncols;) {
+		unsigned char c = str[i];
+		if (c == '\t') {
+			int tab_end = (x / SPACES_IN_A_TAB + 1) * SPACES_IN_A_TAB;
+			for (; x < tab_end && x < self->ncols; x++) {
+				line[x] = blank_cell;
+				line[x].attributes = attributes;
+			}
+			i++;
+			continue;
+		}
+
+		memset(line[x].c, '\0', VT_CELL_BYTES);
+		line[x].attributes = attributes;
+		uint32_t code_point;
+		int length = (c < 0x80) ? 1 : utf8_decode(&str[i], n - i, &code_point);
+		if (c < 0x80)
+			line[x].c[0] = (c < ' ' || c == 127) ? '?' : c;
+		// a byte that isn't part of a valid sequence
+		else if (length == 0) {
+			line[x].c[0] = '?';
+			length = 1;
+		}
+		else if (takes_one_column(code_point))
+			memcpy(line[x].c, &str[i], length);
+		else
+			line[x].c[0] = '?';
+		i += length;
+		x++;
+	}
+}
+
+static void vt_display_move_cursor(struct display_object *self, int y, int x)
+{
+	struct vt_display_data *p = (struct vt_display_data *)self->data;
+	p->screen->cursor_y = p->y + y;
+	p->screen->cursor_x = p->x + x;
+}
+
+static void vt_display_show_cursor(struct display_object *self, int show)
+{
+	struct vt_display_data *p = (struct vt_display_data *)self->data;
+	p->screen->cursor_visible = show;
+}
+
+static void vt_display_flush(struct display_object *self)
+{
+	struct vt_display_data *p = (struct vt_display_data *)self->data;
+	vt_screen_flush(p->screen);
+}
+
+static int vt_display_get_key(struct display_object *self, int timeout_ms)
+{
+	struct vt_display_data *p = (struct vt_display_data *)self->data;
+	struct vt_screen *screen = p->screen;
+	if (screen->input_fd < 0 || read_input(screen, 1, timeout_ms) < 0)
+		return DISPLAY_NO_KEY;
+
+	unsigned char c = screen->input[0];
+	switch (c) {
+		case ESCAPE_KEY:
+			return read_escape_sequence(screen);
+		case 127:
+		case '\b':
+			consume_input(screen, 1);
+			return KEY_BACKSPACE;
+		// like ncurses does in nl() mode
+		case '\r':
+			consume_input(screen, 1);
+			return '\n';
+		default:
+			consume_input(screen, 1);
+			return c;
+	}
+}
+
+struct display_object vt_display_object = {
+	.data = NULL,
+	.screen = NULL,
+	.init = vt_display_init,
+	.uninit = vt_display_uninit,
+	.clear = vt_display_clear,
+	.clear_line = vt_display_clear_line,
+	.put_str = vt_display_put_str,
+	.move_cursor = vt_display_move_cursor,
+	.show_cursor = vt_display_show_cursor,
+	.flush = vt_display_flush,
+	.get_key = vt_display_get_key
+};
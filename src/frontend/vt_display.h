@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENANO_VT_DISPLAY_H
+#define ENANO_VT_DISPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <termios.h>
+
+#include <common/display.h>
+
+// the longest UTF-8 sequence
+#define VT_CELL_BYTES 4
+
+struct vt_cell {
+	// a character, as UTF-8. The bytes it doesn't use are '\0'
+	char c[VT_CELL_BYTES];
+	unsigned char attributes;
+};
+
+/*
+ * A screen we draw on without ncurses: displays draw on the back grid,
+ * and flush() compares it with the front grid (what the terminal shows)
+ * and sends the VT escape sequences for the differences with a single
+ * write(). A screen with output_fd < 0 is headless: frames are computed
+ * (and their size accounted) but not sent anywhere.
+ */
+struct vt_screen {
+	int input_fd;
+	int output_fd;
+	int nlines;
+	int ncols;
+	struct vt_cell *back;
+	struct vt_cell *front;
+	// scratch space to find rows that moved: nlines hashes for each grid
+	uint64_t *back_hashes;
+	uint64_t *front_hashes;
+	// where the cursor should be after the next flush()
+	int cursor_y;
+	int cursor_x;
+	char cursor_visible;
+
+	// what we know about the terminal: -1 means unknown
+	// if front_is_stale, the next frame starts by clearing the terminal
+	char front_is_stale;
+	int term_y;
+	int term_x;
+	int term_attributes;
+	int term_cursor_visible;
+
+	// the frame being built
+	char *out;
+	size_t out_length;
+	size_t out_size;
+
+	// bytes read but not returned by get_key() yet
+	unsigned char input[32];
+	size_t input_length;
+
+	char raw_mode;
+	struct termios saved_termios;
+};
+
+extern struct display_object vt_display_object;
+
+static inline int vt_cell_length(const struct vt_cell *cell)
+{
+	int length = 1;
+	while (length < VT_CELL_BYTES && cell->c[length] != '\0')
+		length++;
+
+	return length;
+}
+
+int vt_screen_init(struct vt_screen *screen, int input_fd, int output_fd, int nlines, int ncols);
+void vt_screen_uninit(struct vt_screen *screen);
+// computes the next frame into screen->out (out_length is set to its
+// size), without writing it anywhere
+void vt_screen_render(struct vt_screen *screen);
+// renders and sends the next frame to output_fd
+void vt_screen_flush(struct vt_screen *screen);
+
+// take over and give back the terminal behind the given fds
+int vt_terminal_init(struct vt_screen *screen, int input_fd, int output_fd);
+void vt_terminal_uninit(struct vt_screen *screen);
+
+#endif /* ENANO_VT_DISPLAY_H */
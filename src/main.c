@@ -15,13 +15,86 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include <common/remote.h>
 #include <frontend/editor.h>
+#include <frontend/server.h>
+
+static void usage(const char *program_name)
+{
+	printf("usage: %s [-t trace.json] [-l latency_report] [-r ncurses|vt] [-m cache_MB] [-x] file\n"
+		"       %s [-l latency_report] [-r ncurses|vt] [-s socket] -a file\n"
+		"       %s [-t trace.json] [-m cache_MB] [-x] [-s socket] -S\n",
+		program_name, program_name, program_name);
+}
 
 int main(int argc, char **argv)
 {
-	if (argc != 2) {
-		printf("error\n");
+	struct editor_options options = {
+		.trace_path = NULL,
+		.latency_report_path = NULL,
+		.renderer = RENDERER_NCURSES,
+		.line_cache_budget = 0,
+		.hex_view = 0
+	};
+	// attach to an editor server, or be one
+	char attach = 0, serve = 0;
+	char socket_path[256];
+	remote_default_socket_path(socket_path, sizeof(socket_path));
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:l:r:m:s:xaS")) != -1) {
+		switch (opt) {
+			case 't':
+				options.trace_path = optarg;
+			break;
+			case 'l':
+				options.latency_report_path = optarg;
+			break;
+			case 'r':
+				if (strcmp(optarg, "vt") == 0)
+					options.renderer = RENDERER_VT;
+				else if (strcmp(optarg, "ncurses") == 0)
+					options.renderer = RENDERER_NCURSES;
+				else {
+					usage(argv[0]);
+					return 1;
+				}
+			break;
+			case 'm':
+				options.line_cache_budget = strtoull(optarg, NULL, 10) * 1024 * 1024;
+			break;
+			case 'x':
+				options.hex_view = 1;
+			break;
+			case 's':
+				snprintf(socket_path, sizeof(socket_path), "%s", optarg);
+			break;
+			case 'a':
+				attach = 1;
+			break;
+			case 'S':
+				serve = 1;
+			break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (serve) {
+		if (attach || optind != argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		run_server(socket_path, &options);
+		return 0;
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
 		return 1;
 	}
 	/*initscr();
@@ -40,6 +113,9 @@ int main(int argc, char **argv)
 	//endwin();
 	//struct single_file_editor_data p;
 	//return init_single_file_editor(&p, argv[1], 80, 80, 0, 0);
-	run_editor(argv[1]);
+	if (attach)
+		run_client(argv[optind], socket_path, &options);
+	else
+		run_editor(argv[optind], &options);
 	return 0;
 }
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2024 Daniel Martin <dalmemail@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs enano inside a pseudo terminal, feeds it a scripted workload one
+ * key at a time and measures, from the outside, the time between writing
+ * each key and the terminal receiving the last byte of the resulting frame.
+ * enano is started in its latency measurement mode (-l) too, so we can
+ * compare what the user sees with what the editor measured itself.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ctrl(x)           ((x) & 0x1f)
+
+// a frame is considered complete once the terminal has been quiet this long
+#define FRAME_QUIET_MS 5
+// a key that doesn't produce any output in this time is counted as lost
+#define KEY_TIMEOUT_MS 1000
+
+// what the keys send with the keypad in "application" mode (as enano sets it)
+#define KEY_SEQUENCE_DOWN "\033OB"
+#define KEY_SEQUENCE_UP "\033OA"
+#define KEY_SEQUENCE_BACKSPACE "\177"
+
+struct workload {
+	const char *name;
+	// returns the key sequence to send for the i-th key
+	const char *(*next_key)(unsigned int i);
+};
+
+static const char *next_key_type(unsigned int i)
+{
+	static char key[2];
+	// break the line every now and then, like a human would
+	key[0] = (i % 60 == 59) ? '\n' : 'a' + (i % 26);
+	return key;
+}
+
+static const char *next_key_scroll(unsigned int i)
+{
+	// go down the file and come back up again
+	return ((i / 200) % 2 == 0) ? KEY_SEQUENCE_DOWN : KEY_SEQUENCE_UP;
+}
+
+static const char *next_key_mixed(unsigned int i)
+{
+	switch (i % 8) {
+		case 5:
+			return KEY_SEQUENCE_BACKSPACE;
+		case 6:
+			return KEY_SEQUENCE_DOWN;
+		case 7:
+			return "\n";
+		default:
+			return next_key_type(i);
+	}
+}
+
+static struct workload workloads[] = {
+	{ "type", next_key_type },
+	{ "scroll", next_key_scroll },
+	{ "mixed", next_key_mixed }
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_uint64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// reads everything the editor writes until it stays quiet for quiet_ms.
+// Returns the time the last byte was read, or 0 if nothing arrived
+// in timeout_ms. The number of bytes read is added to *n_bytes
+static uint64_t drain_frame(int fd, int quiet_ms, int timeout_ms, uint64_t *n_bytes)
+{
+	char buf[65536];
+	uint64_t last_byte_ns = 0;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int wait_ms = timeout_ms;
+	while (poll(&pfd, 1, wait_ms) > 0) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n <= 0)
+			break;
+
+		last_byte_ns = now_ns();
+		*n_bytes += n;
+		wait_ms = quiet_ms;
+	}
+
+	return last_byte_ns;
+}
+
+static void usage(const char *program_name)
+{
+	fprintf(stderr, "usage: %s [-w type|scroll|mixed] [-n keys] [-r ncurses|vt] enano file\n",
+		program_name);
+}
+
+int main(int argc, char **argv)
+{
+	struct workload *workload = &workloads[0];
+	unsigned int n_keys = 1000;
+	const char *renderer = "ncurses";
+
+	int opt;
+	while ((opt = getopt(argc, argv, "w:n:r:")) != -1) {
+		switch (opt) {
+			case 'w':
+				workload = NULL;
+				for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+					if (strcmp(optarg, workloads[i].name) == 0)
+						workload = &workloads[i];
+				if (workload == NULL) {
+					usage(argv[0]);
+					return 1;
+				}
+			break;
+			case 'n':
+				n_keys = strtoul(optarg, NULL, 10);
+			break;
+			case 'r':
+				renderer = optarg;
+			break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind != argc - 2 || n_keys == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	char report_path[] = "/tmp/enano-latency-XXXXXX";
+	int report_fd = mkstemp(report_path);
+	if (report_fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(report_fd);
+
+	uint64_t *latencies = (uint64_t *)malloc(n_keys * sizeof(uint64_t));
+	if (latencies == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	struct winsize window_size = { .ws_row = 24, .ws_col = 80 };
+	int master_fd;
+	pid_t pid = forkpty(&master_fd, NULL, NULL, &window_size);
+	if (pid < 0) {
+		perror("forkpty");
+		return 1;
+	}
+	if (pid == 0) {
+		setenv("TERM", "xterm", 1);
+		execl(argv[optind], argv[optind], "-l", report_path, "-r", renderer,
+			argv[optind + 1], NULL);
+		_exit(127);
+	}
+
+	// wait for the first frame
+	uint64_t n_bytes = 0;
+	if (drain_frame(master_fd, 200, 5000, &n_bytes) == 0) {
+		fprintf(stderr, "enano didn't draw anything\n");
+		kill(pid, SIGKILL);
+		return 1;
+	}
+
+	n_bytes = 0;
+	unsigned int n_lost = 0;
+	size_t n_latencies = 0;
+	for (unsigned int i = 0; i < n_keys; i++) {
+		const char *key = workload->next_key(i);
+		uint64_t start_ns = now_ns();
+		if (write(master_fd, key, strlen(key)) < 0) {
+			perror("write");
+			break;
+		}
+
+		uint64_t end_ns = drain_frame(master_fd, FRAME_QUIET_MS, KEY_TIMEOUT_MS, &n_bytes);
+		if (end_ns == 0)
+			n_lost++;
+		else
+			latencies[n_latencies++] = end_ns - start_ns;
+	}
+
+	char quit = ctrl('x');
+	if (write(master_fd, &quit, 1) < 0)
+		perror("write");
+	uint64_t exit_bytes = 0;
+	drain_frame(master_fd, 100, 1000, &exit_bytes);
+	int status;
+	waitpid(pid, &status, 0);
+
+	qsort(latencies, n_latencies, sizeof(uint64_t), compare_uint64);
+	printf("workload %s, %s renderer, %u keys (%u without output)\n",
+		workload->name, renderer, n_keys, n_lost);
+	printf("terminal output: %.1f bytes per key\n", (double)n_bytes / n_keys);
+	if (n_latencies > 0) {
+		// the frame is only known to be complete FRAME_QUIET_MS after its
+		// last byte, but that wait isn't part of the latency
+		printf("key to last frame byte: p50 %.1fus p99 %.1fus max %.1fus\n",
+			latencies[n_latencies / 2] / 1000.0,
+			latencies[(size_t)(n_latencies * 0.99)] / 1000.0,
+			latencies[n_latencies - 1] / 1000.0);
+	}
+
+	FILE *report = fopen(report_path, "r");
+	if (report != NULL) {
+		char line[128];
+		printf("as measured by enano (wgetch to flush):\n");
+		while (fgets(line, sizeof(line), report))
+			printf("  %s", line);
+		fclose(report);
+	}
+	unlink(report_path);
+	free(latencies);
+
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : 1;
+}